@@ -0,0 +1,598 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-bench.cc
+ * @brief Microbenchmarks for the capture, bookkeeping and replay costs.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ *
+ * Each benchmark runs against a new in-memory database and reports the
+ * median of several runs. The results are written as a json document:
+ *
+ * @code
+ * {"benchmark":"resqliteun","sqlite":"3.45.1","rows":10000,"repeat":5,
+ *  "results":[
+ *  {"name":"capture","op":"insert","update_kind":1,"columns":8,...},
+ *  ...]}
+ * @endcode
+ *
+ * Usage: `resqliteun_bench [--rows N] [--repeat N] [--depth N]
+ * [--threads N] [--opens N] [--output FILE]`.
+ */
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <sqlite/sqlite3.h>
+
+#include <resqliteun/resqliteun.h>
+#include <resqliteun/resqliteun-manager.h>
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QThread>
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+//! The settings of a run.
+struct BenchOptions {
+    int rows; /**< rows changed by the capture benchmarks */
+    int repeat; /**< runs of each measurement (the median is reported) */
+    int depth; /**< largest history used by the begin/end benchmark */
+    int threads; /**< threads that open and close connections at once */
+    int opens; /**< connections opened and closed by all these threads */
+    const char * output; /**< the file that receives the json (NULL for stdout) */
+};
+
+//! A result; the fields are kept as json text.
+class BenchResult {
+public:
+    //! Constructor.
+    BenchResult (const char * name) :
+        fields_ ()
+    {
+        set ("name", name);
+    }
+
+    //! Add a string field.
+    BenchResult & set (const char * key, const char * value) {
+        fields_.append (",\"").append (key).append ("\":\"")
+                .append (value).append ('"');
+        return *this;
+    }
+
+    //! Add an integer field.
+    BenchResult & set (const char * key, qint64 value) {
+        fields_.append (",\"").append (key).append ("\":")
+                .append (QByteArray::number (value));
+        return *this;
+    }
+
+    //! Add a real field.
+    BenchResult & set (const char * key, double value) {
+        fields_.append (",\"").append (key).append ("\":")
+                .append (QByteArray::number (value, 'f', 1));
+        return *this;
+    }
+
+    //! The json object.
+    QByteArray json () const {
+        return "{" + fields_.mid (1) + "}";
+    }
+
+private:
+    QByteArray fields_;
+};
+
+//! The results of all benchmarks.
+static QList<BenchResult> bench_results;
+
+//! The kinds of update tracking (see ReSqliteUnUtil::UpdateBehaviour).
+static const int update_kinds[] = {
+    ReSqliteUnUtil::NoTriggerForUpdate,
+    ReSqliteUnUtil::OneTriggerPerUpdatedTable,
+    ReSqliteUnUtil::OneTriggerPerUpdatedColumn
+};
+
+//! Number of columns of the tables used by the capture benchmarks.
+static const int table_widths[] = { 10, 50, 200 };
+
+//! Rows changed by the entries used by the undo/redo benchmark.
+static const int step_sizes[] = { 1, 10, 100, 1000, 10000 };
+
+//! Number of tables attached at once by `resqun_tables`.
+static const int table_counts[] = { 1, 10, 50, 150 };
+
+#define ARRAY_SIZE(a) (int)(sizeof(a) / sizeof(a[0]))
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  FUNCTIONS    ----------------------------------------------------------- */
+
+/* ------------------------------------------------------------------------- */
+//! Run some statements; a failure ends the program.
+static void exec (sqlite3 * db, const QByteArray & sql)
+{
+    char * err_msg = NULL;
+    if (sqlite3_exec (db, sql.constData (), NULL, NULL, &err_msg) != SQLITE_OK) {
+        fprintf (stderr, "resqliteun_bench: %s\n  in: %s\n",
+                 err_msg != NULL ? err_msg : "error", sql.constData ());
+        sqlite3_free (err_msg);
+        exit (1);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Run some statements and tell how long it took, in nanoseconds.
+static qint64 timed (sqlite3 * db, const QByteArray & sql)
+{
+    QElapsedTimer timer;
+    timer.start ();
+    exec (db, sql);
+    return timer.nsecsElapsed ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! A new in-memory database (with the extension, once it is registered).
+static sqlite3 * openDatabase ()
+{
+    sqlite3 * db = NULL;
+    if (sqlite3_open (":memory:", &db) != SQLITE_OK) {
+        fprintf (stderr, "resqliteun_bench: cannot open a database\n");
+        exit (1);
+    }
+    return db;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! The median of some samples.
+static qint64 median (QList<qint64> samples)
+{
+    if (samples.isEmpty ()) {
+        return 0;
+    }
+    std::sort (samples.begin (), samples.end ());
+    return samples.at (samples.count () / 2);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Create table @a name with an integer key and @a width columns in total.
+static void createTable (sqlite3 * db, const char * name, int width)
+{
+    QByteArray sql = QByteArray ("CREATE TABLE ") + name +
+            "(id INTEGER PRIMARY KEY";
+    for (int i = 1; i < width; ++i) {
+        sql.append (",c").append (QByteArray::number (i));
+    }
+    exec (db, sql + ");");
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Insert @a rows rows in table `t`, alternating integers and text.
+static QByteArray insertRows (int width, int rows)
+{
+    QByteArray columns ("id");
+    QByteArray values ("i");
+    for (int i = 1; i < width; ++i) {
+        columns.append (",c").append (QByteArray::number (i));
+        values.append (i % 2 ? ",i*" : ",'value '||i*")
+                .append (QByteArray::number (i));
+    }
+    return "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n "
+            "WHERE i<" + QByteArray::number (rows) + ") "
+            "INSERT INTO t(" + columns + ") SELECT " + values + " FROM n;";
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! The statement that changes one column of every row of table `t`.
+static QByteArray updateRows (int width)
+{
+    return width > 1 ? "UPDATE t SET c1=c1+1;" : "UPDATE t SET id=-id;";
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * For each kind of update tracking and each width the same inserts,
+ * updates and deletes are timed on a table that is not attached, on one
+ * that is attached while no entry is in progress (the triggers only exist
+ * inside entries, so this should cost nothing) and on one that is
+ * attached, inside an entry; the difference, divided by the number of
+ * rows, is the cost of recording a row. The `resqun_begin` and
+ * `resqun_end` calls are not part of the time.
+ */
+static void benchCapture (const BenchOptions & options)
+{
+    static const char * ops[] = { "insert", "update", "delete" };
+    for (int k = 0; k < ARRAY_SIZE(update_kinds); ++k) {
+        for (int w = 0; w < ARRAY_SIZE(table_widths); ++w) {
+            int width = table_widths[w];
+            QByteArray statements[3] = {
+                insertRows (width, options.rows),
+                updateRows (width),
+                // A WHERE clause keeps sqlite from truncating the table.
+                "DELETE FROM t WHERE id>0;"
+            };
+            QList<qint64> plain[3];
+            QList<qint64> idle[3];
+            QList<qint64> tracked[3];
+            for (int r = 0; r < options.repeat; ++r) {
+                sqlite3 * db = openDatabase ();
+                createTable (db, "t", width);
+                for (int op = 0; op < 3; ++op) {
+                    plain[op].append (timed (db, statements[op]));
+                }
+                sqlite3_close (db);
+
+                db = openDatabase ();
+                createTable (db, "t", width);
+                exec (db, "SELECT resqun_table('t'," +
+                      QByteArray::number (update_kinds[k]) + ");");
+                for (int op = 0; op < 3; ++op) {
+                    idle[op].append (timed (db, statements[op]));
+                }
+                sqlite3_close (db);
+
+                db = openDatabase ();
+                createTable (db, "t", width);
+                exec (db, "SELECT resqun_table('t'," +
+                      QByteArray::number (update_kinds[k]) + ");");
+                for (int op = 0; op < 3; ++op) {
+                    exec (db, "SELECT resqun_begin('bench');");
+                    tracked[op].append (timed (db, statements[op]));
+                    exec (db, "SELECT resqun_end(0);");
+                }
+                sqlite3_close (db);
+            }
+            for (int op = 0; op < 3; ++op) {
+                double base = (double)median (plain[op]) / options.rows;
+                double unused = (double)median (idle[op]) / options.rows;
+                double with = (double)median (tracked[op]) / options.rows;
+                bench_results.append (
+                            BenchResult ("capture")
+                            .set ("op", ops[op])
+                            .set ("update_kind", (qint64)update_kinds[k])
+                            .set ("columns", (qint64)width)
+                            .set ("rows", (qint64)options.rows)
+                            .set ("plain_ns_per_row", base)
+                            .set ("idle_ns_per_row", unused)
+                            .set ("idle_overhead_ns_per_row", unused - base)
+                            .set ("tracked_ns_per_row", with)
+                            .set ("overhead_ns_per_row", with - base));
+            }
+        }
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The history grows by entries that insert a row; at each depth
+ * (powers of ten up to the limit in the options) `resqun_begin` and
+ * `resqun_end` of a few more such entries are timed.
+ */
+static void benchBeginEnd (const BenchOptions & options)
+{
+    sqlite3 * db = openDatabase ();
+    createTable (db, "t", 4);
+    exec (db, "SELECT resqun_table('t',1);");
+    const int samples = qMax (options.repeat, 20);
+    int entries = 0;
+    for (int depth = 0; depth <= options.depth;
+         depth = (depth == 0 ? 10 : depth * 10)) {
+        while (entries < depth) {
+            exec (db, "SELECT resqun_begin('grow');"
+                      "INSERT INTO t(c1) VALUES(1);"
+                      "SELECT resqun_end(0);");
+            ++entries;
+        }
+        QList<qint64> begin_ns;
+        QList<qint64> end_ns;
+        for (int i = 0; i < samples; ++i) {
+            begin_ns.append (timed (db, "SELECT resqun_begin('bench');"));
+            exec (db, "INSERT INTO t(c1) VALUES(2);");
+            end_ns.append (timed (db, "SELECT resqun_end(0);"));
+            ++entries;
+        }
+        bench_results.append (
+                    BenchResult ("begin_end")
+                    .set ("depth", (qint64)depth)
+                    .set ("samples", (qint64)samples)
+                    .set ("begin_ns", median (begin_ns))
+                    .set ("end_ns", median (end_ns)));
+    }
+    sqlite3_close (db);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * An entry that inserts, updates or deletes a number of rows is undone
+ * and redone a few times; the first undo and redo also prepare the
+ * statements, so they are reported apart from the median.
+ */
+static void benchUndoRedo (const BenchOptions & options)
+{
+    static const char * ops[] = { "insert", "update", "delete" };
+    for (int s = 0; s < ARRAY_SIZE(step_sizes); ++s) {
+        int size = step_sizes[s];
+        for (int op = 0; op < 3; ++op) {
+            sqlite3 * db = openDatabase ();
+            createTable (db, "t", 8);
+            if (op != 0) {
+                exec (db, insertRows (8, size));
+            }
+            exec (db, "SELECT resqun_table('t',1);");
+            exec (db, "SELECT resqun_begin('bench');");
+            exec (db, op == 0 ? insertRows (8, size) :
+                      op == 1 ? updateRows (8) :
+                                QByteArray ("DELETE FROM t WHERE id>0;"));
+            exec (db, "SELECT resqun_end(0);");
+
+            qint64 first_undo = timed (db, "SELECT resqun_undo();");
+            qint64 first_redo = timed (db, "SELECT resqun_redo();");
+            QList<qint64> undo_ns;
+            QList<qint64> redo_ns;
+            for (int r = 0; r < options.repeat; ++r) {
+                undo_ns.append (timed (db, "SELECT resqun_undo();"));
+                redo_ns.append (timed (db, "SELECT resqun_redo();"));
+            }
+            bench_results.append (
+                        BenchResult ("undo_redo")
+                        .set ("op", ops[op])
+                        .set ("rows", (qint64)size)
+                        .set ("first_undo_ns", first_undo)
+                        .set ("first_redo_ns", first_redo)
+                        .set ("undo_ns", median (undo_ns))
+                        .set ("redo_ns", median (redo_ns)));
+            sqlite3_close (db);
+        }
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * `resqun_table` is timed on a new database for each width and kind of
+ * update tracking (the first call also creates the journal), and
+ * `resqun_tables` for a growing number of tables.
+ */
+static void benchAttach (const BenchOptions & options)
+{
+    for (int k = 0; k < ARRAY_SIZE(update_kinds); ++k) {
+        for (int w = 0; w < ARRAY_SIZE(table_widths); ++w) {
+            QList<qint64> samples;
+            for (int r = 0; r < options.repeat; ++r) {
+                sqlite3 * db = openDatabase ();
+                createTable (db, "t", table_widths[w]);
+                samples.append (timed (db, "SELECT resqun_table('t'," +
+                                       QByteArray::number (update_kinds[k]) +
+                                       ");"));
+                sqlite3_close (db);
+            }
+            bench_results.append (
+                        BenchResult ("attach")
+                        .set ("update_kind", (qint64)update_kinds[k])
+                        .set ("columns", (qint64)table_widths[w])
+                        .set ("ns", median (samples)));
+        }
+    }
+
+    for (int c = 0; c < ARRAY_SIZE(table_counts); ++c) {
+        QList<qint64> samples;
+        for (int r = 0; r < options.repeat; ++r) {
+            sqlite3 * db = openDatabase ();
+            for (int i = 0; i < table_counts[c]; ++i) {
+                createTable (db, ("t" + QByteArray::number (i)).constData (), 8);
+            }
+            samples.append (timed (db, "SELECT resqun_tables('t%',1);"));
+            sqlite3_close (db);
+        }
+        bench_results.append (
+                    BenchResult ("attach_many")
+                    .set ("tables", (qint64)table_counts[c])
+                    .set ("columns", (qint64)8)
+                    .set ("ns", median (samples)));
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! The time needed to open and close a connection.
+static qint64 openCloseNs (int count)
+{
+    QList<qint64> samples;
+    for (int i = 0; i < count; ++i) {
+        QElapsedTimer timer;
+        timer.start ();
+        sqlite3 * db = openDatabase ();
+        sqlite3_close (db);
+        samples.append (timer.nsecsElapsed ());
+    }
+    return median (samples);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! A thread that opens connections, records an entry in each and closes it.
+class BenchOpenThread : public QThread {
+public:
+    int count_; /**< connections to open */
+
+    BenchOpenThread (int count) :
+        QThread (),
+        count_ (count)
+    {}
+
+protected:
+    virtual void run () {
+        for (int i = 0; i < count_; ++i) {
+            sqlite3 * db = openDatabase ();
+            exec (db, "CREATE TABLE t(a);"
+                      "SELECT resqun_table('t',1);"
+                      "SELECT resqun_begin('stress');"
+                      "INSERT INTO t VALUES(1);"
+                      "SELECT resqun_end(0);");
+            sqlite3_close (db);
+        }
+    }
+};
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Several threads open connections with the extension at the same time,
+ * use the instance of each one and close it; the registry of instances
+ * must be back where it started once they are done.
+ */
+static void benchOpenStress (const BenchOptions & options)
+{
+    int per_thread = qMax (1, options.opens / options.threads);
+    int instances = ReSqliteUnManager::instanceCount ();
+    QList<BenchOpenThread *> threads;
+    for (int i = 0; i < options.threads; ++i) {
+        threads.append (new BenchOpenThread (per_thread));
+    }
+    QElapsedTimer timer;
+    timer.start ();
+    foreach (BenchOpenThread * thread, threads) {
+        thread->start ();
+    }
+    foreach (BenchOpenThread * thread, threads) {
+        thread->wait ();
+    }
+    qint64 wall = timer.nsecsElapsed ();
+    qDeleteAll (threads);
+
+    int left = ReSqliteUnManager::instanceCount () - instances;
+    if (left != 0) {
+        fprintf (stderr, "resqliteun_bench: %d instances were not "
+                         "released by the stress test\n", left);
+        exit (1);
+    }
+    qint64 total = (qint64)per_thread * options.threads;
+    bench_results.append (
+                BenchResult ("open_close_threads")
+                .set ("threads", (qint64)options.threads)
+                .set ("opens", total)
+                .set ("wall_ns", wall)
+                .set ("ns_per_open", (double)wall * options.threads / total));
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! The json document with all results.
+static QByteArray report (const BenchOptions & options)
+{
+    QByteArray result ("{\"benchmark\":\"resqliteun\",\"sqlite\":\"");
+    result.append (sqlite3_libversion ());
+    result.append ("\",\"rows\":").append (QByteArray::number (options.rows));
+    result.append (",\"repeat\":").append (QByteArray::number (options.repeat));
+    result.append (",\"results\":[");
+    for (int i = 0; i < bench_results.count (); ++i) {
+        result.append (i == 0 ? "\n" : ",\n");
+        result.append (bench_results.at (i).json ());
+    }
+    result.append ("\n]}\n");
+    return result;
+}
+/* ========================================================================= */
+
+/*  FUNCTIONS    =========================================================== */
+//
+//
+//
+//
+/* ------------------------------------------------------------------------- */
+int main (int argc, char ** argv)
+{
+    BenchOptions options;
+    options.rows = 10000;
+    options.repeat = 5;
+    options.depth = 10000;
+    options.threads = 8;
+    options.opens = 4000;
+    options.output = NULL;
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (has_value && (strcmp (argv[i], "--rows") == 0)) {
+            options.rows = qMax (1, atoi (argv[++i]));
+        } else if (has_value && (strcmp (argv[i], "--repeat") == 0)) {
+            options.repeat = qMax (1, atoi (argv[++i]));
+        } else if (has_value && (strcmp (argv[i], "--depth") == 0)) {
+            options.depth = qMax (0, atoi (argv[++i]));
+        } else if (has_value && (strcmp (argv[i], "--threads") == 0)) {
+            options.threads = qMax (1, atoi (argv[++i]));
+        } else if (has_value && (strcmp (argv[i], "--opens") == 0)) {
+            options.opens = qMax (1, atoi (argv[++i]));
+        } else if (has_value && (strcmp (argv[i], "--output") == 0)) {
+            options.output = argv[++i];
+        } else {
+            fprintf (stderr, "usage: %s [--rows N] [--repeat N] "
+                             "[--depth N] [--threads N] [--opens N] "
+                             "[--output FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // Connections opened before this don't get the extension.
+    const int opens = 200;
+    qint64 plain_open = openCloseNs (opens);
+    ReSqliteUnManager::autoregister ();
+    qint64 with_open = openCloseNs (opens);
+    bench_results.append (
+                BenchResult ("open_close")
+                .set ("plain_ns", plain_open)
+                .set ("extension_ns", with_open));
+
+    benchCapture (options);
+    benchBeginEnd (options);
+    benchUndoRedo (options);
+    benchAttach (options);
+    benchOpenStress (options);
+
+    QByteArray content = report (options);
+    if (options.output == NULL) {
+        fwrite (content.constData (), 1, content.size (), stdout);
+        return 0;
+    }
+    QFile f (QString::fromLocal8Bit (options.output));
+    if (!f.open (QIODevice::WriteOnly | QIODevice::Truncate) ||
+            (f.write (content) != content.size ())) {
+        fprintf (stderr, "resqliteun_bench: cannot write %s\n",
+                 options.output);
+        return 1;
+    }
+    return 0;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
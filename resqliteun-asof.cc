@@ -0,0 +1,913 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-asof.cc
+ * @brief Definitions for ReSqliteUnAsOf class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <sqlite/sqlite3.h>
+
+#include "resqliteun-asof.h"
+#include "resqliteun.h"
+#include "resqliteun-private.h"
+
+#include <QMap>
+#include <QVector>
+
+#include <assert.h>
+#include <string.h>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+#define STR_HELPER(x) #x
+#define STR(x) STR_HELPER(x)
+
+//! Records past every entry and every rowid.
+#define ASOF_NO_LIMIT Q_INT64_C(0x7fffffffffffffff)
+
+/**
+ * The records of the table (?1) in the entries after ?2 and before the
+ * first undone entry (?3); the undone entries are always the last ones.
+ */
+#define ASOF_APPLIED \
+    "WHERE tbl=?1 AND idxid>?2 AND idxid<?3 "
+
+//! The first snapshot of the table made after the entry.
+#define ASOF_SNAPSHOT \
+    "SELECT id FROM " RESQUN_TBL_TEMP " " ASOF_APPLIED \
+    "AND firstid IS NULL ORDER BY id LIMIT 1"
+
+//! The ranges inserted before record ?4 (all of them or those with ?5).
+#define ASOF_INSERTED \
+    "SELECT firstid,lastid,id FROM " RESQUN_TBL_TEMP " " ASOF_APPLIED \
+    "AND op=" STR(RESQUN_KIND_INSERT) " AND id<?4 " \
+    "AND (?5 IS NULL OR (firstid<=?5 AND lastid>=?5)) ORDER BY id"
+
+//! The other records of row ?5 made before record ?4, oldest first.
+#define ASOF_ROW_RECORDS \
+    "SELECT op,data FROM " RESQUN_TBL_TEMP " " ASOF_APPLIED \
+    "AND firstid=?5 AND op<>" STR(RESQUN_KIND_INSERT) " AND id<?4 " \
+    "ORDER BY id"
+
+//! The rows deleted before record ?4 that are not among the base rows.
+#define ASOF_DELETED \
+    "SELECT DISTINCT firstid FROM " RESQUN_TBL_TEMP " AS j " ASOF_APPLIED \
+    "AND op=" STR(RESQUN_KIND_DELETE) " AND id<?4 %s" \
+    "AND NOT EXISTS (SELECT 1 FROM %s) ORDER BY firstid"
+
+//! The constraints used by a plan; the arguments follow the order of bits.
+enum AsOfPlan {
+    plan_entry = 0x0001,
+    plan_rowid = 0x0002
+};
+
+//! A range of rows inserted after the entry.
+struct AsOfRange {
+    qint64 last; /**< last rowid in the range */
+    qint64 id; /**< the oldest record that inserted these rows */
+
+    AsOfRange (qint64 last_rowid = 0, qint64 record = 0) :
+        last (last_rowid), id (record) {}
+};
+
+//! What the journal tells about the current row.
+struct AsOfRow {
+    QList<QByteArray> images; /**< the decoded values point inside these */
+    QVector<ReSqliteUnRecord::Value> values; /**< by column; column is -1 if unknown */
+};
+
+//! The state of the journal for a filter.
+struct AsOfOverlay {
+    QMap<qint64, AsOfRange> inserted; /**< disjoint ranges, by first rowid */
+    qint64 undone; /**< the first undone entry */
+    qint64 snapshot; /**< shadow key of the base rows, 0 for the table */
+    qint64 limit; /**< records from this one on are not read */
+    AsOfRow row; /**< the current row */
+
+    AsOfOverlay () :
+        undone (ASOF_NO_LIMIT), snapshot (0), limit (ASOF_NO_LIMIT) {}
+};
+
+//! A `resqun_asof` table.
+struct AsOfTable {
+    sqlite3_vtab base; /**< must come first */
+    ReSqliteUn * undoer; /**< the instance that owns the journal */
+    char * name; /**< the table that is shown */
+    char * columns; /**< its columns, quoted and separated by commas */
+    int column_count; /**< number of columns (the hidden one not included) */
+    char * definition; /**< the sql of the table the columns were read from */
+    int schema_version; /**< `PRAGMA schema_version` when it was last checked (-1 for never) */
+};
+
+//! A cursor over a `resqun_asof` table.
+struct AsOfCursor {
+    sqlite3_vtab_cursor base; /**< must come first */
+    sqlite3_stmt * stmt; /**< the base rows */
+    sqlite3_stmt * records; /**< the records of a row (NULL without a journal) */
+    sqlite3_stmt * deleted; /**< the rows deleted after the entry */
+    AsOfOverlay * overlay; /**< the state of the journal */
+    bool eof; /**< no more rows */
+    bool in_base; /**< are base rows still being read? */
+    qint64 entry; /**< the entry (the argument of the table) */
+    qint64 rowid; /**< the rowid of current row */
+    const AsOfRow * row; /**< what the journal knows about it (may be NULL) */
+    bool has_base; /**< is current row in stmt? */
+};
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  FUNCTIONS    ----------------------------------------------------------- */
+
+/* ------------------------------------------------------------------------- */
+//! The name of the table given to `CREATE VIRTUAL TABLE`, without quotes.
+static QString unquote (const char * text)
+{
+    QString result = QString::fromUtf8 (text).trimmed ();
+    if ((result.length () >= 2) &&
+            (result.startsWith (QChar('"')) ||
+             result.startsWith (QChar('\'')) ||
+             result.startsWith (QChar('`')) ||
+             result.startsWith (QChar('[')))) {
+        result = result.mid (1, result.length () - 2);
+    }
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! The version of the schema of the connection.
+static int readSchemaVersion (sqlite3 * db, int & schema_version)
+{
+    sqlite3_stmt * stmt = NULL;
+    int rc = sqlite3_prepare_v2 (
+                db, "PRAGMA main.schema_version", -1, &stmt, NULL);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_step (stmt);
+        if (rc == SQLITE_ROW) {
+            schema_version = sqlite3_column_int (stmt, 0);
+            rc = SQLITE_OK;
+        }
+    }
+    sqlite3_finalize (stmt);
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Replace the error message of the table.
+static void setError (sqlite3_vtab * vtab, char * message)
+{
+    sqlite3_free (vtab->zErrMsg);
+    vtab->zErrMsg = message;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! The record that inserted the row after the entry (0 if none did).
+static qint64 insertedBy (const AsOfOverlay & overlay, qint64 rowid)
+{
+    QMap<qint64, AsOfRange>::const_iterator iter =
+            overlay.inserted.upperBound (rowid);
+    if (iter == overlay.inserted.constBegin ()) {
+        return 0;
+    }
+    --iter;
+    return rowid <= iter.value ().last ? iter.value ().id : 0;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The ranges are read oldest first, so a rowid that was reused belongs
+ * to the range that came first; only the parts of a new range that are
+ * not covered yet are added, as ranges.
+ */
+static void addInserted (
+        AsOfOverlay & overlay, qint64 first, qint64 last, qint64 id)
+{
+    QMap<qint64, AsOfRange>::const_iterator iter =
+            overlay.inserted.upperBound (first);
+    if (iter != overlay.inserted.constBegin ()) {
+        QMap<qint64, AsOfRange>::const_iterator previous = iter;
+        --previous;
+        if (previous.value ().last >= first) {
+            first = previous.value ().last + 1;
+        }
+    }
+    QList<qint64> gaps;
+    while (first <= last) {
+        if ((iter == overlay.inserted.constEnd ()) || (iter.key () > last)) {
+            gaps << first << last;
+            break;
+        }
+        if (iter.key () > first) {
+            gaps << first << iter.key () - 1;
+        }
+        first = iter.value ().last + 1;
+        ++iter;
+    }
+    for (int i = 0; i < gaps.count (); i += 2) {
+        overlay.inserted.insert (gaps.at (i), AsOfRange (gaps.at (i + 1), id));
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Take the values of an image for the columns that are not known yet.
+static bool mergeImage (
+        AsOfRow & row, const QByteArray & image, int column_count)
+{
+    const char * cursor = image.constData ();
+    const char * end = cursor + image.size ();
+    ReSqliteUnRecord::Value value;
+    while (cursor < end) {
+        if (!ReSqliteUnRecord::decode (cursor, end, value)) {
+            return false;
+        }
+        if ((value.column >= 0) && (value.column < column_count) &&
+                (row.values.at (value.column).column < 0)) {
+            row.values[value.column] = value;
+        }
+    }
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The records of the row are read oldest first, by the `(tbl, firstid)`
+ * index, and the first record that touches it decides what the row was
+ * after the entry: an insert means it did not exist, a delete gives all
+ * its values and an update gives the values of the columns it changed
+ * (the others are taken from later records or from the base rows). Only
+ * the records made before the snapshot that provides the base rows are
+ * read.
+ *
+ * @return error code
+ */
+static int loadRow (
+        AsOfCursor * cur, const AsOfTable * table, qint64 rowid,
+        bool & exists)
+{
+    AsOfOverlay & overlay = *cur->overlay;
+    qint64 inserted = insertedBy (overlay, rowid);
+    exists = (inserted == 0);
+    cur->row = NULL;
+    if (cur->records == NULL) {
+        return SQLITE_OK;
+    }
+
+    sqlite3_stmt * stmt = cur->records;
+    sqlite3_bind_int64 (stmt, 4, inserted != 0 ? inserted : overlay.limit);
+    sqlite3_bind_int64 (stmt, 5, rowid);
+    AsOfRow & row = overlay.row;
+    int rc;
+    for (;;) {
+        rc = sqlite3_step (stmt);
+        if (rc != SQLITE_ROW) {
+            break;
+        }
+        if (cur->row == NULL) {
+            ReSqliteUnRecord::Value unknown;
+            memset (&unknown, 0, sizeof(unknown));
+            unknown.column = -1;
+            unknown.type = SQLITE_NULL;
+            row.images.clear ();
+            row.values.fill (unknown, table->column_count);
+            cur->row = &row;
+            exists = true;
+        }
+
+        row.images.append (QByteArray (
+                    static_cast<const char *>(sqlite3_column_blob (stmt, 1)),
+                    sqlite3_column_bytes (stmt, 1)));
+        if (!mergeImage (row, row.images.last (), table->column_count)) {
+            rc = SQLITE_CORRUPT;
+            break;
+        }
+        if (sqlite3_column_int (stmt, 0) == ReSqliteUnRecord::DeleteKind) {
+            rc = SQLITE_DONE;
+            break;
+        }
+    }
+    sqlite3_reset (stmt);
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The base rows (the table or the shadow rows of a snapshot) are read
+ * first; rows inserted after the entry are skipped and rows changed after
+ * it get their old values. The rows deleted after the entry are produced
+ * at the end, by rowid.
+ *
+ * @return error code
+ */
+static int asofAdvance (AsOfCursor * cur)
+{
+    const AsOfTable * table = reinterpret_cast<AsOfTable *>(cur->base.pVtab);
+    bool exists;
+    int rc;
+    while (cur->in_base) {
+        rc = sqlite3_step (cur->stmt);
+        if (rc != SQLITE_ROW) {
+            if (rc != SQLITE_DONE) {
+                return rc;
+            }
+            cur->in_base = false;
+            break;
+        }
+
+        cur->rowid = sqlite3_column_int64 (cur->stmt, 0);
+        rc = loadRow (cur, table, cur->rowid, exists);
+        if (rc != SQLITE_OK) {
+            return rc;
+        }
+        if (exists) {
+            cur->has_base = true;
+            return SQLITE_OK;
+        }
+    }
+
+    cur->has_base = false;
+    while (cur->deleted != NULL) {
+        rc = sqlite3_step (cur->deleted);
+        if (rc != SQLITE_ROW) {
+            if (rc != SQLITE_DONE) {
+                return rc;
+            }
+            break;
+        }
+
+        cur->rowid = sqlite3_column_int64 (cur->deleted, 0);
+        rc = loadRow (cur, table, cur->rowid, exists);
+        if (rc != SQLITE_OK) {
+            return rc;
+        }
+        if (exists) {
+            return SQLITE_OK;
+        }
+    }
+    cur->eof = true;
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Prepare a statement over the records and bind the common arguments.
+static int prepareRecords (
+        AsOfCursor * cur, const AsOfTable * table, const char * sql,
+        sqlite3_stmt ** stmt)
+{
+    int rc = sqlite3_prepare_v2 (
+                static_cast<sqlite3 *>(table->undoer->db_),
+                sql, -1, stmt, NULL);
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_text (*stmt, 1, table->name, -1, SQLITE_STATIC);
+        sqlite3_bind_int64 (*stmt, 2, cur->entry);
+        sqlite3_bind_int64 (*stmt, 3, cur->overlay->undone);
+        sqlite3_bind_int64 (*stmt, 4, cur->overlay->limit);
+    }
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Finds the first undone entry and the snapshot that gives the base rows
+ * and reads the ranges inserted after the entry; the records of the
+ * rows are only read as the rows are produced.
+ *
+ * @return error code
+ */
+static int loadOverlay (
+        AsOfCursor * cur, const AsOfTable * table, bool by_rowid,
+        qint64 rowid)
+{
+    AsOfOverlay & overlay = *cur->overlay;
+    sqlite3_stmt * stmt = NULL;
+    int rc;
+    for (;;) {
+        // The changes of undone entries are not in the table.
+        rc = sqlite3_prepare_v2 (
+                    static_cast<sqlite3 *>(table->undoer->db_),
+                    "SELECT min(id) FROM " RESQUN_TBL_IDX " "
+                    "WHERE status=" STR(RESQUN_MARK_REDO),
+                    -1, &stmt, NULL);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+        rc = sqlite3_step (stmt);
+        if (rc != SQLITE_ROW) {
+            break;
+        }
+        if (sqlite3_column_type (stmt, 0) != SQLITE_NULL) {
+            overlay.undone = sqlite3_column_int64 (stmt, 0);
+        }
+        sqlite3_finalize (stmt);
+        stmt = NULL;
+        if (overlay.undone <= cur->entry) {
+            setError (cur->base.pVtab, sqlite3_mprintf (
+                          "entry %lld was undone; redo it first",
+                          overlay.undone));
+            rc = SQLITE_ERROR;
+            break;
+        }
+
+        // A snapshot ends the records; the rows that are not known
+        // are the ones copied in the shadow table.
+        rc = prepareRecords (cur, table, ASOF_SNAPSHOT, &stmt);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+        rc = sqlite3_step (stmt);
+        if (rc == SQLITE_ROW) {
+            overlay.snapshot = sqlite3_column_int64 (stmt, 0);
+            overlay.limit = overlay.snapshot;
+        } else if (rc != SQLITE_DONE) {
+            break;
+        }
+        sqlite3_finalize (stmt);
+        stmt = NULL;
+
+        rc = prepareRecords (cur, table, ASOF_INSERTED, &stmt);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+        if (by_rowid) {
+            sqlite3_bind_int64 (stmt, 5, rowid);
+        }
+        while ((rc = sqlite3_step (stmt)) == SQLITE_ROW) {
+            addInserted (overlay,
+                         sqlite3_column_int64 (stmt, 0),
+                         sqlite3_column_int64 (stmt, 1),
+                         sqlite3_column_int64 (stmt, 2));
+        }
+        if (rc != SQLITE_DONE) {
+            break;
+        }
+
+        rc = prepareRecords (cur, table, ASOF_ROW_RECORDS, &cur->records);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+
+        char * base;
+        if (overlay.snapshot == 0) {
+            base = sqlite3_mprintf (
+                        "\"%w\" WHERE rowid=j.firstid", table->name);
+        } else {
+            base = sqlite3_mprintf (
+                        "\"" RESQUN_TBL_SHADOW "%w\" WHERE resqun_snap=?6 "
+                        "AND resqun_rowid=j.firstid", table->name);
+        }
+        char * sql = NULL;
+        if (base != NULL) {
+            sql = sqlite3_mprintf (
+                        ASOF_DELETED, by_rowid ? "AND firstid=?5 " : "",
+                        base);
+            sqlite3_free (base);
+        }
+        if (sql == NULL) {
+            rc = SQLITE_NOMEM;
+            break;
+        }
+        rc = prepareRecords (cur, table, sql, &cur->deleted);
+        sqlite3_free (sql);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+        if (by_rowid) {
+            sqlite3_bind_int64 (cur->deleted, 5, rowid);
+        }
+        if (overlay.snapshot != 0) {
+            sqlite3_bind_int64 (cur->deleted, 6, overlay.snapshot);
+        }
+        rc = SQLITE_OK;
+        break;
+    }
+    sqlite3_finalize (stmt);
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Release the statements and the overlay of a cursor.
+static void releaseCursor (AsOfCursor * cur)
+{
+    sqlite3_finalize (cur->stmt);
+    sqlite3_finalize (cur->records);
+    sqlite3_finalize (cur->deleted);
+    cur->stmt = NULL;
+    cur->records = NULL;
+    cur->deleted = NULL;
+    delete cur->overlay;
+    cur->overlay = NULL;
+}
+/* ========================================================================= */
+
+/*  FUNCTIONS    =========================================================== */
+//
+//
+//
+//
+/*  SQLITE Entry Points   -------------------------------------------------- */
+
+extern "C" {
+
+/* ------------------------------------------------------------------------- */
+static int asof_connect (
+        sqlite3 *db, void *aux, int argc, const char * const *argv,
+        sqlite3_vtab **vtab, char **err_msg)
+{
+    ReSqliteUn * undoer = static_cast<ReSqliteUn *>(aux);
+    if (argc != 4) {
+        *err_msg = sqlite3_mprintf (
+                    "usage: CREATE VIRTUAL TABLE temp.name "
+                    "USING " RESQUN_VTAB_ASOF "(table)");
+        return SQLITE_ERROR;
+    }
+    int table_id = undoer->tableId (unquote (argv[3]));
+    if (table_id < 0) {
+        *err_msg = sqlite3_mprintf ("table %s is not tracked", argv[3]);
+        return SQLITE_ERROR;
+    }
+    const ReSqliteUnUtil::TableInfo & info = undoer->tables_.at (table_id);
+    QByteArray columns;
+    foreach(const QString & column, info.columns) {
+        char * quoted = sqlite3_mprintf (
+                    "\"%w\"", column.toUtf8 ().constData ());
+        if (quoted == NULL) {
+            return SQLITE_NOMEM;
+        }
+        if (!columns.isEmpty ()) {
+            columns += ",";
+        }
+        columns += quoted;
+        sqlite3_free (quoted);
+    }
+    QByteArray schema = "CREATE TABLE x(" + columns +
+            ", resqun_entry HIDDEN)";
+    int rc = sqlite3_declare_vtab (db, schema.constData ());
+    if (rc == SQLITE_OK) {
+        AsOfTable * table = static_cast<AsOfTable *>(
+                    sqlite3_malloc (sizeof(AsOfTable)));
+        if (table == NULL) {
+            return SQLITE_NOMEM;
+        }
+        memset (table, 0, sizeof(AsOfTable));
+        table->undoer = undoer;
+        table->name = sqlite3_mprintf (
+                    "%s", info.name.toUtf8 ().constData ());
+        table->columns = sqlite3_mprintf ("%s", columns.constData ());
+        table->column_count = info.columns.count ();
+        table->definition = sqlite3_mprintf (
+                    "%s", info.definition.toUtf8 ().constData ());
+        table->schema_version = -1;
+        *vtab = &table->base;
+    }
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! A different function than asof_connect() so the table is not eponymous.
+static int asof_create (
+        sqlite3 *db, void *aux, int argc, const char * const *argv,
+        sqlite3_vtab **vtab, char **err_msg)
+{
+    return asof_connect (db, aux, argc, argv, vtab, err_msg);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int asof_disconnect (sqlite3_vtab *vtab)
+{
+    AsOfTable * table = reinterpret_cast<AsOfTable *>(vtab);
+    sqlite3_free (table->name);
+    sqlite3_free (table->columns);
+    sqlite3_free (table->definition);
+    sqlite3_free (vtab);
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The entry (the argument of the table) is required, plans without it
+ * are refused; `rowid = ...` limits both the base rows and the journal
+ * records to that row.
+ */
+static int asof_best_index (sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+    const AsOfTable * table = reinterpret_cast<AsOfTable *>(vtab);
+    int entry = -1;
+    int rowid = -1;
+    for (int i = 0; i < info->nConstraint; ++i) {
+        const sqlite3_index_info::sqlite3_index_constraint & c =
+                info->aConstraint[i];
+        if (!c.usable || (c.op != SQLITE_INDEX_CONSTRAINT_EQ)) {
+            continue;
+        }
+        if ((c.iColumn == table->column_count) && (entry == -1)) {
+            entry = i;
+        } else if ((c.iColumn == -1) && (rowid == -1)) {
+            rowid = i;
+        }
+    }
+
+    // Without an entry there is nothing to show.
+    if (entry == -1) {
+        return SQLITE_CONSTRAINT;
+    }
+
+    int plan = plan_entry;
+    int argv_index = 0;
+    info->aConstraintUsage[entry].argvIndex = ++argv_index;
+    info->aConstraintUsage[entry].omit = 1;
+    if (rowid != -1) {
+        plan |= plan_rowid;
+        info->aConstraintUsage[rowid].argvIndex = ++argv_index;
+        info->aConstraintUsage[rowid].omit = 1;
+    }
+    info->idxNum = plan;
+    info->estimatedCost = (plan & plan_rowid) ? 10.0 : 100000.0;
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int asof_open (sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
+{
+    Q_UNUSED(vtab);
+    AsOfCursor * cur = static_cast<AsOfCursor *>(
+                sqlite3_malloc (sizeof(AsOfCursor)));
+    if (cur == NULL) {
+        return SQLITE_NOMEM;
+    }
+    memset (cur, 0, sizeof(AsOfCursor));
+    cur->eof = true;
+    *cursor = &cur->base;
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int asof_close (sqlite3_vtab_cursor *cursor)
+{
+    AsOfCursor * cur = reinterpret_cast<AsOfCursor *>(cursor);
+    releaseCursor (cur);
+    sqlite3_free (cursor);
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int asof_next (sqlite3_vtab_cursor *cursor)
+{
+    return asofAdvance (reinterpret_cast<AsOfCursor *>(cursor));
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int asof_filter (
+        sqlite3_vtab_cursor *cursor, int idx_num, const char *idx_str,
+        int argc, sqlite3_value **argv)
+{
+    Q_UNUSED(idx_str);
+    Q_UNUSED(argc);
+    AsOfCursor * cur = reinterpret_cast<AsOfCursor *>(cursor);
+    AsOfTable * table = reinterpret_cast<AsOfTable *>(cursor->pVtab);
+    sqlite3 * db = static_cast<sqlite3 *>(table->undoer->db_);
+    releaseCursor (cur);
+    cur->overlay = new AsOfOverlay ();
+    cur->eof = true;
+    cur->in_base = false;
+    cur->row = NULL;
+    cur->has_base = false;
+
+    // asof_best_index() does not accept a plan without an entry.
+    assert(idx_num & plan_entry);
+    cur->entry = sqlite3_value_int64 (argv[0]);
+    bool by_rowid = (idx_num & plan_rowid) != 0;
+    qint64 rowid = by_rowid ? sqlite3_value_int64 (argv[1]) : 0;
+
+    // The columns were declared from what the instance knows about the
+    // tracked table (sqlite connects the table again after any change of
+    // the schema); if the table changed since then they no longer match
+    // its rows.
+    int schema_version = 0;
+    int rc = readSchemaVersion (db, schema_version);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    if (schema_version != table->schema_version) {
+        QString definition;
+        rc = ReSqliteUnUtil::readDefinition (
+                    db, QString::fromUtf8 (table->name), definition);
+        if (rc != SQLITE_OK) {
+            return rc;
+        }
+        if (definition != QString::fromUtf8 (table->definition)) {
+            setError (cursor->pVtab, sqlite3_mprintf (
+                          "the structure of table %s changed",
+                          table->name));
+            return SQLITE_ERROR;
+        }
+        table->schema_version = schema_version;
+    }
+
+    if (table->undoer->hasSchema ()) {
+        rc = loadOverlay (cur, table, by_rowid, rowid);
+        if (rc != SQLITE_OK) {
+            return rc;
+        }
+    }
+
+    char * sql;
+    if (cur->overlay->snapshot == 0) {
+        sql = sqlite3_mprintf (
+                    by_rowid ?
+                        "SELECT rowid,%s FROM \"%w\" WHERE rowid=?2" :
+                        "SELECT rowid,%s FROM \"%w\"",
+                    table->columns, table->name);
+    } else {
+        sql = sqlite3_mprintf (
+                    by_rowid ?
+                        "SELECT resqun_rowid,%s "
+                        "FROM \"" RESQUN_TBL_SHADOW "%w\" "
+                        "WHERE resqun_snap=?1 AND resqun_rowid=?2" :
+                        "SELECT resqun_rowid,%s "
+                        "FROM \"" RESQUN_TBL_SHADOW "%w\" "
+                        "WHERE resqun_snap=?1",
+                    table->columns, table->name);
+    }
+    if (sql == NULL) {
+        return SQLITE_NOMEM;
+    }
+    rc = sqlite3_prepare_v2 (db, sql, -1, &cur->stmt, NULL);
+    sqlite3_free (sql);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    if (cur->overlay->snapshot != 0) {
+        sqlite3_bind_int64 (cur->stmt, 1, cur->overlay->snapshot);
+    }
+    if (by_rowid) {
+        sqlite3_bind_int64 (cur->stmt, 2, rowid);
+    }
+    cur->eof = false;
+    cur->in_base = true;
+    return asofAdvance (cur);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int asof_eof (sqlite3_vtab_cursor *cursor)
+{
+    return reinterpret_cast<AsOfCursor *>(cursor)->eof;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int asof_column (
+        sqlite3_vtab_cursor *cursor, sqlite3_context *context, int column)
+{
+    const AsOfCursor * cur = reinterpret_cast<AsOfCursor *>(cursor);
+    const AsOfTable * table = reinterpret_cast<AsOfTable *>(cursor->pVtab);
+    if (column >= table->column_count) {
+        sqlite3_result_int64 (context, cur->entry);
+    } else if ((cur->row != NULL) &&
+               (cur->row->values.at (column).column >= 0)) {
+        ReSqliteUnRecord::result (context, cur->row->values.at (column));
+    } else if (cur->has_base) {
+        sqlite3_result_value (
+                    context, sqlite3_column_value (cur->stmt, column + 1));
+    } else {
+        sqlite3_result_null (context);
+    }
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int asof_rowid (sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
+{
+    *rowid = reinterpret_cast<AsOfCursor *>(cursor)->rowid;
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+} // extern "C"
+
+/* ------------------------------------------------------------------------- */
+//! The module behind `resqun_asof` tables (read only).
+static sqlite3_module asof_module = {
+    /* iVersion */ 0,
+    /* xCreate */ asof_create,
+    /* xConnect */ asof_connect,
+    /* xBestIndex */ asof_best_index,
+    /* xDisconnect */ asof_disconnect,
+    /* xDestroy */ asof_disconnect,
+    /* xOpen */ asof_open,
+    /* xClose */ asof_close,
+    /* xFilter */ asof_filter,
+    /* xNext */ asof_next,
+    /* xEof */ asof_eof,
+    /* xColumn */ asof_column,
+    /* xRowid */ asof_rowid,
+    /* xUpdate */ NULL,
+    /* xBegin */ NULL,
+    /* xSync */ NULL,
+    /* xCommit */ NULL,
+    /* xRollback */ NULL,
+    /* xFindFunction */ NULL,
+    /* xRename */ NULL,
+    /* xSavepoint */ NULL,
+    /* xRelease */ NULL,
+    /* xRollbackTo */ NULL
+};
+/* ========================================================================= */
+
+/*  SQLITE Entry Points   ================================================== */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+/**
+ * @class ReSqliteUnAsOf
+ *
+ * A `resqun_asof` table shows an attached table as it was right after
+ * an entry, without undoing anything:
+ *
+ * @code
+ * CREATE VIRTUAL TABLE temp.Test_asof USING resqun_asof(Test);
+ * SELECT * FROM Test_asof(12) WHERE rowid = 5;
+ * @endcode
+ *
+ * The table has the columns of the tracked table (as they were when it
+ * was created) and a hidden `resqun_entry` column that receives the
+ * argument. Once the structure of the tracked table changes the queries
+ * fail until the instance reads the table again (see
+ * ReSqliteUn::refreshTables()). The rows are the live rows with the journal's before-images
+ * laid over them: the records of each row written after the entry are
+ * looked up by the `(tbl, firstid)` index as the row is produced, so only
+ * the ranges of inserted rows are read before the first one. Rows that
+ * the records do not touch come straight from the table, rows inserted
+ * later are left out and rows deleted later are added at the end. When
+ * the table was suspended after the entry the rows saved by the snapshot
+ * take the place of the live ones.
+ *
+ * Only the entries that are in effect can be read; asking for the state
+ * after an entry that was undone is an error. Changes that were not
+ * recorded (columns left out of updates, changes made while the instance
+ * was not active) are not reverted.
+ */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Tables are created in the `temp` schema with `CREATE VIRTUAL TABLE`,
+ * as their columns depend on the table they show; the table must be
+ * attached at that time.
+ *
+ * @param db The connection.
+ * @param undoer The instance associated with the connection.
+ * @return error code
+ */
+int ReSqliteUnAsOf::createModule (void * db, ReSqliteUn * undoer)
+{
+    return sqlite3_create_module_v2 (
+                static_cast<sqlite3 *>(db), RESQUN_VTAB_ASOF,
+                &asof_module, undoer, NULL);
+}
+/* ========================================================================= */
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
@@ -0,0 +1,74 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-asof.h
+ * @brief Declarations for ReSqliteUnAsOf class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_RESQLITEUN_ASOF_H_INCLUDE
+#define GUARD_RESQLITEUN_ASOF_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <resqliteun/resqliteun-config.h>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+class ReSqliteUn;
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+//! The `resqun_asof` module that shows a table as it was after an entry.
+class RESQLITEUN_EXPORT ReSqliteUnAsOf {
+    //
+    //
+    //
+    //
+    /*  FUNCTIONS    ------------------------------------------------------- */
+
+public:
+
+    //! Register the `resqun_asof` module for a connection.
+    static int
+    createModule (
+            void * db,
+            ReSqliteUn * undoer);
+
+    /*  FUNCTIONS    ======================================================= */
+    //
+    //
+    //
+    //
+
+}; // class ReSqliteUnAsOf
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+
+#endif // GUARD_RESQLITEUN_ASOF_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
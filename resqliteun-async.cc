@@ -0,0 +1,298 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-async.cc
+ * @brief Definitions for ReSqliteUnAsync class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <sqlite/sqlite3.h>
+
+#include "resqliteun-async.h"
+#include "resqliteun.h"
+#include "resqliteun-private.h"
+
+#include <QThread>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+//! Number of virtual machine instructions between calls to the handler.
+#define PROGRESS_OPCODES 1000
+
+#define dtb_ static_cast<sqlite3 *>(undoer_->db_)
+
+//! The thread that runs the steps.
+class ReSqliteUnAsyncThread : public QThread {
+public:
+    ReSqliteUnAsync * handle_;
+
+    ReSqliteUnAsyncThread (ReSqliteUnAsync * handle) :
+        QThread (),
+        handle_ (handle)
+    {}
+
+protected:
+    virtual void run () {
+        handle_->run ();
+    }
+};
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+/**
+ * @class ReSqliteUnAsync
+ *
+ * Large steps block the thread that performs them for as long as the
+ * replay takes. An instance of this class performs the steps on a worker
+ * thread and reports back through signals that are delivered
+ * in the event loop of the thread that created it.
+ *
+ * Each step holds the mutex of the connection (see ReSqliteUnLocker),
+ * as do all the entry points of ReSqliteUn, so the application may keep
+ * using the instance and the connection from its own thread: the calls
+ * wait for the step in progress. The connection must have been opened
+ * in serialized mode for that; otherwise the application must not use
+ * it until finished() is emitted.
+ *
+ * Progress is reported through `sqlite3_progress_handler`, which also
+ * checks for cancellation: a cancelled step is interrupted and its
+ * savepoint is rolled back, while the steps that were completed before
+ * remain in place (see stepsDone()). While a step runs the handler of
+ * the application (see ReSqliteUn::setProgressHandler()) is called by
+ * the handler of the worker and may interrupt the step as well; it is
+ * put back in the connection after each step.
+ */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The worker is not started; connect to the signals and call start().
+ *
+ * @param undoer The instance that performs the steps.
+ * @param steps Number of steps.
+ * @param for_undo Undo (true) or redo.
+ * @param parent The parent object.
+ */
+ReSqliteUnAsync::ReSqliteUnAsync (
+        ReSqliteUn * undoer, int steps, bool for_undo, QObject * parent) :
+    QObject (parent),
+    undoer_ (undoer),
+    thread_ (NULL),
+    steps_ (steps),
+    for_undo_ (for_undo),
+    cancelled_ (0),
+    steps_done_ (0),
+    last_progress_ (-1),
+    result_ (SQLITE_OK),
+    s_error_ ()
+{
+    RESQLITEUN_TRACE_ENTRY;
+    thread_ = new ReSqliteUnAsyncThread (this);
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+ReSqliteUnAsync::~ReSqliteUnAsync()
+{
+    RESQLITEUN_TRACE_ENTRY;
+    cancel ();
+    thread_->wait ();
+    delete thread_;
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void ReSqliteUnAsync::start ()
+{
+    thread_->start ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * May be called from any thread.
+ */
+void ReSqliteUnAsync::cancel ()
+{
+    cancelled_.storeRelease (1);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool ReSqliteUnAsync::isCancelled () const
+{
+    return cancelled_.loadAcquire () != 0;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool ReSqliteUnAsync::isFinished () const
+{
+    return thread_->isFinished ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param msecs Maximum time to wait.
+ * @return false if the time expired before the worker was done
+ */
+bool ReSqliteUnAsync::wait (unsigned long msecs)
+{
+    return thread_->wait (msecs);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int ReSqliteUnAsync::stepsDone () const
+{
+    return steps_done_.loadAcquire ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Runs in the worker, from inside the statements of the steps.
+ *
+ * @param user_data The ReSqliteUnAsync instance.
+ * @return non-zero to interrupt the statement
+ */
+int ReSqliteUnAsync::progressHandler (void * user_data)
+{
+    ReSqliteUnAsync * self = static_cast<ReSqliteUnAsync *>(user_data);
+    if (self->cancelled_.loadAcquire () != 0) {
+        return 1;
+    }
+
+    const ReSqliteUn * undoer = self->undoer_;
+    if (undoer->app_progress_ != NULL) {
+        if (undoer->app_progress_ (undoer->app_progress_data_) != 0) {
+            return 1;
+        }
+    }
+
+    self->reportProgress ();
+    return 0;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Runs in the worker. Each step counts the same; inside a step the
+ * progress is given by the number of records that were applied.
+ */
+void ReSqliteUnAsync::reportProgress ()
+{
+    if (steps_ < 1) {
+        return;
+    }
+    int in_step = undoer_->replay_total_ > 0 ?
+                undoer_->replay_applied_ * 1000 / undoer_->replay_total_ : 0;
+    int per_mille =
+            (steps_done_.loadAcquire () * 1000 + in_step) / steps_;
+    if (per_mille > last_progress_) {
+        last_progress_ = per_mille;
+        emit progress (per_mille);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Runs in the worker.
+ */
+void ReSqliteUnAsync::run ()
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    QString s_error;
+    for (int i = 0; i < steps_; ++i) {
+        if (isCancelled ()) {
+            rc = SQLITE_INTERRUPT;
+            s_error = tr ("Cancelled");
+            break;
+        }
+
+        // The application may use the instance between the steps; the
+        // counters of the previous step are not part of the progress.
+        ReSqliteUnLocker locker (undoer_->db_);
+        undoer_->replay_total_ = 0;
+        undoer_->replay_applied_ = 0;
+        sqlite3_progress_handler (
+                    dtb_, PROGRESS_OPCODES, progressHandler, this);
+        rc = undoer_->performUndoRedo (for_undo_, s_error);
+        sqlite3_progress_handler (
+                    dtb_, undoer_->app_progress_opcodes_,
+                    undoer_->app_progress_, undoer_->app_progress_data_);
+        undoer_->replay_total_ = 0;
+        undoer_->replay_applied_ = 0;
+        if (rc != SQLITE_OK) {
+            if (isCancelled ()) {
+                rc = SQLITE_INTERRUPT;
+            }
+            s_error.prepend (tr ("At step %1: ").arg (i+1));
+            break;
+        }
+
+        steps_done_.storeRelease (i + 1);
+        reportProgress ();
+    }
+
+    result_ = rc;
+    s_error_ = s_error;
+    emit finished (rc);
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+/* ------------------------------------------------------------------------- */
+/**
+ * The instance is created with @a parent as its parent and its worker is
+ * not started: connect to its signals first and then call
+ * ReSqliteUnAsync::start(), so a quick worker cannot finish before
+ * anybody listens. Delete it (or let the parent delete it) when done.
+ *
+ * @param steps Number of steps.
+ * @param for_undo Undo (true) or redo.
+ * @param parent The parent of the returned object.
+ * @return the object that tracks the steps
+ */
+ReSqliteUnAsync * ReSqliteUn::performUndoRedoAsync (
+        int steps, bool for_undo, QObject * parent)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnAsync * result = new ReSqliteUnAsync (
+                this, steps, for_undo, parent);
+    RESQLITEUN_TRACE_EXIT;
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
@@ -0,0 +1,184 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-async.h
+ * @brief Declarations for ReSqliteUnAsync class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_RESQLITEUN_ASYNC_H_INCLUDE
+#define GUARD_RESQLITEUN_ASYNC_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <resqliteun/resqliteun-config.h>
+
+#include <QObject>
+#include <QString>
+#include <QAtomicInt>
+
+#include <climits>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+class ReSqliteUn;
+class ReSqliteUnAsyncThread;
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+//! Undo or redo steps running on a worker thread.
+class RESQLITEUN_EXPORT ReSqliteUnAsync : public QObject {
+    Q_OBJECT
+    //
+    //
+    //
+    //
+    /*  DEFINITIONS    ----------------------------------------------------- */
+
+    friend class ReSqliteUnAsyncThread;
+
+    /*  DEFINITIONS    ===================================================== */
+    //
+    //
+    //
+    //
+    /*  DATA    ------------------------------------------------------------ */
+
+private:
+
+    ReSqliteUn * undoer_; /**< the instance that performs the steps */
+    ReSqliteUnAsyncThread * thread_; /**< the worker */
+    int steps_; /**< number of steps requested */
+    bool for_undo_; /**< undo (true) or redo */
+    QAtomicInt cancelled_; /**< set by cancel(), read by the worker */
+    QAtomicInt steps_done_; /**< number of steps completed so far */
+    int last_progress_; /**< last value sent by progress() (worker only) */
+    int result_; /**< error code (valid when finished) */
+    QString s_error_; /**< error message (valid when finished) */
+
+    /*  DATA    ============================================================ */
+    //
+    //
+    //
+    //
+    /*  FUNCTIONS    ------------------------------------------------------- */
+
+public:
+
+    //! Constructor.
+    ReSqliteUnAsync (
+            ReSqliteUn * undoer,
+            int steps,
+            bool for_undo,
+            QObject * parent = NULL);
+
+    //! Destructor; cancels the steps and waits for the worker.
+    virtual ~ReSqliteUnAsync ();
+
+    //! Start the worker.
+    void
+    start ();
+
+    //! Ask the worker to stop; the step in progress is rolled back.
+    void
+    cancel ();
+
+    //! Was cancel() called?
+    bool
+    isCancelled () const;
+
+    //! Is the worker done?
+    bool
+    isFinished () const;
+
+    //! Block until the worker is done.
+    bool
+    wait (
+            unsigned long msecs = ULONG_MAX);
+
+    //! Number of steps requested.
+    int
+    steps () const {
+        return steps_;
+    }
+
+    //! Number of steps completed so far.
+    int
+    stepsDone () const;
+
+    //! The error code (valid when finished).
+    int
+    result () const {
+        return result_;
+    }
+
+    //! The error message (valid when finished).
+    const QString &
+    errorString () const {
+        return s_error_;
+    }
+
+signals:
+
+    //! Progress of the whole operation, in thousandths.
+    void
+    progress (
+            int per_mille);
+
+    //! The worker is done; result() and errorString() are valid.
+    void
+    finished (
+            int result);
+
+private:
+
+    //! Called by sqlite from the worker while statements run.
+    static int
+    progressHandler (
+            void * user_data);
+
+    //! Emit progress() if the progress changed.
+    void
+    reportProgress ();
+
+    //! The body of the worker.
+    void
+    run ();
+
+    /*  FUNCTIONS    ======================================================= */
+    //
+    //
+    //
+    //
+
+}; // class ReSqliteUnAsync
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+
+#endif // GUARD_RESQLITEUN_ASYNC_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
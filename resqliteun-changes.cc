@@ -0,0 +1,499 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-changes.cc
+ * @brief Definitions for ReSqliteUnChanges class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <sqlite/sqlite3.h>
+
+#include "resqliteun-changes.h"
+#include "resqliteun.h"
+#include "resqliteun-private.h"
+
+#include <assert.h>
+#include <string.h>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+//! The columns of the `resqun_changes` table.
+enum ChangesColumns {
+    col_tbl = 0, // the table that was changed;
+    col_row_id, // the rowid of the row (NULL for snapshots);
+    col_op, // insert, delete, update or snapshot;
+    col_col, // the name of the column (NULL for inserts and snapshots);
+    col_old, // the value before the change;
+    col_new, // the value after the change (NULL for deletes);
+    col_entry // hidden: the entry (the argument of the function).
+};
+
+//! The constraints used by a plan; the arguments follow the order of bits.
+enum ChangesPlan {
+    plan_entry = 0x0001,
+    plan_tbl = 0x0002
+};
+
+//! The `resqun_changes` table.
+struct ChangesTable {
+    sqlite3_vtab base; /**< must come first */
+    ReSqliteUn * undoer; /**< the instance that owns the journal */
+};
+
+//! A cursor over the `resqun_changes` table.
+struct ChangesCursor {
+    sqlite3_vtab_cursor base; /**< must come first */
+    sqlite3_stmt * stmt; /**< the records of the entry, in order */
+    bool eof; /**< no more rows */
+    sqlite3_int64 row; /**< number of rows produced so far */
+
+    bool in_record; /**< is there a record being expanded? */
+    int kind; /**< the kind of the record */
+    int table_id; /**< the table of the record (-1 if not attached) */
+    qint64 next_rowid; /**< next rowid of an insert range */
+    qint64 last_rowid; /**< last rowid of the record */
+    const char * old_cursor; /**< next value in the undo image */
+    const char * old_end; /**< end of the undo image */
+    const char * new_cursor; /**< next value in the redo image */
+    const char * new_end; /**< end of the redo image */
+
+    qint64 rowid; /**< the rowid of current row */
+    ReSqliteUnRecord::Value old_value; /**< old value of current row */
+    ReSqliteUnRecord::Value new_value; /**< new value of current row */
+};
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  FUNCTIONS    ----------------------------------------------------------- */
+
+/* ------------------------------------------------------------------------- */
+//! A value that stands for NULL in column @a column.
+static void nullValue (ReSqliteUnRecord::Value & value, int column)
+{
+    memset (&value, 0, sizeof(value));
+    value.column = column;
+    value.type = SQLITE_NULL;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Records are read one at a time and their images are decoded in place
+ * (they point inside the current row of the statement), so an entry is
+ * never loaded as a whole.
+ *
+ * @return error code
+ */
+static int changesAdvance (ChangesCursor * cur, ReSqliteUn * undoer)
+{
+    for (;;) {
+        if (!cur->in_record) {
+            int rc = sqlite3_step (cur->stmt);
+            if (rc != SQLITE_ROW) {
+                cur->eof = true;
+                return rc == SQLITE_DONE ? SQLITE_OK : rc;
+            }
+            cur->in_record = true;
+            cur->kind = sqlite3_column_int (cur->stmt, 0);
+            cur->table_id = undoer->tableId (
+                        ReSqliteUn::columnText (cur->stmt, 1));
+            cur->next_rowid = sqlite3_column_int64 (cur->stmt, 2);
+            cur->last_rowid = sqlite3_column_int64 (cur->stmt, 3);
+            cur->old_cursor = static_cast<const char *>(
+                        sqlite3_column_blob (cur->stmt, 4));
+            cur->old_end = cur->old_cursor +
+                    sqlite3_column_bytes (cur->stmt, 4);
+            cur->new_cursor = static_cast<const char *>(
+                        sqlite3_column_blob (cur->stmt, 5));
+            cur->new_end = cur->new_cursor +
+                    sqlite3_column_bytes (cur->stmt, 5);
+        }
+
+        nullValue (cur->old_value, -1);
+        nullValue (cur->new_value, -1);
+        cur->rowid = cur->next_rowid;
+        switch (cur->kind) {
+        case ReSqliteUnRecord::InsertKind: {
+            // One row for each rowid in the range.
+            if (cur->next_rowid > cur->last_rowid) {
+                cur->in_record = false;
+                continue;
+            }
+            ++cur->next_rowid;
+            return SQLITE_OK; }
+        case ReSqliteUnRecord::SnapshotKind: {
+            // One row for the whole table.
+            cur->in_record = false;
+            return SQLITE_OK; }
+        case ReSqliteUnRecord::DeleteKind: {
+            // One row for each column of the deleted row.
+            if (cur->old_cursor >= cur->old_end) {
+                cur->in_record = false;
+                continue;
+            }
+            if (!ReSqliteUnRecord::decode (
+                        cur->old_cursor, cur->old_end, cur->old_value)) {
+                return SQLITE_CORRUPT;
+            }
+            nullValue (cur->new_value, cur->old_value.column);
+            return SQLITE_OK; }
+        case ReSqliteUnRecord::UpdateKind:
+        case ReSqliteUnRecord::UpdateColumnKind: {
+            // One row for each column whose value changed; both images
+            // hold the same columns in the same order.
+            if ((cur->old_cursor >= cur->old_end) ||
+                    (cur->new_cursor >= cur->new_end)) {
+                cur->in_record = false;
+                continue;
+            }
+            if (!ReSqliteUnRecord::decode (
+                        cur->old_cursor, cur->old_end, cur->old_value) ||
+                    !ReSqliteUnRecord::decode (
+                        cur->new_cursor, cur->new_end, cur->new_value)) {
+                return SQLITE_CORRUPT;
+            }
+            if (ReSqliteUnRecord::sameValue (
+                        cur->old_value, cur->new_value)) {
+                continue;
+            }
+            return SQLITE_OK; }
+        default: {
+            return SQLITE_CORRUPT; }
+        }
+    }
+}
+/* ========================================================================= */
+
+/*  FUNCTIONS    =========================================================== */
+//
+//
+//
+//
+/*  SQLITE Entry Points   -------------------------------------------------- */
+
+extern "C" {
+
+/* ------------------------------------------------------------------------- */
+static int changes_connect (
+        sqlite3 *db, void *aux, int argc, const char * const *argv,
+        sqlite3_vtab **vtab, char **err_msg)
+{
+    Q_UNUSED(argc);
+    Q_UNUSED(argv);
+    Q_UNUSED(err_msg);
+    int rc = sqlite3_declare_vtab (
+                db, "CREATE TABLE x(tbl TEXT, row_id INTEGER, op TEXT, "
+                    "col TEXT, old, new, entry HIDDEN)");
+    if (rc == SQLITE_OK) {
+        ChangesTable * table = static_cast<ChangesTable *>(
+                    sqlite3_malloc (sizeof(ChangesTable)));
+        if (table == NULL) {
+            return SQLITE_NOMEM;
+        }
+        memset (table, 0, sizeof(ChangesTable));
+        table->undoer = static_cast<ReSqliteUn *>(aux);
+        *vtab = &table->base;
+    }
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int changes_disconnect (sqlite3_vtab *vtab)
+{
+    sqlite3_free (vtab);
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The entry (the argument of the function) and `tbl = ...` are
+ * passed down to the query over the journal, which is indexed by entry.
+ */
+static int changes_best_index (sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+    Q_UNUSED(vtab);
+    int entry = -1;
+    int tbl = -1;
+    for (int i = 0; i < info->nConstraint; ++i) {
+        const sqlite3_index_info::sqlite3_index_constraint & c =
+                info->aConstraint[i];
+        if (!c.usable || (c.op != SQLITE_INDEX_CONSTRAINT_EQ)) {
+            continue;
+        }
+        if ((c.iColumn == col_entry) && (entry == -1)) {
+            entry = i;
+        } else if ((c.iColumn == col_tbl) && (tbl == -1)) {
+            tbl = i;
+        }
+    }
+
+    int plan = 0;
+    int argv_index = 0;
+    if (entry != -1) {
+        plan |= plan_entry;
+        info->aConstraintUsage[entry].argvIndex = ++argv_index;
+        info->aConstraintUsage[entry].omit = 1;
+    }
+    if (tbl != -1) {
+        plan |= plan_tbl;
+        info->aConstraintUsage[tbl].argvIndex = ++argv_index;
+        info->aConstraintUsage[tbl].omit = 1;
+    }
+    info->idxNum = plan;
+
+    // Without an entry there is nothing to list.
+    info->estimatedCost = (plan & plan_entry) ? 1000.0 : 1e12;
+    if (plan & plan_tbl) {
+        info->estimatedCost /= 10.0;
+    }
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int changes_open (sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
+{
+    Q_UNUSED(vtab);
+    ChangesCursor * cur = static_cast<ChangesCursor *>(
+                sqlite3_malloc (sizeof(ChangesCursor)));
+    if (cur == NULL) {
+        return SQLITE_NOMEM;
+    }
+    memset (cur, 0, sizeof(ChangesCursor));
+    cur->eof = true;
+    *cursor = &cur->base;
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int changes_close (sqlite3_vtab_cursor *cursor)
+{
+    ChangesCursor * cur = reinterpret_cast<ChangesCursor *>(cursor);
+    if (cur->stmt != NULL) {
+        sqlite3_finalize (cur->stmt);
+    }
+    sqlite3_free (cursor);
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int changes_next (sqlite3_vtab_cursor *cursor)
+{
+    ChangesCursor * cur = reinterpret_cast<ChangesCursor *>(cursor);
+    ChangesTable * table = reinterpret_cast<ChangesTable *>(cursor->pVtab);
+    ++cur->row;
+    return changesAdvance (cur, table->undoer);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int changes_filter (
+        sqlite3_vtab_cursor *cursor, int idx_num, const char *idx_str,
+        int argc, sqlite3_value **argv)
+{
+    Q_UNUSED(idx_str);
+    ChangesCursor * cur = reinterpret_cast<ChangesCursor *>(cursor);
+    ChangesTable * table = reinterpret_cast<ChangesTable *>(cursor->pVtab);
+    if (cur->stmt != NULL) {
+        sqlite3_finalize (cur->stmt);
+        cur->stmt = NULL;
+    }
+    cur->eof = true;
+    cur->in_record = false;
+    cur->row = 0;
+
+    // Nothing was recorded yet or no entry was named.
+    if (!table->undoer->hasSchema () || !(idx_num & plan_entry)) {
+        return SQLITE_OK;
+    }
+
+    int rc = sqlite3_prepare_v2 (
+                static_cast<sqlite3 *>(table->undoer->db_),
+                idx_num & plan_tbl ?
+                    "SELECT op,tbl,firstid,lastid,data,redo "
+                    "FROM " RESQUN_TBL_TEMP " "
+                    "WHERE idxid=?1 AND tbl=?2 ORDER BY id" :
+                    "SELECT op,tbl,firstid,lastid,data,redo "
+                    "FROM " RESQUN_TBL_TEMP " "
+                    "WHERE idxid=?1 ORDER BY id",
+                -1, &cur->stmt, NULL);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    for (int i = 0; i < argc; ++i) {
+        sqlite3_bind_value (cur->stmt, i + 1, argv[i]);
+    }
+    cur->eof = false;
+    return changesAdvance (cur, table->undoer);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int changes_eof (sqlite3_vtab_cursor *cursor)
+{
+    return reinterpret_cast<ChangesCursor *>(cursor)->eof;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int changes_column (
+        sqlite3_vtab_cursor *cursor, sqlite3_context *context, int column)
+{
+    const ChangesCursor * cur = reinterpret_cast<ChangesCursor *>(cursor);
+    const ReSqliteUn * undoer =
+            reinterpret_cast<ChangesTable *>(cursor->pVtab)->undoer;
+    switch (column) {
+    case col_tbl: {
+        sqlite3_result_value (context, sqlite3_column_value (cur->stmt, 1));
+        break; }
+    case col_row_id: {
+        if (cur->kind == ReSqliteUnRecord::SnapshotKind) {
+            sqlite3_result_null (context);
+        } else {
+            sqlite3_result_int64 (context, cur->rowid);
+        }
+        break; }
+    case col_op: {
+        const char * op;
+        switch (cur->kind) {
+        case ReSqliteUnRecord::InsertKind: op = "insert"; break;
+        case ReSqliteUnRecord::DeleteKind: op = "delete"; break;
+        case ReSqliteUnRecord::SnapshotKind: op = "snapshot"; break;
+        default: op = "update"; break;
+        }
+        sqlite3_result_text (context, op, -1, SQLITE_STATIC);
+        break; }
+    case col_col: {
+        int index = cur->old_value.column;
+        if ((index < 0) || (cur->table_id < 0) ||
+                (index >= undoer->tables_.at (cur->table_id).columns.count ())) {
+            sqlite3_result_null (context);
+        } else {
+            ReSqliteUn::result (
+                        context,
+                        undoer->tables_.at (cur->table_id).columns.at (index));
+        }
+        break; }
+    case col_old: {
+        ReSqliteUnRecord::result (context, cur->old_value);
+        break; }
+    case col_new: {
+        ReSqliteUnRecord::result (context, cur->new_value);
+        break; }
+    default: {
+        sqlite3_result_null (context);
+        break; }
+    }
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int changes_rowid (sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
+{
+    *rowid = reinterpret_cast<ChangesCursor *>(cursor)->row;
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+} // extern "C"
+
+/* ------------------------------------------------------------------------- */
+//! The module behind the `resqun_changes` function (eponymous, read only).
+static sqlite3_module changes_module = {
+    /* iVersion */ 0,
+    /* xCreate */ NULL,
+    /* xConnect */ changes_connect,
+    /* xBestIndex */ changes_best_index,
+    /* xDisconnect */ changes_disconnect,
+    /* xDestroy */ NULL,
+    /* xOpen */ changes_open,
+    /* xClose */ changes_close,
+    /* xFilter */ changes_filter,
+    /* xNext */ changes_next,
+    /* xEof */ changes_eof,
+    /* xColumn */ changes_column,
+    /* xRowid */ changes_rowid,
+    /* xUpdate */ NULL,
+    /* xBegin */ NULL,
+    /* xSync */ NULL,
+    /* xCommit */ NULL,
+    /* xRollback */ NULL,
+    /* xFindFunction */ NULL,
+    /* xRename */ NULL,
+    /* xSavepoint */ NULL,
+    /* xRelease */ NULL,
+    /* xRollbackTo */ NULL
+};
+/* ========================================================================= */
+
+/*  SQLITE Entry Points   ================================================== */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+/**
+ * @class ReSqliteUnChanges
+ *
+ * `resqun_changes(entry)` decodes the journal records of an entry into
+ * one row for each changed value, in the order the changes were made:
+ * - inserts give one row for each rowid of the range, with no columns
+ *   (the values are in the table or, after undo, in its shadow table);
+ * - deletes give one row for each column of the deleted row, with the
+ *   old value;
+ * - updates give one row for each column whose value changed, with the
+ *   old and the new value;
+ * - a table saved by `resqun_suspend` gives a single `snapshot` row.
+ *
+ * `WHERE tbl = ...` is applied to the journal query. The records are
+ * streamed: memory does not grow with the size of the entry.
+ */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The table is eponymous: it exists in every connection that has an
+ * instance and needs no `CREATE VIRTUAL TABLE`.
+ *
+ * @param db The connection.
+ * @param undoer The instance associated with the connection.
+ * @return error code
+ */
+int ReSqliteUnChanges::createModule (void * db, ReSqliteUn * undoer)
+{
+    return sqlite3_create_module_v2 (
+                static_cast<sqlite3 *>(db), RESQUN_VTAB_CHANGES,
+                &changes_module, undoer, NULL);
+}
+/* ========================================================================= */
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
@@ -0,0 +1,74 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-changes.h
+ * @brief Declarations for ReSqliteUnChanges class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_RESQLITEUN_CHANGES_H_INCLUDE
+#define GUARD_RESQLITEUN_CHANGES_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <resqliteun/resqliteun-config.h>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+class ReSqliteUn;
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+//! The `resqun_changes` function that lists the row changes of an entry.
+class RESQLITEUN_EXPORT ReSqliteUnChanges {
+    //
+    //
+    //
+    //
+    /*  FUNCTIONS    ------------------------------------------------------- */
+
+public:
+
+    //! Register the `resqun_changes` function for a connection.
+    static int
+    createModule (
+            void * db,
+            ReSqliteUn * undoer);
+
+    /*  FUNCTIONS    ======================================================= */
+    //
+    //
+    //
+    //
+
+}; // class ReSqliteUnChanges
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+
+#endif // GUARD_RESQLITEUN_CHANGES_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
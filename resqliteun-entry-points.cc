@@ -20,10 +20,14 @@
 static SQLITE_EXTENSION_INIT1
 
 #include "resqliteun.h"
+#include "resqliteun-asof.h"
+#include "resqliteun-changes.h"
+#include "resqliteun-history.h"
 #include "resqliteun-private.h"
 
 #include <assert.h>
 #include <QString>
+#include <QStringList>
 
 /*  INCLUDES    ============================================================ */
 //
@@ -59,6 +63,13 @@ static void epoint_table (
         sqlite3 * db = sqlite3_context_db_handle(context);
         assert(db == static_cast<sqlite3 *>(p_app->db_));
 
+        if ((argc < 2) || (argc > 4)) {
+            sqlite3_result_error (
+                        context,
+                        RESQUN_FUN_TABLE " takes two to four arguments", -1);
+            sqlite3_result_error_code (context, SQLITE_CONSTRAINT);
+            break;
+        }
 
         // Check arguments types.
         if ((sqlite3_value_type(argv[0]) != SQLITE_TEXT)) {
@@ -93,6 +104,43 @@ static void epoint_table (
             break;
         }
 
+        // Optional list of columns and the way to interpret it.
+        QStringList columns;
+        ReSqliteUn::ColumnFilter filter = ReSqliteUn::ExcludeColumns;
+        if (argc > 2) {
+            if ((sqlite3_value_type(argv[2]) != SQLITE_TEXT) &&
+                    (sqlite3_value_type(argv[2]) != SQLITE_NULL)) {
+                sqlite3_result_error (
+                            context,
+                            "Third argument to " RESQUN_FUN_TABLE
+                            " must be a comma-separated list of columns", -1);
+                sqlite3_result_error_code (context, SQLITE_CONSTRAINT);
+                break;
+            }
+            foreach(const QString & column,
+                    ReSqliteUn::value2string (argv[2]).split (',')) {
+                QString s = column.trimmed ();
+                if (!s.isEmpty ()) {
+                    columns.append (s);
+                }
+            }
+        }
+        if (argc > 3) {
+            if ((sqlite3_value_type(argv[3]) != SQLITE_INTEGER) ||
+                    (sqlite3_value_int(argv[3]) < ReSqliteUn::ExcludeColumns) ||
+                    (sqlite3_value_int(argv[3]) > ReSqliteUn::IncludeColumns)) {
+                sqlite3_result_error (
+                            context,
+                            "Fourth argument to " RESQUN_FUN_TABLE
+                            " must be 0 (exclude columns) or"
+                            " 1 (include columns)", -1);
+                sqlite3_result_error_code (context, SQLITE_CONSTRAINT);
+                break;
+            }
+            filter = static_cast<ReSqliteUn::ColumnFilter>(
+                        sqlite3_value_int(argv[3]));
+        }
+
         // Get the name of the table.
         QString table = ReSqliteUn::value2string (argv[0]);
         if (table.length() == 0) {
@@ -107,7 +155,8 @@ static void epoint_table (
         // Actually attaching to the table goes on inside here.
         rc = p_app->attachToTable (
                     table,
-                    static_cast<ReSqliteUn::UpdateBehaviour>(update_type));
+                    static_cast<ReSqliteUn::UpdateBehaviour>(update_type),
+                    columns, filter);
         if (rc != SQLITE_OK) {
             sqlite3_result_error (context, RESQUN_FUN_TABLE "failed", -1);
             sqlite3_result_error_code (context, rc);
@@ -121,6 +170,59 @@ static void epoint_table (
 }
 /* ========================================================================= */
 
+/* ------------------------------------------------------------------------- */
+//! Implementation of the `tables` function.
+static void epoint_tables (
+            sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn::SqLiteResult rc;
+    for (;;) {
+        ReSqliteUn * p_app = static_cast<ReSqliteUn *>(
+                    sqlite3_user_data (context));
+        assert(p_app != NULL);
+        assert(argc == 2);
+
+        // Check arguments types.
+        if ((sqlite3_value_type(argv[0]) != SQLITE_TEXT)) {
+            sqlite3_result_error (
+                        context,
+                        "First argument to " RESQUN_FUN_TABLES
+                        " must be a string", -1);
+            sqlite3_result_error_code (context, SQLITE_CONSTRAINT);
+            break;
+        }
+        int update_type = sqlite3_value_int(argv[1]);
+        if ((sqlite3_value_type(argv[1]) != SQLITE_INTEGER) || (
+                (update_type != ReSqliteUn::NoTriggerForUpdate) &&
+                (update_type != ReSqliteUn::OneTriggerPerUpdatedTable) &&
+                (update_type != ReSqliteUn::OneTriggerPerUpdatedColumn))) {
+            sqlite3_result_error (
+                        context,
+                        "Second argument to " RESQUN_FUN_TABLES
+                        " must be 0, 1 or 2", -1);
+            sqlite3_result_error_code (context, SQLITE_CONSTRAINT);
+            break;
+        }
+
+        int count = 0;
+        rc = p_app->attachMatchingTables (
+                    ReSqliteUn::value2string (argv[0]),
+                    static_cast<ReSqliteUn::UpdateBehaviour>(update_type),
+                    &count);
+        if (rc != SQLITE_OK) {
+            sqlite3_result_error (context, RESQUN_FUN_TABLES " failed", -1);
+            sqlite3_result_error_code (context, rc);
+            break;
+        }
+
+        sqlite3_result_int (context, count);
+        break;
+    }
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
 /* ------------------------------------------------------------------------- */
 //! Implementation of the `active` function.
 static void epoint_active (
@@ -135,6 +237,119 @@ static void epoint_active (
 }
 /* ========================================================================= */
 
+/* ------------------------------------------------------------------------- */
+//! Implementation of the `scope` function.
+static void epoint_scope (
+            sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    for (;;) {
+        ReSqliteUn * p_app = static_cast<ReSqliteUn *>(
+                    sqlite3_user_data (context));
+        assert(p_app != NULL);
+
+        if ((sqlite3_value_type(argv[0]) != SQLITE_INTEGER) ||
+                (sqlite3_value_int(argv[0]) < ReSqliteUn::CaptureAllChanges) ||
+                (sqlite3_value_int(argv[0]) > ReSqliteUn::CaptureRootChanges)) {
+            sqlite3_result_error (
+                        context,
+                        "First argument to " RESQUN_FUN_SCOPE
+                        " must be 0 (all changes) or 1 (root changes)", -1);
+            sqlite3_result_error_code (context, SQLITE_CONSTRAINT);
+            break;
+        }
+
+        ReSqliteUn::SqLiteResult rc = p_app->setCaptureScope (
+                    static_cast<ReSqliteUn::CaptureScope>(
+                        sqlite3_value_int(argv[0])));
+        if (rc != SQLITE_OK) {
+            sqlite3_result_error (
+                        context,
+                        RESQUN_FUN_SCOPE " failed (root changes require "
+                        "SQLITE_ENABLE_PREUPDATE_HOOK and no active update)",
+                        -1);
+            sqlite3_result_error_code (context, rc);
+            break;
+        }
+        break;
+    }
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Implementation of the `isroot` function (used by triggers).
+static void epoint_isroot (
+            sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn * p_app = static_cast<ReSqliteUn *>(sqlite3_user_data (context));
+    assert(p_app != NULL);
+
+    sqlite3_result_int (
+                context,
+                p_app->isRootChange (
+                    reinterpret_cast<const char *>(
+                        sqlite3_value_text (argv[0])),
+                    sqlite3_value_int (argv[1]),
+                    sqlite3_value_int64 (argv[2])) ? 1 : 0);
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Implementation of the `row` function (used by triggers).
+static void epoint_row (
+            sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn * p_app = static_cast<ReSqliteUn *>(sqlite3_user_data (context));
+    assert(p_app != NULL);
+
+    if (argc < 3) {
+        sqlite3_result_error (
+                    context,
+                    RESQUN_FUN_ROW " takes at least three arguments", -1);
+        sqlite3_result_error_code (context, SQLITE_CONSTRAINT);
+        RESQLITEUN_TRACE_EXIT;
+        return;
+    }
+
+    ReSqliteUn::SqLiteResult rc = p_app->captureRow (
+                sqlite3_value_int (argv[0]),
+                sqlite3_value_int (argv[1]),
+                sqlite3_value_int64 (argv[2]),
+                argc - 3,
+                reinterpret_cast<void **>(argv + 3));
+    if (rc != SQLITE_OK) {
+        sqlite3_result_error (
+                    context, RESQUN_FUN_ROW " failed to record the change", -1);
+        sqlite3_result_error_code (context, rc);
+    }
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Implementation of the `part` function (used by the triggers of wide tables).
+static void epoint_part (
+            sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn * p_app = static_cast<ReSqliteUn *>(sqlite3_user_data (context));
+    assert(p_app != NULL);
+
+    ReSqliteUn::SqLiteResult rc = p_app->capturePart (
+                argc, reinterpret_cast<void **>(argv));
+    if (rc != SQLITE_OK) {
+        sqlite3_result_error (
+                    context, RESQUN_FUN_PART " failed to keep the values", -1);
+        sqlite3_result_error_code (context, rc);
+    }
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
 /* ------------------------------------------------------------------------- */
 //! Implementation of the `begin` function.
 static void epoint_begin (
@@ -196,6 +411,73 @@ static void epoint_getid (
 }
 /* ========================================================================= */
 
+/* ------------------------------------------------------------------------- */
+//! Common implementation for `suspend` and `resume` functions.
+static void suspend_resume (
+            sqlite3_context *context, int argc, sqlite3_value **argv,
+            bool suspend)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    for (;;) {
+        ReSqliteUn * p_app = static_cast<ReSqliteUn *>(
+                    sqlite3_user_data (context));
+        assert(p_app != NULL);
+
+        if (sqlite3_value_type(argv[0]) != SQLITE_TEXT) {
+            sqlite3_result_error (
+                        context,
+                        suspend ?
+                            "First argument to " RESQUN_FUN_SUSPEND
+                            " must be the name of a table" :
+                            "First argument to " RESQUN_FUN_RESUME
+                            " must be the name of a table", -1);
+            sqlite3_result_error_code (context, SQLITE_CONSTRAINT);
+            break;
+        }
+
+        QString table = ReSqliteUn::value2string (argv[0]);
+        ReSqliteUn::SqLiteResult rc = suspend ?
+                    p_app->suspendTable (table) :
+                    p_app->resumeTable (table);
+        if (rc != SQLITE_OK) {
+            sqlite3_result_error (
+                        context,
+                        suspend ?
+                            RESQUN_FUN_SUSPEND " failed (the table must be "
+                            "attached and an update must be active)" :
+                            RESQUN_FUN_RESUME " failed (the table must be "
+                            "attached and an update must be active)", -1);
+            sqlite3_result_error_code (context, rc);
+            break;
+        }
+        break;
+    }
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Implementation of the `suspend` function.
+static void epoint_suspend (
+            sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    suspend_resume (context, argc, argv, true);
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Implementation of the `resume` function.
+static void epoint_resume (
+            sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    suspend_resume (context, argc, argv, false);
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
 /* ------------------------------------------------------------------------- */
 //! Implementation of the `end` function.
 #define STR_END_USAGE \
@@ -429,29 +711,45 @@ struct FuncDescr {
     sqliteEntryPoint function_;
     //! do we destroy the ReSqliteUn when the database closes?
     bool has_destroy_;
+    //! flags added to the text encoding (SQLITE_DETERMINISTIC, ...)
+    int flags_;
 
     FuncDescr(
             const char * name, int arg_count,
             sqliteEntryPoint function,
-            bool has_destroy) :
+            bool has_destroy, int flags) :
         name_(name),
         arg_count_ (arg_count),
         function_ (function),
-        has_destroy_ (has_destroy)
+        has_destroy_ (has_destroy),
+        flags_ (flags)
     {}
 };
 
 #define HAS_VAR_ARG -1
 #define NO_ARG 0
 
+//! The functions that capture rows or switch tracking depend on the state
+//! of the instance, so they are not deterministic, and they cannot be
+//! used by the schema of the database file; our own triggers are TEMP,
+//! which may still call them.
+#define DIRECT_ONLY SQLITE_DIRECTONLY
+
 FuncDescr entry_points[] = {
-    {RESQUN_FUN_TABLE,  2,              epoint_table,   true},
-    {RESQUN_FUN_ACTIVE, NO_ARG,         epoint_active,  false},
-    {RESQUN_FUN_BEGIN,  HAS_VAR_ARG,    epoint_begin,   false},
-    {RESQUN_FUN_END,    HAS_VAR_ARG,    epoint_end,     false},
-    {RESQUN_FUN_UNDO,   NO_ARG,         epoint_undo,    false},
-    {RESQUN_FUN_REDO,   NO_ARG,         epoint_redo,    false},
-    {RESQUN_FUN_GETID,  NO_ARG,         epoint_getid,   false}
+    {RESQUN_FUN_TABLE,  HAS_VAR_ARG,    epoint_table,   true,   SQLITE_DETERMINISTIC},
+    {RESQUN_FUN_TABLES, 2,              epoint_tables,  false,  SQLITE_DETERMINISTIC},
+    {RESQUN_FUN_ACTIVE, NO_ARG,         epoint_active,  false,  SQLITE_DETERMINISTIC},
+    {RESQUN_FUN_BEGIN,  HAS_VAR_ARG,    epoint_begin,   false,  SQLITE_DETERMINISTIC},
+    {RESQUN_FUN_END,    HAS_VAR_ARG,    epoint_end,     false,  SQLITE_DETERMINISTIC},
+    {RESQUN_FUN_UNDO,   NO_ARG,         epoint_undo,    false,  SQLITE_DETERMINISTIC},
+    {RESQUN_FUN_REDO,   NO_ARG,         epoint_redo,    false,  SQLITE_DETERMINISTIC},
+    {RESQUN_FUN_GETID,  NO_ARG,         epoint_getid,   false,  SQLITE_DETERMINISTIC},
+    {RESQUN_FUN_SCOPE,  1,              epoint_scope,   false,  SQLITE_DETERMINISTIC},
+    {RESQUN_FUN_ISROOT, 3,              epoint_isroot,  false,  DIRECT_ONLY},
+    {RESQUN_FUN_ROW,    HAS_VAR_ARG,    epoint_row,     false,  DIRECT_ONLY},
+    {RESQUN_FUN_PART,   HAS_VAR_ARG,    epoint_part,    false,  DIRECT_ONLY},
+    {RESQUN_FUN_SUSPEND, 1,             epoint_suspend, false,  DIRECT_ONLY},
+    {RESQUN_FUN_RESUME, 1,              epoint_resume,  false,  DIRECT_ONLY}
 };
 #define entry_point_count sizeof(entry_points) / sizeof(entry_points[0])
 /* ========================================================================= */
@@ -460,61 +758,34 @@ FuncDescr entry_points[] = {
 ReSqliteUn *ReSqliteUnManager::create (void *database, QString & s_error)
 {
     RESQLITEUN_TRACE_ENTRY;
+    RESQLITEUN_PROBE1(create__start, database);
 
     sqlite3* db = static_cast<sqlite3*>(database);
     ReSqliteUn * p_app = new ReSqliteUn (static_cast<void*> (db));
 
+    // Once a function with a destructor has been handed to sqlite the
+    // instance belongs to the connection; sqlite calls epoint_destroy()
+    // even when that registration fails.
+    bool owned_by_db = false;
     int rc = SQLITE_OK;
     for (;;) {
-        // AUTOINCREMENT is justified because we use the indices to
-        // have the entries sorted by time.
-        rc = sqlite3_exec (db,
-
-            // This is where each undo or redo entry is stored.
-            "CREATE TEMP TABLE IF NOT EXISTS " RESQUN_TBL_IDX "("
-                "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-                "name TEXT, "
-                "status INTEGER "
-            ");"
-
-            // This is where the data for each individual step is stored
-            // An undo or redo method may have zero or more
-            // individual steps associated with them.
-            "CREATE TEMP TABLE IF NOT EXISTS " RESQUN_TBL_TEMP "("
-                "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-                "sql TEXT, "
-                "idxid INTEGER, "
-                "FOREIGN KEY(idxid) REFERENCES " RESQUN_TBL_IDX "(id) "
-            ");"
-
-            // We're creating an index here because
-            // `SELECT id FROM sqlite_undo WHERE idxid=XX` is common.
-            "CREATE INDEX IF NOT EXISTS " RESQUN_INDEX_DATA " "
-                "ON " RESQUN_TBL_TEMP "(idxid);" ,
-
-
-
-            NULL, NULL, NULL);
-        if (rc != SQLITE_OK) {
-            s_error = tr(
-                        "Failed to create temporary tables in ReSqliteUn `"
-                        RESQUN_FUN_TABLE "`: %s")
-                    .arg (sqlite3_errmsg(db));
-            break;
-        }
-
+        // The temporary tables are created by the instance on first use
+        // (see ReSqliteUn::createSchema()) so connections that never
+        // use undo only pay for registering the functions.
         for (int i = 0; i < entry_point_count; ++i) {
             FuncDescr * fd = &entry_points[i];
             rc = sqlite3_create_function_v2 (
                         db,
                         /* zFunctionName */ fd->name_,
                         /* nArg */ fd->arg_count_,
-                        /* eTextRep */ SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                        /* eTextRep */ SQLITE_UTF8 | fd->flags_,
                         /* pApp */ static_cast<void*>(p_app),
                         /* xFunc */ fd->function_,
                         /* xStep */ NULL,
                         /* xFinal */ NULL,
                         /* xDestroy */ fd->has_destroy_ ? epoint_destroy : NULL);
+            if (fd->has_destroy_)
+                owned_by_db = true;
             if (rc != SQLITE_OK) {
                 s_error = tr (
                             "Failed to register function `%1`: %2")
@@ -526,14 +797,53 @@ ReSqliteUn *ReSqliteUnManager::create (void *database, QString & s_error)
         if (rc != SQLITE_OK)
             break;
 
+        rc = ReSqliteUnStats::createModule (db, p_app);
+        if (rc != SQLITE_OK) {
+            s_error = tr (
+                        "Failed to register table `%1`: %2")
+                    .arg (RESQUN_VTAB_STATS)
+                    .arg (sqlite3_errmsg(db));
+            break;
+        }
+
+        rc = ReSqliteUnHistory::createModule (db, p_app);
+        if (rc != SQLITE_OK) {
+            s_error = tr (
+                        "Failed to register table `%1`: %2")
+                    .arg (RESQUN_VTAB_HISTORY)
+                    .arg (sqlite3_errmsg(db));
+            break;
+        }
+
+        rc = ReSqliteUnChanges::createModule (db, p_app);
+        if (rc != SQLITE_OK) {
+            s_error = tr (
+                        "Failed to register table `%1`: %2")
+                    .arg (RESQUN_VTAB_CHANGES)
+                    .arg (sqlite3_errmsg(db));
+            break;
+        }
+
+        rc = ReSqliteUnAsOf::createModule (db, p_app);
+        if (rc != SQLITE_OK) {
+            s_error = tr (
+                        "Failed to register module `%1`: %2")
+                    .arg (RESQUN_VTAB_ASOF)
+                    .arg (sqlite3_errmsg(db));
+            break;
+        }
 
         break;
     }
     if (rc != SQLITE_OK) {
-        delete p_app;
+        // An instance owned by the connection is released when the
+        // connection closes; deleting it here would be a double free.
+        if (!owned_by_db)
+            delete p_app;
         p_app = NULL;
     }
 
+    RESQLITEUN_PROBE2(create__done, database, rc);
     RESQLITEUN_TRACE_EXIT;
     return p_app;
 }
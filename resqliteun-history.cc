@@ -0,0 +1,429 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-history.cc
+ * @brief Definitions for ReSqliteUnHistory class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <sqlite/sqlite3.h>
+
+#include "resqliteun-history.h"
+#include "resqliteun.h"
+#include "resqliteun-private.h"
+
+#include <assert.h>
+#include <string.h>
+#include <QByteArray>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+//! The columns of the `resqun_history` table.
+enum HistoryColumns {
+    col_id = 0, // the id of the entry;
+    col_name, // the name given to begin;
+    col_status, // 0 for undo entries, 1 for redo entries;
+    col_records, // the number of journal records;
+    col_bytes, // the size of the images;
+    col_ts // when the entry was closed (opened if it is still open).
+};
+
+//! The constraints used by a plan; the arguments follow the order of bits.
+enum HistoryPlan {
+    plan_id_eq = 0x0001,
+    plan_id_gt = 0x0002,
+    plan_id_ge = 0x0004,
+    plan_id_lt = 0x0008,
+    plan_id_le = 0x0010,
+    plan_status_eq = 0x0020,
+    plan_limit = 0x0040,
+    plan_offset = 0x0080,
+    plan_desc = 0x0100,
+
+    plan_args = 8 // number of bits that take an argument
+};
+
+//! The comparison that each of the argument bits adds to the query.
+static const char * plan_terms[plan_args] = {
+    " AND id=?",
+    " AND id>?",
+    " AND id>=?",
+    " AND id<?",
+    " AND id<=?",
+    " AND status=?",
+    NULL,
+    NULL
+};
+
+//! The `resqun_history` table.
+struct HistoryTable {
+    sqlite3_vtab base; /**< must come first */
+    ReSqliteUn * undoer; /**< the instance that owns the entries */
+};
+
+//! A cursor over the `resqun_history` table.
+struct HistoryCursor {
+    sqlite3_vtab_cursor base; /**< must come first */
+    sqlite3_stmt * stmt; /**< the query over the index table */
+    bool eof; /**< no more rows */
+};
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  SQLITE Entry Points   -------------------------------------------------- */
+
+extern "C" {
+
+/* ------------------------------------------------------------------------- */
+static int history_connect (
+        sqlite3 *db, void *aux, int argc, const char * const *argv,
+        sqlite3_vtab **vtab, char **err_msg)
+{
+    Q_UNUSED(argc);
+    Q_UNUSED(argv);
+    Q_UNUSED(err_msg);
+    int rc = sqlite3_declare_vtab (
+                db, "CREATE TABLE x(id INTEGER, name TEXT, status INTEGER, "
+                    "records INTEGER, bytes INTEGER, ts INTEGER)");
+    if (rc == SQLITE_OK) {
+        HistoryTable * table = static_cast<HistoryTable *>(
+                    sqlite3_malloc (sizeof(HistoryTable)));
+        if (table == NULL) {
+            return SQLITE_NOMEM;
+        }
+        memset (table, 0, sizeof(HistoryTable));
+        table->undoer = static_cast<ReSqliteUn *>(aux);
+        *vtab = &table->base;
+    }
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int history_disconnect (sqlite3_vtab *vtab)
+{
+    sqlite3_free (vtab);
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The entries are kept in a table whose primary key is the id, so
+ * ranges of ids and the order of ids come for free; `LIMIT` and
+ * `OFFSET` are passed down when the order (if any) is handled here
+ * and every other constraint is consumed, so a page costs as much as
+ * the rows in the page. A constraint left for sqlite to check would
+ * drop rows after the limit was applied and return a short page.
+ */
+static int history_best_index (sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+    Q_UNUSED(vtab);
+    int constraint[plan_args];
+    for (int b = 0; b < plan_args; ++b) {
+        constraint[b] = -1;
+    }
+
+    // The first usable constraint of each kind.
+    bool all_consumed = true;
+    for (int i = 0; i < info->nConstraint; ++i) {
+        const sqlite3_index_info::sqlite3_index_constraint & c =
+                info->aConstraint[i];
+        if (!c.usable) {
+            continue;
+        }
+        // The column of `LIMIT` and `OFFSET` means nothing.
+        int b = -1;
+#ifdef SQLITE_INDEX_CONSTRAINT_LIMIT
+        if (c.op == SQLITE_INDEX_CONSTRAINT_LIMIT) {
+            b = 6;
+        } else if (c.op == SQLITE_INDEX_CONSTRAINT_OFFSET) {
+            b = 7;
+        } else
+#endif
+        if ((c.iColumn == col_id) || (c.iColumn == -1)) {
+            switch (c.op) {
+            case SQLITE_INDEX_CONSTRAINT_EQ: b = 0; break;
+            case SQLITE_INDEX_CONSTRAINT_GT: b = 1; break;
+            case SQLITE_INDEX_CONSTRAINT_GE: b = 2; break;
+            case SQLITE_INDEX_CONSTRAINT_LT: b = 3; break;
+            case SQLITE_INDEX_CONSTRAINT_LE: b = 4; break;
+            default: break;
+            }
+        } else if ((c.iColumn == col_status) &&
+                   (c.op == SQLITE_INDEX_CONSTRAINT_EQ)) {
+            b = 5;
+        }
+        if ((b != -1) && (constraint[b] == -1)) {
+            constraint[b] = i;
+        } else if ((b != 6) && (b != 7)) {
+            all_consumed = false;
+        }
+    }
+
+    // Rows come out ordered by id in either direction.
+    int plan = 0;
+    bool ordered = (info->nOrderBy == 0);
+    if ((info->nOrderBy == 1) &&
+            ((info->aOrderBy[0].iColumn == col_id) ||
+             (info->aOrderBy[0].iColumn == -1))) {
+        ordered = true;
+        info->orderByConsumed = 1;
+        if (info->aOrderBy[0].desc) {
+            plan |= plan_desc;
+        }
+    }
+    if (!ordered || !all_consumed) {
+        constraint[6] = -1;
+        constraint[7] = -1;
+    }
+
+    int argv_index = 0;
+    for (int b = 0; b < plan_args; ++b) {
+        if (constraint[b] != -1) {
+            plan |= (1 << b);
+            info->aConstraintUsage[constraint[b]].argvIndex = ++argv_index;
+            info->aConstraintUsage[constraint[b]].omit = 1;
+        }
+    }
+    info->idxNum = plan;
+
+    // Guess how many rows are visited.
+    double rows = 100000.0;
+    if (plan & plan_id_eq) {
+        rows = 1.0;
+        info->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+    } else {
+        if (plan & (plan_id_gt | plan_id_ge)) {
+            rows /= 4.0;
+        }
+        if (plan & (plan_id_lt | plan_id_le)) {
+            rows /= 4.0;
+        }
+        if (plan & plan_status_eq) {
+            rows /= 2.0;
+        }
+        if (plan & plan_limit) {
+            rows = rows < 100.0 ? rows : 100.0;
+        }
+    }
+    info->estimatedRows = static_cast<sqlite3_int64>(rows);
+    info->estimatedCost = rows;
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int history_open (sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
+{
+    Q_UNUSED(vtab);
+    HistoryCursor * cur = static_cast<HistoryCursor *>(
+                sqlite3_malloc (sizeof(HistoryCursor)));
+    if (cur == NULL) {
+        return SQLITE_NOMEM;
+    }
+    memset (cur, 0, sizeof(HistoryCursor));
+    cur->eof = true;
+    *cursor = &cur->base;
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int history_close (sqlite3_vtab_cursor *cursor)
+{
+    HistoryCursor * cur = reinterpret_cast<HistoryCursor *>(cursor);
+    if (cur->stmt != NULL) {
+        sqlite3_finalize (cur->stmt);
+    }
+    sqlite3_free (cursor);
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int history_next (sqlite3_vtab_cursor *cursor)
+{
+    HistoryCursor * cur = reinterpret_cast<HistoryCursor *>(cursor);
+    int rc = sqlite3_step (cur->stmt);
+    if (rc == SQLITE_ROW) {
+        return SQLITE_OK;
+    }
+    cur->eof = true;
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int history_filter (
+        sqlite3_vtab_cursor *cursor, int idx_num, const char *idx_str,
+        int argc, sqlite3_value **argv)
+{
+    Q_UNUSED(idx_str);
+    HistoryCursor * cur = reinterpret_cast<HistoryCursor *>(cursor);
+    HistoryTable * table = reinterpret_cast<HistoryTable *>(cursor->pVtab);
+    if (cur->stmt != NULL) {
+        sqlite3_finalize (cur->stmt);
+        cur->stmt = NULL;
+    }
+    cur->eof = true;
+
+    // Nothing was recorded yet.
+    if (!table->undoer->hasSchema ()) {
+        return SQLITE_OK;
+    }
+
+    QByteArray statement (
+                "SELECT id, name, status, records, bytes, "
+                    "COALESCE(finished, started) "
+                "FROM " RESQUN_TBL_IDX " WHERE 1");
+    for (int b = 0; b < plan_args; ++b) {
+        if ((idx_num & (1 << b)) && (plan_terms[b] != NULL)) {
+            statement.append (plan_terms[b]);
+        }
+    }
+    statement.append (idx_num & plan_desc ?
+                          " ORDER BY id DESC" : " ORDER BY id");
+    if (idx_num & (plan_limit | plan_offset)) {
+        statement.append (idx_num & plan_limit ? " LIMIT ?" : " LIMIT -1");
+        if (idx_num & plan_offset) {
+            statement.append (" OFFSET ?");
+        }
+    }
+
+    int rc = sqlite3_prepare_v2 (
+                static_cast<sqlite3 *>(table->undoer->db_),
+                statement.constData (), -1, &cur->stmt, NULL);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    for (int i = 0; i < argc; ++i) {
+        sqlite3_bind_value (cur->stmt, i + 1, argv[i]);
+    }
+    cur->eof = false;
+    return history_next (cursor);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int history_eof (sqlite3_vtab_cursor *cursor)
+{
+    return reinterpret_cast<HistoryCursor *>(cursor)->eof;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int history_column (
+        sqlite3_vtab_cursor *cursor, sqlite3_context *context, int column)
+{
+    const HistoryCursor * cur = reinterpret_cast<HistoryCursor *>(cursor);
+    sqlite3_result_value (context, sqlite3_column_value (cur->stmt, column));
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int history_rowid (sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
+{
+    const HistoryCursor * cur = reinterpret_cast<HistoryCursor *>(cursor);
+    *rowid = sqlite3_column_int64 (cur->stmt, col_id);
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+} // extern "C"
+
+/* ------------------------------------------------------------------------- */
+//! The module behind the `resqun_history` table (eponymous, read only).
+static sqlite3_module history_module = {
+    /* iVersion */ 0,
+    /* xCreate */ NULL,
+    /* xConnect */ history_connect,
+    /* xBestIndex */ history_best_index,
+    /* xDisconnect */ history_disconnect,
+    /* xDestroy */ NULL,
+    /* xOpen */ history_open,
+    /* xClose */ history_close,
+    /* xFilter */ history_filter,
+    /* xNext */ history_next,
+    /* xEof */ history_eof,
+    /* xColumn */ history_column,
+    /* xRowid */ history_rowid,
+    /* xUpdate */ NULL,
+    /* xBegin */ NULL,
+    /* xSync */ NULL,
+    /* xCommit */ NULL,
+    /* xRollback */ NULL,
+    /* xFindFunction */ NULL,
+    /* xRename */ NULL,
+    /* xSavepoint */ NULL,
+    /* xRelease */ NULL,
+    /* xRollbackTo */ NULL
+};
+/* ========================================================================= */
+
+/*  SQLITE Entry Points   ================================================== */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+/**
+ * @class ReSqliteUnHistory
+ *
+ * The entries live in the `resqun_sqlite_itbl` temporary table. The
+ * `resqun_history` table reads them through a query built for each scan
+ * from the constraints the statement has on `id` (`=`, `<`, `<=`, `>`,
+ * `>=`) and `status` (`=`), its order (`ORDER BY id` in either direction)
+ * and its `LIMIT` and `OFFSET`, so that
+ *
+ * @code
+ * SELECT * FROM resqun_history WHERE id < ? ORDER BY id DESC LIMIT 50
+ * @endcode
+ *
+ * visits 50 rows of the primary key, however long the history is.
+ */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The table is eponymous: it exists in every connection that has an
+ * instance and needs no `CREATE VIRTUAL TABLE`.
+ *
+ * @param db The connection.
+ * @param undoer The instance associated with the connection.
+ * @return error code
+ */
+int ReSqliteUnHistory::createModule (void * db, ReSqliteUn * undoer)
+{
+    return sqlite3_create_module_v2 (
+                static_cast<sqlite3 *>(db), RESQUN_VTAB_HISTORY,
+                &history_module, undoer, NULL);
+}
+/* ========================================================================= */
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
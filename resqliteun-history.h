@@ -0,0 +1,74 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-history.h
+ * @brief Declarations for ReSqliteUnHistory class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_RESQLITEUN_HISTORY_H_INCLUDE
+#define GUARD_RESQLITEUN_HISTORY_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <resqliteun/resqliteun-config.h>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+class ReSqliteUn;
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+//! The `resqun_history` table that pages through the undo-redo entries.
+class RESQLITEUN_EXPORT ReSqliteUnHistory {
+    //
+    //
+    //
+    //
+    /*  FUNCTIONS    ------------------------------------------------------- */
+
+public:
+
+    //! Register the `resqun_history` table for a connection.
+    static int
+    createModule (
+            void * db,
+            ReSqliteUn * undoer);
+
+    /*  FUNCTIONS    ======================================================= */
+    //
+    //
+    //
+    //
+
+}; // class ReSqliteUnHistory
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+
+#endif // GUARD_RESQLITEUN_HISTORY_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
@@ -0,0 +1,178 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-incremental.cc
+ * @brief Definitions for ReSqliteUnIncremental class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <sqlite/sqlite3.h>
+
+#include "resqliteun-incremental.h"
+#include "resqliteun-private.h"
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+/**
+ * @class ReSqliteUnIncremental
+ *
+ * For applications that cannot move the connection to another thread
+ * (see ReSqliteUnAsync) the replay of an entry can be split in slices
+ * that are run from the event loop: each call to step() applies the
+ * steps of the plan (see ReSqliteUn::ReplayStep), in the same order as
+ * ReSqliteUn::performUndoRedo(), until the time budget is spent. There
+ * is one step for each record that changes a table, so position() and
+ * count() are in steps, not in records of the journal.
+ *
+ * All the changes are made inside the `RESQUN_SVP_UNDO` savepoint that
+ * is only released after the last step, so abort() (or deleting an
+ * unfinished instance) leaves the database as it was. The application
+ * may read from the database between slices but should not change it,
+ * as those changes would be rolled back along with the replay.
+ */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Instances are created by ReSqliteUn::beginUndoRedo().
+ *
+ * @param undoer The instance that performs the replay.
+ * @param plan The plan returned by ReSqliteUn::openReplay().
+ */
+ReSqliteUnIncremental::ReSqliteUnIncremental (
+        ReSqliteUn * undoer, ReSqliteUn::ReplayPlan * plan) :
+    undoer_ (undoer),
+    plan_ (plan),
+    position_ (0),
+    count_ (plan->steps.count ())
+{
+    RESQLITEUN_TRACE_ENTRY;
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+ReSqliteUnIncremental::~ReSqliteUnIncremental()
+{
+    RESQLITEUN_TRACE_ENTRY;
+    abort ();
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * At least one step is applied by each call. When the last step
+ * is applied the savepoint is released and the replay is finished.
+ * On error the changes are rolled back and the replay is finished.
+ *
+ * @param budget_ms Time available for this slice, in milliseconds.
+ * @param s_error Receives the error message, if any.
+ * @return SQLITE_ROW if there is more to do, SQLITE_DONE when finished,
+ * an error code otherwise
+ */
+ReSqliteUn::SqLiteResult ReSqliteUnIncremental::step (
+        int budget_ms, QString & s_error)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (undoer_->db_);
+    ReSqliteUn::SqLiteResult rc = SQLITE_MISUSE;
+    for (;;) {
+        if (plan_ == NULL) {
+            s_error = tr ("The replay is finished");
+            break;
+        }
+
+        rc = undoer_->runPlan (*plan_, position_, budget_ms, s_error);
+        if (rc != SQLITE_OK) {
+            undoer_->closeReplay (plan_, false);
+            plan_ = NULL;
+            break;
+        }
+
+        if (position_ < count_) {
+            rc = SQLITE_ROW;
+        } else {
+            undoer_->closeReplay (plan_, true);
+            plan_ = NULL;
+            rc = SQLITE_DONE;
+        }
+        break;
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Does nothing if the replay is finished.
+ */
+void ReSqliteUnIncremental::abort ()
+{
+    RESQLITEUN_TRACE_ENTRY;
+    if (plan_ != NULL) {
+        ReSqliteUnLocker locker (undoer_->db_);
+        undoer_->closeReplay (plan_, false);
+        plan_ = NULL;
+    }
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+/* ------------------------------------------------------------------------- */
+/**
+ * The status of the entry is changed and the savepoint is opened right
+ * away; the steps are applied by ReSqliteUnIncremental::step().
+ * Other undo, redo and begin() calls are refused until the returned
+ * instance is finished.
+ *
+ * @param for_undo Undo (true) or redo.
+ * @param s_error Receives the error message, if any.
+ * @return the instance that applies the steps (owned by the caller)
+ * or NULL if there is nothing to undo or redo or on error
+ */
+ReSqliteUnIncremental * ReSqliteUn::beginUndoRedo (
+        bool for_undo, QString &s_error)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    ReSqliteUnIncremental * result = NULL;
+    ReplayPlan * plan;
+    ReSqliteUn::SqLiteResult rc = openReplay (for_undo, plan, s_error);
+    if (rc == SQLITE_OK) {
+        result = new ReSqliteUnIncremental (this, plan);
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
@@ -0,0 +1,127 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-incremental.h
+ * @brief Declarations for ReSqliteUnIncremental class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_RESQLITEUN_INCREMENTAL_H_INCLUDE
+#define GUARD_RESQLITEUN_INCREMENTAL_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <resqliteun/resqliteun.h>
+
+#include <QString>
+#include <QCoreApplication>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+//! An undo or redo that is applied in slices.
+class RESQLITEUN_EXPORT ReSqliteUnIncremental {
+    //
+    //
+    //
+    //
+    /*  DEFINITIONS    ----------------------------------------------------- */
+    Q_DECLARE_TR_FUNCTIONS(ReSqliteUnIncremental)
+
+    /*  DEFINITIONS    ===================================================== */
+    //
+    //
+    //
+    //
+    /*  DATA    ------------------------------------------------------------ */
+
+private:
+
+    ReSqliteUn * undoer_; /**< the instance that performs the replay */
+    ReSqliteUn::ReplayPlan * plan_; /**< the plan; NULL once finished */
+    int position_; /**< next step of the plan */
+    int count_; /**< number of steps in the plan */
+
+    /*  DATA    ============================================================ */
+    //
+    //
+    //
+    //
+    /*  FUNCTIONS    ------------------------------------------------------- */
+
+public:
+
+    //! Constructor; takes ownership of the plan.
+    ReSqliteUnIncremental (
+            ReSqliteUn * undoer,
+            ReSqliteUn::ReplayPlan * plan);
+
+    //! Destructor; aborts the replay if it was not finished.
+    virtual ~ReSqliteUnIncremental ();
+
+    //! Apply replay steps until the time budget is spent.
+    ReSqliteUn::SqLiteResult
+    step (
+            int budget_ms,
+            QString & s_error);
+
+    //! Roll back the changes and give up.
+    void
+    abort ();
+
+    //! Was the replay completed, aborted or did it fail?
+    bool
+    isFinished () const {
+        return plan_ == NULL;
+    }
+
+    //! Number of replay steps applied so far (see count()).
+    int
+    position () const {
+        return position_;
+    }
+
+    //! Number of replay steps; records that change nothing have none.
+    int
+    count () const {
+        return count_;
+    }
+
+    /*  FUNCTIONS    ======================================================= */
+    //
+    //
+    //
+    //
+
+}; // class ReSqliteUnIncremental
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+
+#endif // GUARD_RESQLITEUN_INCREMENTAL_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
@@ -23,6 +23,10 @@
 
 #include <assert.h>
 #include <QStringBuilder>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInt>
+#include <QAtomicPointer>
 
 /*  INCLUDES    ============================================================ */
 //
@@ -34,6 +38,162 @@
 // the list of instances
 QList<ReSqliteUn *> ReSqliteUnManager::instances_;
 
+//! Minimum number of slots in the lookup table.
+#define REGISTRY_MIN_CAPACITY 16
+
+//! A slot in the lookup table.
+struct RegistrySlot {
+    QAtomicPointer<void> database; /**< NULL (never used), the key or tombstone */
+    QAtomicPointer<ReSqliteUn> instance; /**< the value (NULL once removed) */
+};
+
+//! Open-addressing table that maps connections to instances.
+struct RegistryTable {
+    int capacity; /**< number of slots (a power of two) */
+    int used; /**< slots that are not empty (including tombstones) */
+    int live; /**< slots that hold an instance */
+    RegistrySlot * entries; /**< the slots */
+};
+
+//! Marks the slots of removed instances; these are never reused.
+static char tombstone;
+
+//! Serializes the writers and guards instances_.
+static QMutex registry_lock;
+
+//! The table used by readers.
+static QAtomicPointer<RegistryTable> registry_table;
+
+//! What a thread that looks up instances tells the writers.
+struct RegistryReader {
+    QAtomicPointer<RegistryTable> table; /**< the table being read (NULL outside a lookup) */
+    QAtomicInt in_use; /**< is the reader owned by a running thread? */
+};
+
+//! Gives the reader back when the thread ends.
+struct RegistryOwner {
+    RegistryReader * reader;
+    ~RegistryOwner () {
+        if (reader != NULL) {
+            reader->in_use.storeRelease (0);
+        }
+    }
+};
+
+//! All readers ever created; they are reused, never freed (guarded by the lock).
+static QList<RegistryReader *> registry_readers;
+
+//! The reader of each thread.
+static thread_local RegistryOwner registry_owner = { NULL };
+
+//! Tables replaced while readers may still use them (guarded by the lock).
+static QList<RegistryTable *> registry_retired;
+
+/* ------------------------------------------------------------------------- */
+//! First slot to look at for a connection.
+static inline int registrySlot (const void * database, int capacity)
+{
+    quint64 key = reinterpret_cast<quintptr>(database);
+    key = (key >> 4) * Q_UINT64_C(0x9E3779B97F4A7C15);
+    return static_cast<int>(key >> 32) & (capacity - 1);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The reader of a thread that ended is reused. This is the only place
+ * where a lookup takes the lock, once in the life of a thread.
+ *
+ * @return the reader of the calling thread
+ */
+static RegistryReader * claimReader ()
+{
+    QMutexLocker locker (&registry_lock);
+    RegistryReader * reader = NULL;
+    foreach(RegistryReader * iter, registry_readers) {
+        if (iter->in_use.loadAcquire () == 0) {
+            reader = iter;
+            break;
+        }
+    }
+    if (reader == NULL) {
+        reader = new RegistryReader ();
+        registry_readers.append (reader);
+    }
+    reader->in_use.storeRelease (1);
+    registry_owner.reader = reader;
+    return reader;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Release the tables that were replaced and that no reader uses (locked).
+static void registryCollect ()
+{
+    if (registry_retired.isEmpty ()) {
+        return;
+    }
+    QList<RegistryTable *> kept;
+    foreach(RegistryTable * table, registry_retired) {
+        bool in_use = false;
+        foreach(RegistryReader * reader, registry_readers) {
+            if (reader->table.loadAcquire () == table) {
+                in_use = true;
+                break;
+            }
+        }
+        if (in_use) {
+            kept.append (table);
+        } else {
+            delete [] table->entries;
+            delete table;
+        }
+    }
+    registry_retired = kept;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Replace the table with one that has room for more instances (locked).
+static RegistryTable * registryGrow (RegistryTable * current)
+{
+    int live = (current == NULL ? 0 : current->live);
+    int capacity = REGISTRY_MIN_CAPACITY;
+    while (capacity < (live + 1) * 4) {
+        capacity *= 2;
+    }
+
+    RegistryTable * table = new RegistryTable ();
+    table->capacity = capacity;
+    table->used = 0;
+    table->live = 0;
+    table->entries = new RegistrySlot[capacity];
+    if (current != NULL) {
+        for (int i = 0; i < current->capacity; ++i) {
+            ReSqliteUn * instance = current->entries[i].instance.loadAcquire ();
+            if (instance == NULL) {
+                continue;
+            }
+            void * database = current->entries[i].database.loadAcquire ();
+            int j = registrySlot (database, capacity);
+            while (table->entries[j].database.loadAcquire () != NULL) {
+                j = (j + 1) & (capacity - 1);
+            }
+            table->entries[j].instance.storeRelease (instance);
+            table->entries[j].database.storeRelease (database);
+            ++table->used;
+            ++table->live;
+        }
+    }
+
+    registry_table.fetchAndStoreOrdered (table);
+    if (current != NULL) {
+        registry_retired.append (current);
+    }
+    return table;
+}
+/* ========================================================================= */
+
 /*  DEFINITIONS    ========================================================= */
 //
 //
@@ -57,6 +217,7 @@ ReSqliteUn *ReSqliteUnManager::instance (int interface_version)
         return NULL;
     }
 
+    QMutexLocker locker (&registry_lock);
     int last = instances_.count () - 1;
     if (last < 0) {
         return NULL;
@@ -85,6 +246,7 @@ ReSqliteUn *ReSqliteUnManager::instanceForIndex (
         return NULL;
     }
 
+    QMutexLocker locker (&registry_lock);
     if ((i < 0) || (i >= instances_.count ())) {
         return NULL;
     } else {
@@ -95,8 +257,9 @@ ReSqliteUn *ReSqliteUnManager::instanceForIndex (
 
 /* ------------------------------------------------------------------------- */
 /**
- * The method involves checking all instances so it may be worth caching
- * the result if this is called often.
+ * The lookup does not lock (except for the first lookup of a thread,
+ * see claimReader()): it may be called from any thread while other
+ * threads open and close connections.
  *
  * @param sqlite_database The database to look for.
  * @param interface_version Internal use (checks that the version is teh right one).
@@ -111,15 +274,121 @@ ReSqliteUn *ReSqliteUnManager::instanceForDatabase (
                 RESQLITEUN_VERSION, interface_version);
         return NULL;
     }
-    sqlite3 * dtb = static_cast<sqlite3 *>(sqlite_database);
 
-    foreach(ReSqliteUn * iter, instances_) {
-        if (dtb == static_cast<sqlite3 *>(iter->db_)) {
-            return iter;
+    RegistryReader * reader = registry_owner.reader;
+    if (reader == NULL) {
+        reader = claimReader ();
+    }
+
+    // Writers do not free the table published by the reader; it is
+    // published before it is used, so a table that was replaced
+    // in the mean time is not used at all.
+    ReSqliteUn * result = NULL;
+    RegistryTable * table = registry_table.loadAcquire ();
+    for (;;) {
+        reader->table.fetchAndStoreOrdered (table);
+        RegistryTable * current = registry_table.loadAcquire ();
+        if (current == table) {
+            break;
         }
+        table = current;
     }
+    if (table != NULL) {
+        int i = registrySlot (sqlite_database, table->capacity);
+        for (int n = 0; n < table->capacity; ++n) {
+            void * database = table->entries[i].database.loadAcquire ();
+            if (database == NULL) {
+                break;
+            } else if (database == sqlite_database) {
+                result = table->entries[i].instance.loadAcquire ();
+                break;
+            }
+            i = (i + 1) & (table->capacity - 1);
+        }
+    }
+    reader->table.storeRelease (NULL);
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int ReSqliteUnManager::instanceCount ()
+{
+    QMutexLocker locker (&registry_lock);
+    return instances_.count ();
+}
+/* ========================================================================= */
 
-    return NULL;
+/* ------------------------------------------------------------------------- */
+/**
+ * Called by the constructor of ReSqliteUn.
+ *
+ * Writers are serialized by a mutex. The value of a slot is stored
+ * before its key, so a reader that finds the key also finds the value.
+ * Slots are never reused: removed instances leave a tombstone
+ * and the table is rebuilt when it is half full. Each thread that looks
+ * up instances publishes the table it reads in a reader of its own, so
+ * readers do not contend with each other; a table that was replaced is
+ * released by the next writer that finds no reader using it.
+ *
+ * @param instance The new instance.
+ */
+void ReSqliteUnManager::registerInstance (ReSqliteUn * instance)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    QMutexLocker locker (&registry_lock);
+    instances_.append (instance);
+
+    RegistryTable * table = registry_table.loadAcquire ();
+    if ((table == NULL) || ((table->used + 1) * 2 > table->capacity)) {
+        table = registryGrow (table);
+    }
+    int i = registrySlot (instance->db_, table->capacity);
+    while (table->entries[i].database.loadAcquire () != NULL) {
+        i = (i + 1) & (table->capacity - 1);
+    }
+    table->entries[i].instance.storeRelease (instance);
+    table->entries[i].database.storeRelease (instance->db_);
+    ++table->used;
+    ++table->live;
+
+    registryCollect ();
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Called by the destructor of ReSqliteUn.
+ *
+ * @param instance The instance that goes away.
+ */
+void ReSqliteUnManager::unregisterInstance (ReSqliteUn * instance)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    QMutexLocker locker (&registry_lock);
+    instances_.removeOne (instance);
+
+    RegistryTable * table = registry_table.loadAcquire ();
+    if (table != NULL) {
+        int i = registrySlot (instance->db_, table->capacity);
+        for (int n = 0; n < table->capacity; ++n) {
+            void * database = table->entries[i].database.loadAcquire ();
+            if (database == NULL) {
+                break;
+            } else if ((database == instance->db_) &&
+                       (table->entries[i].instance.loadAcquire () == instance)) {
+                table->entries[i].instance.storeRelease (NULL);
+                table->entries[i].database.storeRelease (&tombstone);
+                --table->live;
+                break;
+            }
+            i = (i + 1) & (table->capacity - 1);
+        }
+    }
+
+    registryCollect ();
+    RESQLITEUN_TRACE_EXIT;
 }
 /* ========================================================================= */
 
@@ -63,7 +63,7 @@ class RESQLITEUN_EXPORT ReSqliteUnManager {
 
 public:
 
-    static QList<ReSqliteUn *> instances_; /**< the list of instances */
+    static QList<ReSqliteUn *> instances_; /**< the list of instances (guarded by the registry lock) */
 
     /*  DATA    ============================================================ */
     //
@@ -87,9 +87,7 @@ public:
 
     //! The number of instances.
     static int
-    instanceCount () {
-        return instances_.count ();
-    }
+    instanceCount ();
 
     //! The instance at a particular index.
     static ReSqliteUn *
@@ -103,6 +101,16 @@ public:
             void * sqlite_database,
             int interface_version=RESQLITEUN_VERSION);
 
+    //! Make an instance known to the lookup functions.
+    static void
+    registerInstance (
+            ReSqliteUn * instance);
+
+    //! Forget about an instance.
+    static void
+    unregisterInstance (
+            ReSqliteUn * instance);
+
     //! Creates an instance of the clsaa for the given database.
     static ReSqliteUn *
     create (
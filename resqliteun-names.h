@@ -30,6 +30,11 @@
 #define RESQUN_FUN_TABLE    RESQUN_PREFIX "table"
 #endif // RESQUN_FUN_TABLE
 
+#ifndef RESQUN_FUN_TABLES
+//! Name of the function used for adding many tables to undo-redo system.
+#define RESQUN_FUN_TABLES   RESQUN_PREFIX "tables"
+#endif // RESQUN_FUN_TABLES
+
 #ifndef RESQUN_FUN_ACTIVE
 //! Name of the function used for
 #define RESQUN_FUN_ACTIVE   RESQUN_PREFIX "active"
@@ -60,6 +65,56 @@
 #define RESQUN_FUN_GETID    RESQUN_PREFIX "getid"
 #endif // RESQUN_FUN_GETID
 
+#ifndef RESQUN_FUN_SCOPE
+//! Name of the function used for selecting which changes are recorded.
+#define RESQUN_FUN_SCOPE    RESQUN_PREFIX "scope"
+#endif // RESQUN_FUN_SCOPE
+
+#ifndef RESQUN_FUN_ISROOT
+//! Name of the function used by triggers to skip nested changes.
+#define RESQUN_FUN_ISROOT   RESQUN_PREFIX "isroot"
+#endif // RESQUN_FUN_ISROOT
+
+#ifndef RESQUN_FUN_ROW
+//! Name of the function used by triggers to record a row.
+#define RESQUN_FUN_ROW      RESQUN_PREFIX "row"
+#endif // RESQUN_FUN_ROW
+
+#ifndef RESQUN_FUN_PART
+//! Name of the function used by triggers to pass the first values of a wide row.
+#define RESQUN_FUN_PART     RESQUN_PREFIX "part"
+#endif // RESQUN_FUN_PART
+
+#ifndef RESQUN_FUN_SUSPEND
+//! Name of the function used for suspending row tracking for a table.
+#define RESQUN_FUN_SUSPEND  RESQUN_PREFIX "suspend"
+#endif // RESQUN_FUN_SUSPEND
+
+#ifndef RESQUN_FUN_RESUME
+//! Name of the function used for resuming row tracking for a table.
+#define RESQUN_FUN_RESUME   RESQUN_PREFIX "resume"
+#endif // RESQUN_FUN_RESUME
+
+#ifndef RESQUN_VTAB_STATS
+//! Name of the table that shows the counters of the instance.
+#define RESQUN_VTAB_STATS   RESQUN_PREFIX "stats"
+#endif // RESQUN_VTAB_STATS
+
+#ifndef RESQUN_VTAB_HISTORY
+//! Name of the table that lists the undo and redo entries.
+#define RESQUN_VTAB_HISTORY RESQUN_PREFIX "history"
+#endif // RESQUN_VTAB_HISTORY
+
+#ifndef RESQUN_VTAB_CHANGES
+//! Name of the table-valued function that lists the changes of an entry.
+#define RESQUN_VTAB_CHANGES RESQUN_PREFIX "changes"
+#endif // RESQUN_VTAB_CHANGES
+
+#ifndef RESQUN_VTAB_ASOF
+//! Name of the module that shows a table as it was after an entry.
+#define RESQUN_VTAB_ASOF    RESQUN_PREFIX "asof"
+#endif // RESQUN_VTAB_ASOF
+
 #ifndef RESQUN_TBL_TEMP
 //! The table to be used for storing undo-redo stack.
 #define RESQUN_TBL_TEMP     RESQUN_PREFIX "sqlite_undo"
@@ -75,6 +130,16 @@
 #define RESQUN_INDEX_DATA   RESQUN_PREFIX "sqlite_index"
 #endif // RESQUN_INDEX_DATA
 
+#ifndef RESQUN_INDEX_ROWS
+//! The index that finds the records of a row in the undo-redo stack.
+#define RESQUN_INDEX_ROWS   RESQUN_PREFIX "sqlite_rows"
+#endif // RESQUN_INDEX_ROWS
+
+#ifndef RESQUN_TBL_SHADOW
+//! Prefix for the tables that store snapshots of suspended tables.
+#define RESQUN_TBL_SHADOW   RESQUN_PREFIX "shadow_"
+#endif // RESQUN_TBL_SHADOW
+
 #ifndef RESQUN_SVP_BEGIN
 //! Name of the savepoint used in `begin` command.
 #define RESQUN_SVP_BEGIN    RESQUN_PREFIX "begin_svp"
@@ -95,6 +160,31 @@
 #define RESQUN_MARK_REDO    1
 #endif // RESQUN_MARK_REDO
 
+#ifndef RESQUN_KIND_INSERT
+//! Marker used in temporary table to indicate a record for inserted rows.
+#define RESQUN_KIND_INSERT          1
+#endif // RESQUN_KIND_INSERT
+
+#ifndef RESQUN_KIND_DELETE
+//! Marker used in temporary table to indicate a record for a deleted row.
+#define RESQUN_KIND_DELETE          2
+#endif // RESQUN_KIND_DELETE
+
+#ifndef RESQUN_KIND_UPDATE
+//! Marker used in temporary table to indicate a record for an updated row.
+#define RESQUN_KIND_UPDATE          3
+#endif // RESQUN_KIND_UPDATE
+
+#ifndef RESQUN_KIND_UPDATE_COLUMN
+//! Marker used in temporary table to indicate a record for an updated column.
+#define RESQUN_KIND_UPDATE_COLUMN   4
+#endif // RESQUN_KIND_UPDATE_COLUMN
+
+#ifndef RESQUN_KIND_SNAPSHOT
+//! Marker used in temporary table to indicate a snapshot of a whole table.
+#define RESQUN_KIND_SNAPSHOT        5
+#endif // RESQUN_KIND_SNAPSHOT
+
 
 /** @} */
 
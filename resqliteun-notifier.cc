@@ -0,0 +1,88 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-notifier.cc
+ * @brief Definitions for ReSqliteUnNotifier class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include "resqliteun-notifier.h"
+#include "resqliteun-private.h"
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+/**
+ * @class ReSqliteUnNotifier
+ *
+ * The notifier adds itself to the change listeners of the instance
+ * (see ReSqliteUn::addChangeListener()), so any number of notifiers
+ * may watch an instance next to the change callback. The signal is emitted
+ * on the thread that changed the database; ReSqliteUn::ChangeSet is
+ * registered as a meta-type, so queued connections to objects living in
+ * other threads (the GUI thread while performUndoRedoAsync() runs) work.
+ *
+ * The notifier may outlive the database: it checks that the instance
+ * still exists before removing the listener.
+ */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param undoer The instance whose changes are reported.
+ * @param parent The parent object.
+ */
+ReSqliteUnNotifier::ReSqliteUnNotifier (ReSqliteUn * undoer, QObject * parent) :
+    QObject (parent),
+    undoer_ (undoer),
+    db_ (undoer->db_)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    qRegisterMetaType<ReSqliteUn::ChangeSet> ("ReSqliteUn::ChangeSet");
+    undoer_->addChangeListener (changeCallback, this);
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+ReSqliteUnNotifier::~ReSqliteUnNotifier ()
+{
+    RESQLITEUN_TRACE_ENTRY;
+    if (ReSqliteUn::instanceForDatabase (db_) == undoer_) {
+        undoer_->removeChangeListener (changeCallback, this);
+    }
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void ReSqliteUnNotifier::changeCallback (
+        ReSqliteUn * undoer, int reason,
+        const ReSqliteUn::ChangeSet & changes, void * user_data)
+{
+    Q_UNUSED(undoer);
+    ReSqliteUnNotifier * self = static_cast<ReSqliteUnNotifier *>(user_data);
+    emit self->changed (reason, changes);
+}
+/* ========================================================================= */
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
@@ -0,0 +1,117 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-notifier.h
+ * @brief Declarations for ReSqliteUnNotifier class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_RESQLITEUN_NOTIFIER_H_INCLUDE
+#define GUARD_RESQLITEUN_NOTIFIER_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <resqliteun/resqliteun-config.h>
+#include <resqliteun/resqliteun.h>
+
+#include <QObject>
+#include <QMetaType>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+//! Turns the change sets of an instance into a Qt signal.
+class RESQLITEUN_EXPORT ReSqliteUnNotifier : public QObject {
+    Q_OBJECT
+    //
+    //
+    //
+    //
+    /*  DATA    ------------------------------------------------------------ */
+
+private:
+
+    ReSqliteUn * undoer_; /**< the instance that publishes the changes */
+    void * db_; /**< the database of the instance */
+
+    /*  DATA    ============================================================ */
+    //
+    //
+    //
+    //
+    /*  FUNCTIONS    ------------------------------------------------------- */
+
+public:
+
+    //! Constructor; becomes a change listener of the instance.
+    ReSqliteUnNotifier (
+            ReSqliteUn * undoer,
+            QObject * parent = NULL);
+
+    //! Destructor; removes the listener.
+    virtual ~ReSqliteUnNotifier ();
+
+    //! The instance that publishes the changes.
+    ReSqliteUn *
+    undoer () const {
+        return undoer_;
+    }
+
+signals:
+
+    //! Rows were changed by end, undo or redo (see ReSqliteUn::ChangeReason).
+    void
+    changed (
+            int reason,
+            const ReSqliteUn::ChangeSet & changes);
+
+private:
+
+    //! The listener added to the instance.
+    static void
+    changeCallback (
+            ReSqliteUn * undoer,
+            int reason,
+            const ReSqliteUn::ChangeSet & changes,
+            void * user_data);
+
+    /*  FUNCTIONS    ======================================================= */
+    //
+    //
+    //
+    //
+
+}; // class ReSqliteUnNotifier
+
+Q_DECLARE_METATYPE(ReSqliteUn::ChangeSet)
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+
+#endif // GUARD_RESQLITEUN_NOTIFIER_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
@@ -13,29 +13,60 @@
 #include <resqliteun/resqliteun-config.h>
 #include <QDebug>
 
-#if 0
-//#    define RESQLITEUN_DEBUGM printf
-#    define RESQLITEUN_DEBUGM qDebug() << QString::asprintf
+#ifdef RESQLITEUN_TRACE
+#    include <resqliteun/resqliteun-trace.h>
+#    define RESQLITEUN_TRACE_CAT2(a, b) a ## b
+#    define RESQLITEUN_TRACE_CAT(a, b) RESQLITEUN_TRACE_CAT2(a, b)
+#    define RESQLITEUN_DEBUGM ReSqliteUnTrace::message
+#    define RESQLITEUN_TRACE_ENTRY \
+        ReSqliteUnTrace::Span resqliteun_trace_entry_ (__func__)
+#    define RESQLITEUN_TRACE_EXIT
+#    define RESQLITEUN_TRACE_SPAN(name) \
+        ReSqliteUnTrace::Span RESQLITEUN_TRACE_CAT( \
+            resqliteun_trace_span_, __LINE__) (name)
 #else
 #    define RESQLITEUN_DEBUGM black_hole
-#endif
-
-#if 0
-//#    define RESQLITEUN_TRACE_ENTRY printf("RESQLITEUN ENTRY %s in %s[%d]\n", __func__, __FILE__, __LINE__)
-#    define RESQLITEUN_TRACE_ENTRY qDebug() << QString::asprintf("RESQLITEUN ENTRY %s", __func__)
-#else
 #    define RESQLITEUN_TRACE_ENTRY
+#    define RESQLITEUN_TRACE_EXIT
+#    define RESQLITEUN_TRACE_SPAN(name)
 #endif
 
-#if 0
-//#    define RESQLITEUN_TRACE_EXIT printf("RESQLITEUN EXIT %s in %s[%d]\n", __func__, __FILE__, __LINE__)
-#    define RESQLITEUN_TRACE_EXIT qDebug() << QString::asprintf("RESQLITEUN EXIT %s", __func__)
+// Static probes for perf and bpftrace (provider `resqliteun`); a probe
+// is a single nop in the code until a tool attaches to it.
+#ifdef RESQLITEUN_USDT
+#    include <sys/sdt.h>
+#    define RESQLITEUN_PROBE1(name, a) \
+        DTRACE_PROBE1(resqliteun, name, a)
+#    define RESQLITEUN_PROBE2(name, a, b) \
+        DTRACE_PROBE2(resqliteun, name, a, b)
+#    define RESQLITEUN_PROBE3(name, a, b, c) \
+        DTRACE_PROBE3(resqliteun, name, a, b, c)
+#    define RESQLITEUN_PROBE4(name, a, b, c, d) \
+        DTRACE_PROBE4(resqliteun, name, a, b, c, d)
+#    define RESQLITEUN_PROBE5(name, a, b, c, d, e) \
+        DTRACE_PROBE5(resqliteun, name, a, b, c, d, e)
 #else
-#    define RESQLITEUN_TRACE_EXIT
+#    define RESQLITEUN_PROBE1(name, a)
+#    define RESQLITEUN_PROBE2(name, a, b)
+#    define RESQLITEUN_PROBE3(name, a, b, c)
+#    define RESQLITEUN_PROBE4(name, a, b, c, d)
+#    define RESQLITEUN_PROBE5(name, a, b, c, d, e)
 #endif
 
-
 static inline void black_hole (...)
 {}
 
+//! Holds the mutex of a connection for as long as it lives.
+//!
+//! All the entry points of an instance take it, so an instance may be
+//! used from several threads; the mutex is recursive and sqlite holds it
+//! while it calls the sql functions and the triggers of the instance.
+class ReSqliteUnLocker {
+public:
+    explicit ReSqliteUnLocker (void * db);
+    ~ReSqliteUnLocker ();
+private:
+    void * mutex_; /**< the mutex of the connection (NULL if not serialized) */
+};
+
 #endif // GUARD_RESQLITEUN_PRIVATE_H_INCLUDE
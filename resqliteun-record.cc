@@ -0,0 +1,300 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-record.cc
+ * @brief Definitions for ReSqliteUnRecord class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <sqlite/sqlite3.h>
+
+#include "resqliteun-record.h"
+#include "resqliteun-private.h"
+
+#include <string.h>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+//! Append an unsigned integer using 7 bits per byte.
+static inline void appendVarint (QByteArray & image, quint64 value)
+{
+    char buffer[10];
+    int i = 0;
+    do {
+        char byte = static_cast<char>(value & 0x7F);
+        value >>= 7;
+        if (value != 0)
+            byte |= 0x80;
+        buffer[i++] = byte;
+    } while (value != 0);
+    image.append (buffer, i);
+}
+
+//! Read an unsigned integer written by appendVarint().
+static inline bool readVarint (
+        const char *& cursor, const char * end, quint64 & value)
+{
+    value = 0;
+    for (int shift = 0; (cursor < end) && (shift < 64); shift += 7) {
+        quint64 byte = static_cast<unsigned char>(*cursor++);
+        value |= (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+/**
+ * @class ReSqliteUnRecord
+ *
+ * A row image is a sequence of values, each one made of:
+ * - the index of the column (varint);
+ * - the type of the value (one byte, the sqlite fundamental type);
+ * - the payload: zig-zag varint for integers, 8 bytes for reals,
+ *   varint length followed by the bytes for text and blobs and
+ *   nothing for NULL.
+ *
+ * Images are built in a single pass by the capture function directly from
+ * the sqlite values, without going through an sql text representation.
+ */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param image The buffer that receives the value.
+ * @param column Index of the column in the table.
+ * @param value The `sqlite3_value *` to encode.
+ */
+void ReSqliteUnRecord::encode (QByteArray & image, int column, void * value)
+{
+    sqlite3_value * val = static_cast<sqlite3_value *>(value);
+    int type = sqlite3_value_type (val);
+
+    appendVarint (image, static_cast<quint64>(column));
+    image.append (static_cast<char>(type));
+    switch (type) {
+    case SQLITE_INTEGER: {
+        qint64 i = sqlite3_value_int64 (val);
+        appendVarint (image, (static_cast<quint64>(i) << 1) ^
+                      static_cast<quint64>(i >> 63));
+        break; }
+    case SQLITE_FLOAT: {
+        double d = sqlite3_value_double (val);
+        image.append (reinterpret_cast<const char *>(&d), sizeof(d));
+        break; }
+    case SQLITE_TEXT: {
+        const unsigned char * text = sqlite3_value_text (val);
+        int size = sqlite3_value_bytes (val);
+        appendVarint (image, static_cast<quint64>(size));
+        image.append (reinterpret_cast<const char *>(text), size);
+        break; }
+    case SQLITE_BLOB: {
+        const void * blob = sqlite3_value_blob (val);
+        int size = sqlite3_value_bytes (val);
+        appendVarint (image, static_cast<quint64>(size));
+        if (size > 0) {
+            image.append (static_cast<const char *>(blob), size);
+        }
+        break; }
+    default:
+        break;
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param cursor Current position; advanced past the value on success.
+ * @param end One past the last byte in the image.
+ * @param value Receives the value.
+ * @return false if there are no more values or the image is damaged
+ */
+bool ReSqliteUnRecord::decode (
+        const char *& cursor, const char * end, Value & value)
+{
+    quint64 u;
+    if (!readVarint (cursor, end, u))
+        return false;
+    value.column = static_cast<int>(u);
+    if (cursor >= end)
+        return false;
+    value.type = static_cast<unsigned char>(*cursor++);
+    value.data = NULL;
+    value.size = 0;
+    switch (value.type) {
+    case SQLITE_INTEGER: {
+        if (!readVarint (cursor, end, u))
+            return false;
+        value.integer = static_cast<qint64>((u >> 1) ^ (~(u & 1) + 1));
+        break; }
+    case SQLITE_FLOAT: {
+        if (end - cursor < static_cast<int>(sizeof(double)))
+            return false;
+        memcpy (&value.real, cursor, sizeof(double));
+        cursor += sizeof(double);
+        break; }
+    case SQLITE_TEXT:
+    case SQLITE_BLOB: {
+        if (!readVarint (cursor, end, u))
+            return false;
+        if (static_cast<quint64>(end - cursor) < u)
+            return false;
+        value.data = cursor;
+        value.size = static_cast<int>(u);
+        cursor += value.size;
+        break; }
+    case SQLITE_NULL: {
+        break; }
+    default:
+        return false;
+    }
+    return true;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Used when the columns of a table moved: the value of column `i` goes
+ * to column `columns[i]` and is left out if that is negative. The
+ * payloads are copied as they are. A damaged image is returned unchanged,
+ * so that the replay still reports it.
+ *
+ * @param image The image to convert.
+ * @param columns The new index of each column (-1 for dropped columns).
+ * @return the converted image
+ */
+QByteArray ReSqliteUnRecord::remap (
+        const QByteArray & image, const QList<int> & columns)
+{
+    QByteArray result;
+    const char * cursor = image.constData ();
+    const char * end = cursor + image.size ();
+    while (cursor < end) {
+        const char * payload = cursor;
+        Value value;
+        quint64 u;
+        if (!decode (cursor, end, value) ||
+                !readVarint (payload, end, u)) {
+            return image;
+        }
+        int column = (value.column < columns.count ()) ?
+                    columns.at (value.column) : -1;
+        if (column >= 0) {
+            appendVarint (result, static_cast<quint64>(column));
+            result.append (payload, static_cast<int>(cursor - payload));
+        }
+    }
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Text and blobs are bound as transient so the image does not
+ * need to outlive the statement.
+ *
+ * @param statement The `sqlite3_stmt *` that receives the value.
+ * @param index The index of the parameter (first one is 1).
+ * @param value The value to bind.
+ * @return sqlite error code
+ */
+int ReSqliteUnRecord::bind (void * statement, int index, const Value & value)
+{
+    sqlite3_stmt * stmt = static_cast<sqlite3_stmt *>(statement);
+    switch (value.type) {
+    case SQLITE_INTEGER:
+        return sqlite3_bind_int64 (stmt, index, value.integer);
+    case SQLITE_FLOAT:
+        return sqlite3_bind_double (stmt, index, value.real);
+    case SQLITE_TEXT:
+        return sqlite3_bind_text (
+                    stmt, index, value.data, value.size, SQLITE_TRANSIENT);
+    case SQLITE_BLOB:
+        return sqlite3_bind_blob (
+                    stmt, index, value.data, value.size, SQLITE_TRANSIENT);
+    default:
+        return sqlite3_bind_null (stmt, index);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Text and blobs are copied, as for bind().
+ *
+ * @param context The `sqlite3_context *` of the function or column.
+ * @param value The decoded value.
+ */
+void ReSqliteUnRecord::result (void * context, const Value & value)
+{
+    sqlite3_context * ctx = static_cast<sqlite3_context *>(context);
+    switch (value.type) {
+    case SQLITE_INTEGER:
+        sqlite3_result_int64 (ctx, value.integer);
+        break;
+    case SQLITE_FLOAT:
+        sqlite3_result_double (ctx, value.real);
+        break;
+    case SQLITE_TEXT:
+        sqlite3_result_text (ctx, value.data, value.size, SQLITE_TRANSIENT);
+        break;
+    case SQLITE_BLOB:
+        sqlite3_result_blob (ctx, value.data, value.size, SQLITE_TRANSIENT);
+        break;
+    default:
+        sqlite3_result_null (ctx);
+        break;
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+bool ReSqliteUnRecord::sameValue (const Value & first, const Value & second)
+{
+    if (first.type != second.type) {
+        return false;
+    }
+    switch (first.type) {
+    case SQLITE_INTEGER:
+        return first.integer == second.integer;
+    case SQLITE_FLOAT:
+        return memcmp (&first.real, &second.real, sizeof(double)) == 0;
+    case SQLITE_TEXT:
+    case SQLITE_BLOB:
+        return (first.size == second.size) &&
+                (memcmp (first.data, second.data, first.size) == 0);
+    default:
+        return true;
+    }
+}
+/* ========================================================================= */
+
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
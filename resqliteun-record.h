@@ -0,0 +1,164 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-record.h
+ * @brief Declarations for ReSqliteUnRecord class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_RESQLITEUN_RECORD_H_INCLUDE
+#define GUARD_RESQLITEUN_RECORD_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <resqliteun/resqliteun-config.h>
+#include <resqliteun/resqliteun-names.h>
+
+#include <QByteArray>
+#include <QString>
+#include <QList>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+//! Encodes and decodes the row images stored in the journal.
+class RESQLITEUN_EXPORT ReSqliteUnRecord {
+    //
+    //
+    //
+    //
+    /*  DEFINITIONS    ----------------------------------------------------- */
+
+public:
+
+    //! The kind of change a journal record undoes.
+    enum Kind {
+        InvalidKind = 0,
+        InsertKind = RESQUN_KIND_INSERT, /**< rows were inserted (a range of rowids) */
+        DeleteKind = RESQUN_KIND_DELETE, /**< a row was deleted (the image has all columns) */
+        UpdateKind = RESQUN_KIND_UPDATE, /**< a row was updated (the image has tracked columns) */
+        UpdateColumnKind = RESQUN_KIND_UPDATE_COLUMN, /**< a single column of a row was updated */
+        SnapshotKind = RESQUN_KIND_SNAPSHOT /**< the whole table was saved in a shadow table */
+    };
+
+    //! A decoded value; text and blobs point inside the encoded image.
+    struct Value {
+        int column; /**< index of the column in the table */
+        int type; /**< SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT, SQLITE_BLOB or SQLITE_NULL */
+        qint64 integer; /**< value for SQLITE_INTEGER */
+        double real; /**< value for SQLITE_FLOAT */
+        const char * data; /**< value for SQLITE_TEXT and SQLITE_BLOB */
+        int size; /**< number of bytes in data */
+    };
+
+    /*  DEFINITIONS    ===================================================== */
+    //
+    //
+    //
+    //
+    /*  DATA    ------------------------------------------------------------ */
+
+public:
+
+    qint64 id_; /**< the id of the record in the journal */
+    int kind_; /**< the kind of change (see Kind) */
+    QString table_; /**< the table that was changed */
+    qint64 first_rowid_; /**< first rowid affected by the change */
+    qint64 last_rowid_; /**< last rowid affected by the change */
+    QByteArray image_; /**< the values needed to undo the change */
+    QByteArray redo_image_; /**< the values needed to redo the change */
+
+    /*  DATA    ============================================================ */
+    //
+    //
+    //
+    //
+    /*  FUNCTIONS    ------------------------------------------------------- */
+
+public:
+
+    //! Default constructor.
+    ReSqliteUnRecord () :
+        id_ (-1),
+        kind_ (InvalidKind),
+        first_rowid_ (-1),
+        last_rowid_ (-1)
+    {}
+
+    //! Append a sqlite value to an image.
+    static void
+    encode (
+            QByteArray & image,
+            int column,
+            void * value);
+
+    //! Read next value from an image.
+    static bool
+    decode (
+            const char *& cursor,
+            const char * end,
+            Value & value);
+
+    //! Bind a decoded value to a statement.
+    static int
+    bind (
+            void * statement,
+            int index,
+            const Value & value);
+
+    //! Set a decoded value as the result of a function or a column.
+    static void
+    result (
+            void * context,
+            const Value & value);
+
+    //! Give the values of an image the new indices of their columns.
+    static QByteArray
+    remap (
+            const QByteArray & image,
+            const QList<int> & columns);
+
+    //! Do two decoded values hold the same thing (the column is ignored)?
+    static bool
+    sameValue (
+            const Value & first,
+            const Value & second);
+
+    /*  FUNCTIONS    ======================================================= */
+    //
+    //
+    //
+    //
+
+}; // class ReSqliteUnRecord
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+
+#endif // GUARD_RESQLITEUN_RECORD_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
@@ -0,0 +1,499 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-stats.cc
+ * @brief Definitions for ReSqliteUnStats class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <sqlite/sqlite3.h>
+
+#include "resqliteun-stats.h"
+#include "resqliteun.h"
+#include "resqliteun-private.h"
+
+#include <assert.h>
+#include <string.h>
+#include <QMutexLocker>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+//! The names of the instance counters, in the order of the enum.
+static const char * counter_names[ReSqliteUnStats::CounterMax] = {
+    "rows_inserted",
+    "rows_deleted",
+    "rows_updated",
+    "columns_updated",
+    "snapshots",
+    "journal_records",
+    "journal_bytes",
+    "entries",
+    "entry_records_max",
+    "entry_bytes_max",
+    "undos",
+    "redos",
+    "begin_count",
+    "begin_total_ns",
+    "begin_max_ns",
+    "end_count",
+    "end_total_ns",
+    "end_max_ns",
+    "replay_count",
+    "replay_total_ns",
+    "replay_max_ns"
+};
+
+//! The names of the table counters, in the order of the enum.
+static const char * table_counter_names[ReSqliteUnStats::TableCounterMax] = {
+    "rows_inserted",
+    "rows_deleted",
+    "rows_updated",
+    "journal_bytes"
+};
+
+//! The columns of the `resqun_stats` table.
+enum StatsColumns {
+    col_tbl = 0, // the table or NULL for the instance;
+    col_name, // the name of the counter;
+    col_value, // the value of the counter.
+};
+
+//! The `resqun_stats` table.
+struct StatsTable {
+    sqlite3_vtab base; /**< must come first */
+    ReSqliteUn * undoer; /**< the instance that owns the counters */
+};
+
+//! A cursor over the `resqun_stats` table.
+struct StatsCursor {
+    sqlite3_vtab_cursor base; /**< must come first */
+    int row; /**< instance counters first, then those of each table */
+};
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  SQLITE Entry Points   -------------------------------------------------- */
+
+extern "C" {
+
+/* ------------------------------------------------------------------------- */
+static int stats_connect (
+        sqlite3 *db, void *aux, int argc, const char * const *argv,
+        sqlite3_vtab **vtab, char **err_msg)
+{
+    Q_UNUSED(argc);
+    Q_UNUSED(argv);
+    Q_UNUSED(err_msg);
+    int rc = sqlite3_declare_vtab (
+                db, "CREATE TABLE x(tbl TEXT, name TEXT, value INTEGER)");
+    if (rc == SQLITE_OK) {
+        StatsTable * table = static_cast<StatsTable *>(
+                    sqlite3_malloc (sizeof(StatsTable)));
+        if (table == NULL) {
+            return SQLITE_NOMEM;
+        }
+        memset (table, 0, sizeof(StatsTable));
+        table->undoer = static_cast<ReSqliteUn *>(aux);
+        *vtab = &table->base;
+    }
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int stats_disconnect (sqlite3_vtab *vtab)
+{
+    sqlite3_free (vtab);
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int stats_best_index (sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+    Q_UNUSED(vtab);
+    info->estimatedCost = ReSqliteUnStats::CounterMax;
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int stats_open (sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
+{
+    Q_UNUSED(vtab);
+    StatsCursor * cur = static_cast<StatsCursor *>(
+                sqlite3_malloc (sizeof(StatsCursor)));
+    if (cur == NULL) {
+        return SQLITE_NOMEM;
+    }
+    memset (cur, 0, sizeof(StatsCursor));
+    *cursor = &cur->base;
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int stats_close (sqlite3_vtab_cursor *cursor)
+{
+    sqlite3_free (cursor);
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int stats_filter (
+        sqlite3_vtab_cursor *cursor, int idx_num, const char *idx_str,
+        int argc, sqlite3_value **argv)
+{
+    Q_UNUSED(idx_num);
+    Q_UNUSED(idx_str);
+    Q_UNUSED(argc);
+    Q_UNUSED(argv);
+    reinterpret_cast<StatsCursor *>(cursor)->row = 0;
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int stats_next (sqlite3_vtab_cursor *cursor)
+{
+    reinterpret_cast<StatsCursor *>(cursor)->row++;
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int stats_eof (sqlite3_vtab_cursor *cursor)
+{
+    const StatsCursor * cur = reinterpret_cast<StatsCursor *>(cursor);
+    const ReSqliteUn * undoer =
+            reinterpret_cast<StatsTable *>(cursor->pVtab)->undoer;
+    return cur->row >= ReSqliteUnStats::CounterMax +
+            undoer->tables_.count () * ReSqliteUnStats::TableCounterMax;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int stats_column (
+        sqlite3_vtab_cursor *cursor, sqlite3_context *context, int column)
+{
+    const StatsCursor * cur = reinterpret_cast<StatsCursor *>(cursor);
+    const ReSqliteUn * undoer =
+            reinterpret_cast<StatsTable *>(cursor->pVtab)->undoer;
+    const ReSqliteUnStats & stats = undoer->stats ();
+
+    if (cur->row < ReSqliteUnStats::CounterMax) {
+        ReSqliteUnStats::Counter counter =
+                static_cast<ReSqliteUnStats::Counter>(cur->row);
+        switch (column) {
+        case col_tbl:
+            sqlite3_result_null (context);
+            break;
+        case col_name:
+            sqlite3_result_text (
+                        context, ReSqliteUnStats::name (counter), -1,
+                        SQLITE_STATIC);
+            break;
+        default:
+            sqlite3_result_int64 (context, stats.value (counter));
+            break;
+        }
+    } else {
+        int index = cur->row - ReSqliteUnStats::CounterMax;
+        int table_id = index / ReSqliteUnStats::TableCounterMax;
+        ReSqliteUnStats::TableCounter counter =
+                static_cast<ReSqliteUnStats::TableCounter>(
+                    index % ReSqliteUnStats::TableCounterMax);
+        switch (column) {
+        case col_tbl:
+            ReSqliteUn::result (context, undoer->tables_.at (table_id).name);
+            break;
+        case col_name:
+            sqlite3_result_text (
+                        context, ReSqliteUnStats::name (counter), -1,
+                        SQLITE_STATIC);
+            break;
+        default:
+            sqlite3_result_int64 (context, stats.value (table_id, counter));
+            break;
+        }
+    }
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+static int stats_rowid (sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
+{
+    *rowid = reinterpret_cast<StatsCursor *>(cursor)->row;
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+} // extern "C"
+
+/* ------------------------------------------------------------------------- */
+//! The module behind the `resqun_stats` table (eponymous, read only).
+static sqlite3_module stats_module = {
+    /* iVersion */ 0,
+    /* xCreate */ NULL,
+    /* xConnect */ stats_connect,
+    /* xBestIndex */ stats_best_index,
+    /* xDisconnect */ stats_disconnect,
+    /* xDestroy */ NULL,
+    /* xOpen */ stats_open,
+    /* xClose */ stats_close,
+    /* xFilter */ stats_filter,
+    /* xNext */ stats_next,
+    /* xEof */ stats_eof,
+    /* xColumn */ stats_column,
+    /* xRowid */ stats_rowid,
+    /* xUpdate */ NULL,
+    /* xBegin */ NULL,
+    /* xSync */ NULL,
+    /* xCommit */ NULL,
+    /* xRollback */ NULL,
+    /* xFindFunction */ NULL,
+    /* xRename */ NULL,
+    /* xSavepoint */ NULL,
+    /* xRelease */ NULL,
+    /* xRollbackTo */ NULL
+};
+/* ========================================================================= */
+
+/*  SQLITE Entry Points   ================================================== */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+/**
+ * @class ReSqliteUnStats
+ *
+ * Each instance keeps a set of counters that are updated as it captures
+ * rows, closes entries and replays them, and a smaller set for each
+ * attached table. The counters are atomic and are updated with relaxed
+ * ordering, so the capture path pays for an uncontended add; they may be
+ * read from any thread, but a set of values read while the connection is
+ * in use is not guaranteed to be consistent.
+ *
+ * The counters are available through ReSqliteUn::stats() and, in sql,
+ * through the `resqun_stats` table:
+ *
+ * @code
+ * SELECT tbl, name, value FROM resqun_stats;
+ * @endcode
+ *
+ * where `tbl` is NULL for the counters of the instance.
+ */
+
+/* ------------------------------------------------------------------------- */
+ReSqliteUnStats::ReSqliteUnStats () :
+    tables_ (),
+    tables_lock_ ()
+{
+    RESQLITEUN_TRACE_ENTRY;
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+ReSqliteUnStats::~ReSqliteUnStats()
+{
+    RESQLITEUN_TRACE_ENTRY;
+    foreach(TableCounters * counters, tables_) {
+        delete counters;
+    }
+    tables_.clear ();
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+const char * ReSqliteUnStats::name (Counter counter)
+{
+    assert((counter >= 0) && (counter < CounterMax));
+    return counter_names[counter];
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+const char * ReSqliteUnStats::name (TableCounter counter)
+{
+    assert((counter >= 0) && (counter < TableCounterMax));
+    return table_counter_names[counter];
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param table_id The id of the table in the instance.
+ * @param counter The counter to read.
+ * @return the value
+ */
+qint64 ReSqliteUnStats::value (int table_id, TableCounter counter) const
+{
+    QMutexLocker locker (&tables_lock_);
+    if ((table_id < 0) || (table_id >= tables_.count ())) {
+        return 0;
+    }
+    return tables_.at (table_id)->values[counter].load ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+int ReSqliteUnStats::tableCount () const
+{
+    QMutexLocker locker (&tables_lock_);
+    return tables_.count ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The counter is left alone if it is already larger.
+ *
+ * @param counter The counter to change.
+ * @param amount The new value.
+ */
+void ReSqliteUnStats::raise (Counter counter, qint64 amount)
+{
+    qint64 current = values_[counter].load ();
+    while (current < amount) {
+        if (values_[counter].testAndSetRelaxed (current, amount, current)) {
+            break;
+        }
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The list of tables only grows in the thread that uses the connection
+ * (the one that captures rows), so that thread reads it without locking.
+ *
+ * @param table_id The id of the table in the instance.
+ * @return the counters
+ */
+ReSqliteUnStats::TableCounters * ReSqliteUnStats::table (int table_id)
+{
+    if (table_id >= tables_.count ()) {
+        QMutexLocker locker (&tables_lock_);
+        while (table_id >= tables_.count ()) {
+            tables_.append (new TableCounters ());
+        }
+    }
+    return tables_.at (table_id);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param table_id The id of the table in the instance.
+ * @param kind The kind of the record (see ReSqliteUnRecord::Kind).
+ * @param bytes The size of the images, 0 if a record was extended.
+ */
+void ReSqliteUnStats::addRow (int table_id, int kind, qint64 bytes)
+{
+    TableCounters * counters = table (table_id);
+    switch (kind) {
+    case ReSqliteUnRecord::InsertKind: {
+        add (RowsInserted);
+        counters->values[TableRowsInserted].fetchAndAddRelaxed (1);
+        break; }
+    case ReSqliteUnRecord::DeleteKind: {
+        add (RowsDeleted);
+        counters->values[TableRowsDeleted].fetchAndAddRelaxed (1);
+        break; }
+    case ReSqliteUnRecord::UpdateKind: {
+        add (RowsUpdated);
+        counters->values[TableRowsUpdated].fetchAndAddRelaxed (1);
+        break; }
+    case ReSqliteUnRecord::UpdateColumnKind: {
+        add (ColumnsUpdated);
+        counters->values[TableRowsUpdated].fetchAndAddRelaxed (1);
+        break; }
+    default:
+        break;
+    }
+    if (bytes > 0) {
+        add (JournalBytes, bytes);
+        counters->values[TableJournalBytes].fetchAndAddRelaxed (bytes);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param count The counter of calls; the total and the maximum
+ * follow it in the Counter enum.
+ * @param nanoseconds The duration of the call.
+ */
+void ReSqliteUnStats::addTiming (Counter count, qint64 nanoseconds)
+{
+    add (count);
+    add (static_cast<Counter>(count + 1), nanoseconds);
+    raise (static_cast<Counter>(count + 2), nanoseconds);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void ReSqliteUnStats::reset ()
+{
+    RESQLITEUN_TRACE_ENTRY;
+    for (int i = 0; i < CounterMax; ++i) {
+        values_[i].store (0);
+    }
+    QMutexLocker locker (&tables_lock_);
+    foreach(TableCounters * counters, tables_) {
+        for (int i = 0; i < TableCounterMax; ++i) {
+            counters->values[i].store (0);
+        }
+    }
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The table is eponymous: it exists in every connection that has an
+ * instance and needs no `CREATE VIRTUAL TABLE`.
+ *
+ * @param db The connection.
+ * @param undoer The instance associated with the connection.
+ * @return error code
+ */
+int ReSqliteUnStats::createModule (void * db, ReSqliteUn * undoer)
+{
+    return sqlite3_create_module_v2 (
+                static_cast<sqlite3 *>(db), RESQUN_VTAB_STATS,
+                &stats_module, undoer, NULL);
+}
+/* ========================================================================= */
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
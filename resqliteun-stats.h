@@ -0,0 +1,213 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-stats.h
+ * @brief Declarations for ReSqliteUnStats class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_RESQLITEUN_STATS_H_INCLUDE
+#define GUARD_RESQLITEUN_STATS_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <resqliteun/resqliteun-config.h>
+
+#include <QAtomicInteger>
+#include <QList>
+#include <QMutex>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+class ReSqliteUn;
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+//! Counters that tell what the undo-redo mechanism costs.
+class RESQLITEUN_EXPORT ReSqliteUnStats {
+    //
+    //
+    //
+    //
+    /*  DEFINITIONS    ----------------------------------------------------- */
+
+public:
+
+    //! The counters kept for the instance.
+    enum Counter {
+        RowsInserted = 0, /**< rows captured for inserts */
+        RowsDeleted, /**< rows captured for deletes */
+        RowsUpdated, /**< rows captured for updates of the whole row */
+        ColumnsUpdated, /**< columns captured for updates of a column */
+        Snapshots, /**< tables saved by suspendTable() */
+        JournalRecords, /**< records written in the journal */
+        JournalBytes, /**< bytes of images written in the journal */
+        Entries, /**< entries closed by end() */
+        EntryRecordsMax, /**< records in the largest entry */
+        EntryBytesMax, /**< bytes of images in the largest entry */
+        Undos, /**< entries that were undone */
+        Redos, /**< entries that were redone */
+        BeginCount, /**< calls to begin() */
+        BeginTotalNs, /**< time spent in begin() */
+        BeginMaxNs, /**< longest call to begin() */
+        EndCount, /**< calls to end() */
+        EndTotalNs, /**< time spent in end() */
+        EndMaxNs, /**< longest call to end() */
+        ReplayCount, /**< calls to performUndoRedo() */
+        ReplayTotalNs, /**< time spent in performUndoRedo() */
+        ReplayMaxNs, /**< longest call to performUndoRedo() */
+
+        CounterMax /**< number of counters */
+    };
+
+    //! The counters kept for each attached table.
+    enum TableCounter {
+        TableRowsInserted = 0, /**< rows captured for inserts */
+        TableRowsDeleted, /**< rows captured for deletes */
+        TableRowsUpdated, /**< rows or columns captured for updates */
+        TableJournalBytes, /**< bytes of images written in the journal */
+
+        TableCounterMax /**< number of counters */
+    };
+
+    //! The counters of a table.
+    struct TableCounters {
+        QAtomicInteger<qint64> values[TableCounterMax];
+    };
+
+    /*  DEFINITIONS    ===================================================== */
+    //
+    //
+    //
+    //
+    /*  DATA    ------------------------------------------------------------ */
+
+private:
+
+    QAtomicInteger<qint64> values_[CounterMax]; /**< instance counters */
+    QList<TableCounters *> tables_; /**< counters for each table id */
+    mutable QMutex tables_lock_; /**< guards growing tables_ */
+
+    /*  DATA    ============================================================ */
+    //
+    //
+    //
+    //
+    /*  FUNCTIONS    ------------------------------------------------------- */
+
+public:
+
+    //! Default constructor.
+    ReSqliteUnStats ();
+
+    //! Destructor.
+    virtual ~ReSqliteUnStats ();
+
+    //! The name of a counter.
+    static const char *
+    name (
+            Counter counter);
+
+    //! The name of a table counter.
+    static const char *
+    name (
+            TableCounter counter);
+
+    //! The value of a counter.
+    qint64
+    value (
+            Counter counter) const {
+        return values_[counter].load ();
+    }
+
+    //! The value of a counter for a table (0 if there is none).
+    qint64
+    value (
+            int table_id,
+            TableCounter counter) const;
+
+    //! Number of tables that have counters.
+    int
+    tableCount () const;
+
+    //! Add to a counter.
+    void
+    add (
+            Counter counter,
+            qint64 amount = 1) {
+        values_[counter].fetchAndAddRelaxed (amount);
+    }
+
+    //! Raise a counter to a value.
+    void
+    raise (
+            Counter counter,
+            qint64 amount);
+
+    //! Account for a row captured by the triggers.
+    void
+    addRow (
+            int table_id,
+            int kind,
+            qint64 bytes);
+
+    //! Account for a call that took some time.
+    void
+    addTiming (
+            Counter count,
+            qint64 nanoseconds);
+
+    //! Set all counters to 0.
+    void
+    reset ();
+
+    //! Register the `resqun_stats` table for a connection.
+    static int
+    createModule (
+            void * db,
+            ReSqliteUn * undoer);
+
+private:
+
+    //! The counters of a table, created if needed.
+    TableCounters *
+    table (
+            int table_id);
+
+    /*  FUNCTIONS    ======================================================= */
+    //
+    //
+    //
+    //
+
+}; // class ReSqliteUnStats
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+
+#endif // GUARD_RESQLITEUN_STATS_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
@@ -0,0 +1,301 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-trace.cc
+ * @brief Definitions for ReSqliteUnTrace class.
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include "resqliteun-trace.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+//! Number of events kept for each thread (a power of two).
+#define TRACE_CAPACITY 4096
+
+//! The write counter restarts (at TRACE_CAPACITY) before it gets here.
+#define TRACE_WRAP 0x40000000
+
+//! An event in the buffer.
+struct TraceEvent {
+    const char * name; /**< static string that names the event */
+    qint64 timestamp; /**< nanoseconds since the first event */
+    char phase; /**< 'B' begin, 'E' end, 'i' instant */
+};
+
+//! The events recorded by a thread.
+struct TraceBuffer {
+    QAtomicInt head; /**< number of events written so far */
+    QAtomicInt in_use; /**< is the buffer owned by a running thread? */
+    int thread_id; /**< the id shown in the trace */
+    TraceEvent events[TRACE_CAPACITY]; /**< the ring */
+};
+
+//! Gives the buffer back when the thread ends.
+struct TraceOwner {
+    TraceBuffer * buffer;
+    ~TraceOwner () {
+        if (buffer != NULL) {
+            buffer->in_use.storeRelease (0);
+        }
+    }
+};
+
+// tracing is off until turned on
+QAtomicInt ReSqliteUnTrace::enabled_ (0);
+
+//! Guards the list of buffers.
+static QMutex trace_lock;
+
+//! All buffers ever created; they are reused, never freed.
+static QList<TraceBuffer *> trace_buffers;
+
+//! The buffer of each thread.
+static thread_local TraceOwner trace_owner = { NULL };
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  FUNCTIONS    ----------------------------------------------------------- */
+
+/* ------------------------------------------------------------------------- */
+//! A timer that was started.
+static QElapsedTimer startedTimer ()
+{
+    QElapsedTimer timer;
+    timer.start ();
+    return timer;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Nanoseconds since the first call.
+static qint64 traceTime ()
+{
+    static const QElapsedTimer timer = startedTimer ();
+    return timer.nsecsElapsed ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Append a name as a json string (without the quotes).
+static void appendEscaped (QByteArray & result, const char * name)
+{
+    for (const char * p = name; *p != 0; ++p) {
+        if ((*p == '"') || (*p == '\\')) {
+            result.append ('\\');
+            result.append (*p);
+        } else if (static_cast<unsigned char>(*p) < 0x20) {
+            result.append (' ');
+        } else {
+            result.append (*p);
+        }
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The buffer of a thread that ended is reused; its old events are lost.
+ *
+ * @return the buffer of the calling thread
+ */
+static TraceBuffer * claimBuffer ()
+{
+    QMutexLocker locker (&trace_lock);
+    TraceBuffer * buffer = NULL;
+    foreach(TraceBuffer * iter, trace_buffers) {
+        if (iter->in_use.loadAcquire () == 0) {
+            buffer = iter;
+            break;
+        }
+    }
+    if (buffer == NULL) {
+        buffer = new TraceBuffer ();
+        buffer->thread_id = trace_buffers.count () + 1;
+        trace_buffers.append (buffer);
+    }
+    buffer->head.storeRelease (0);
+    buffer->in_use.storeRelease (1);
+    trace_owner.buffer = buffer;
+    return buffer;
+}
+/* ========================================================================= */
+
+/*  FUNCTIONS    =========================================================== */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+/**
+ * @class ReSqliteUnTrace
+ *
+ * The library is built with tracing when `RESQLITEUN_TRACE` is defined
+ * (the CMake option of the same name); otherwise the macros in
+ * resqliteun-private.h compile to nothing. Even when built in, tracing
+ * costs a relaxed load per span until it is turned on with
+ * setEnabled().
+ *
+ * Each thread writes its events in its own ring buffer, so recording
+ * takes no lock; once the ring is full the oldest events are overwritten.
+ * The names of the events are static strings (function names and the
+ * labels of the internal queries), so nothing is formatted while tracing.
+ *
+ * dump() produces the events of all threads in Chrome trace-event format,
+ * which can be opened in Perfetto or `chrome://tracing`. Buffers are read
+ * while other threads may be writing; turn tracing off before dumping to
+ * get a consistent trace.
+ */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Has no effect on the macros if the library was built without tracing.
+ *
+ * @param value true to record events
+ */
+void ReSqliteUnTrace::setEnabled (bool value)
+{
+    traceTime ();
+    enabled_.store (value ? 1 : 0);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param name A string that lives as long as the program.
+ * @param phase 'B' for begin, 'E' for end or 'i' for instant events.
+ */
+void ReSqliteUnTrace::record (const char * name, char phase)
+{
+    TraceBuffer * buffer = trace_owner.buffer;
+    if (buffer == NULL) {
+        buffer = claimBuffer ();
+    }
+    int head = buffer->head.load ();
+    TraceEvent & event = buffer->events[head & (TRACE_CAPACITY - 1)];
+    event.name = name;
+    event.timestamp = traceTime ();
+    event.phase = phase;
+
+    // Keep the position in the ring when the counter would overflow.
+    int next = head + 1;
+    if (next >= TRACE_WRAP) {
+        next = TRACE_CAPACITY + (next & (TRACE_CAPACITY - 1));
+    }
+    buffer->head.storeRelease (next);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The arguments are not formatted; the format string names the event.
+ *
+ * @param format A string that lives as long as the program.
+ */
+void ReSqliteUnTrace::message (const char * format, ...)
+{
+    if (isEnabled ()) {
+        record (format, 'i');
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void ReSqliteUnTrace::clear ()
+{
+    QMutexLocker locker (&trace_lock);
+    foreach(TraceBuffer * buffer, trace_buffers) {
+        buffer->head.storeRelease (0);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Timestamps are in microseconds since the first event, as the format
+ * requires; `pid` is always 1 and `tid` identifies the buffer.
+ *
+ * @return the json document
+ */
+QByteArray ReSqliteUnTrace::dump ()
+{
+    QByteArray result ("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    bool first = true;
+    QMutexLocker locker (&trace_lock);
+    foreach(const TraceBuffer * buffer, trace_buffers) {
+        int head = buffer->head.loadAcquire ();
+        int i = head > TRACE_CAPACITY ? head - TRACE_CAPACITY : 0;
+        for (; i < head; ++i) {
+            const TraceEvent & event =
+                    buffer->events[i & (TRACE_CAPACITY - 1)];
+            if (!first) {
+                result.append (',');
+            }
+            first = false;
+            result.append ("\n{\"name\":\"");
+            appendEscaped (result, event.name);
+            result.append ("\",\"ph\":\"");
+            result.append (event.phase);
+            result.append ("\",\"ts\":");
+            result.append (QByteArray::number (event.timestamp / 1000.0, 'f', 3));
+            result.append (",\"pid\":1,\"tid\":");
+            result.append (QByteArray::number (buffer->thread_id));
+            if (event.phase == 'i') {
+                result.append (",\"s\":\"t\"");
+            }
+            result.append ('}');
+        }
+    }
+    result.append ("\n]}\n");
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param file The path of the file; it is replaced if it exists.
+ * @return false if the file could not be written
+ */
+bool ReSqliteUnTrace::dumpToFile (const QString & file)
+{
+    QFile f (file);
+    if (!f.open (QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    QByteArray content = dump ();
+    return f.write (content) == content.size ();
+}
+/* ========================================================================= */
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
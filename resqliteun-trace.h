@@ -0,0 +1,149 @@
+/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
+/**
+ * @file resqliteun-trace.h
+ * @brief Declarations for ReSqliteUnTrace class
+ * @author Nicu Tofan <nicu.tofan@gmail.com>
+ * @copyright Copyright 2014 piles contributors. All rights reserved.
+ * This file is released under the
+ * [MIT License](http://opensource.org/licenses/mit-license.html)
+ */
+
+#ifndef GUARD_RESQLITEUN_TRACE_H_INCLUDE
+#define GUARD_RESQLITEUN_TRACE_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
+//
+//
+//
+//
+/*  INCLUDES    ------------------------------------------------------------ */
+
+#include <resqliteun/resqliteun-config.h>
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QString>
+
+/*  INCLUDES    ============================================================ */
+//
+//
+//
+//
+/*  DEFINITIONS    --------------------------------------------------------- */
+
+/*  DEFINITIONS    ========================================================= */
+//
+//
+//
+//
+/*  CLASS    --------------------------------------------------------------- */
+
+//! Records timestamped events in per-thread buffers.
+class RESQLITEUN_EXPORT ReSqliteUnTrace {
+    //
+    //
+    //
+    //
+    /*  DEFINITIONS    ----------------------------------------------------- */
+
+public:
+
+    //! Records the begin and the end of a scope.
+    class Span {
+    public:
+        //! Constructor; records the begin of the span.
+        Span (const char * name) :
+            name_ (ReSqliteUnTrace::isEnabled () ? name : NULL)
+        {
+            if (name_ != NULL) {
+                ReSqliteUnTrace::record (name_, 'B');
+            }
+        }
+
+        //! Destructor; records the end of the span.
+        ~Span () {
+            if (name_ != NULL) {
+                ReSqliteUnTrace::record (name_, 'E');
+            }
+        }
+
+    private:
+        const char * name_; /**< NULL if the begin was not recorded */
+    };
+
+    /*  DEFINITIONS    ===================================================== */
+    //
+    //
+    //
+    //
+    /*  DATA    ------------------------------------------------------------ */
+
+private:
+
+    static QAtomicInt enabled_; /**< is tracing turned on? */
+
+    /*  DATA    ============================================================ */
+    //
+    //
+    //
+    //
+    /*  FUNCTIONS    ------------------------------------------------------- */
+
+public:
+
+    //! Is the compiled-in tracing turned on?
+    static bool
+    isEnabled () {
+        return enabled_.load () != 0;
+    }
+
+    //! Turn the compiled-in tracing on or off.
+    static void
+    setEnabled (
+            bool value);
+
+    //! Record an event in the buffer of the calling thread.
+    static void
+    record (
+            const char * name,
+            char phase);
+
+    //! Record an instant event named by a format string.
+    static void
+    message (
+            const char * format,
+            ...);
+
+    //! Forget all recorded events.
+    static void
+    clear ();
+
+    //! The recorded events in Chrome trace-event format.
+    static QByteArray
+    dump ();
+
+    //! Save the recorded events in Chrome trace-event format.
+    static bool
+    dumpToFile (
+            const QString & file);
+
+    /*  FUNCTIONS    ======================================================= */
+    //
+    //
+    //
+    //
+
+}; // class ReSqliteUnTrace
+
+/*  CLASS    =============================================================== */
+//
+//
+//
+//
+
+#endif // GUARD_RESQLITEUN_TRACE_H_INCLUDE
+
+/* ------------------------------------------------------------------------- */
+/* ========================================================================= */
@@ -23,6 +23,9 @@
 
 #include <assert.h>
 #include <QStringBuilder>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QHash>
 
 /*  INCLUDES    ============================================================ */
 //
@@ -31,11 +34,29 @@
 //
 /*  DEFINITIONS    --------------------------------------------------------- */
 
+#define STR_HELPER(x) #x
+#define STR(x) STR_HELPER(x)
+
 #define dtb_ static_cast<sqlite3 *>(db)
 
 static QLatin1String comma (",");
 static QString empty;
 
+//! Most values passed to one call of `resqun_row` or `resqun_part`.
+#define ROW_CALL_VALUES 100
+
+//! A table as seen by some connection at some version of the schema.
+struct CachedTableInfo {
+    int schema_version; /**< `PRAGMA schema_version` when it was read */
+    ReSqliteUnUtil::TableInfo info; /**< structure and triggers */
+};
+
+//! Guards table_cache.
+static QMutex table_cache_lock;
+
+//! Tables read by all connections, by file, table and arguments.
+static QHash<QString, CachedTableInfo> table_cache;
+
 
 /*  DEFINITIONS    ========================================================= */
 //
@@ -66,6 +87,16 @@ int ReSqliteUnUtil::bind (
 }
 /* ========================================================================= */
 
+/* ------------------------------------------------------------------------- */
+void ReSqliteUnUtil::result (void * context, const QString & s_value)
+{
+    sqlite3_result_text16 (
+                static_cast<sqlite3_context *>(context),
+                s_value.utf16 (), s_value.size () * sizeof(QChar),
+                SQLITE_TRANSIENT);
+}
+/* ========================================================================= */
+
 /* ------------------------------------------------------------------------- */
 //! Helper for retrieving strings from values.
 QString ReSqliteUnUtil::value2string (void * val)
@@ -78,6 +109,29 @@ QString ReSqliteUnUtil::value2string (void * val)
 }
 /* ========================================================================= */
 
+/* ------------------------------------------------------------------------- */
+/**
+ * Names of tables are given by the application, so they may contain
+ * anything; the name is enclosed in double quotes, which are doubled.
+ */
+QString ReSqliteUnUtil::quotedName (const QString & s_name)
+{
+    QString result (s_name);
+    result.replace (QLatin1String ("\""), QLatin1String ("\"\""));
+    return QLatin1String ("\"") % result % QLatin1String ("\"");
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Same as quotedName() but with single quotes, like `%Q` in sqlite3_mprintf().
+QString ReSqliteUnUtil::quotedText (const QString & s_value)
+{
+    QString result (s_value);
+    result.replace (QLatin1String ("'"), QLatin1String ("''"));
+    return QLatin1String ("'") % result % QLatin1String ("'");
+}
+/* ========================================================================= */
+
 /* ------------------------------------------------------------------------- */
 /**
  * We discover the structure of the table by using PRAGMA table_info(Table);
@@ -90,10 +144,23 @@ QString ReSqliteUnUtil::value2string (void * val)
  *   4. dflt_value - default value for the column;
  *   5. pk - flag that tells us if this is a primary key or not.
  *
+ * The @a columns list restricts the set of columns that are tracked by
+ * update triggers (see isColumnTracked()). Columns that are not tracked
+ * are left out of the update images and an update that only touches such
+ * columns does not create an undo record at all. Deletions always store
+ * the whole row so that the row can be restored as it was.
  *
+ * @param db The database where the table lives.
+ * @param table The name of the table.
+ * @param update_kind How to track updates.
+ * @param columns List of columns to include or exclude (may be empty).
+ * @param filter How to interpret the @a columns list.
+ * @param info Receives the structure of the table.
+ * @return error code
  */
-QString ReSqliteUnUtil::sqlTriggers (
-        void * db, const QString & table, UpdateBehaviour update_kind)
+ReSqliteUnUtil::SqLiteResult ReSqliteUnUtil::readTableInfo (
+        void * db, const QString & table, UpdateBehaviour update_kind,
+        const QStringList & columns, ColumnFilter filter, TableInfo & info)
 {
     RESQLITEUN_TRACE_ENTRY;
     sqlite3_stmt *stmt;
@@ -105,15 +172,10 @@ QString ReSqliteUnUtil::sqlTriggers (
                 dtb_, statement.utf16 (),
                 statement.size () * sizeof(QChar), &stmt, NULL);
     if (rc != SQLITE_OK) {
-
-        return false;
+        RESQLITEUN_TRACE_EXIT;
+        return rc;
     }
 
-    QString del_col_name;
-    QString del_col_value;
-    QString upd_col_value;
-    QString upd_tbl_value;
-
     enum TableInfoColumns {
         col_cid = 0, // the id of the record;
         col_name, // the name of the column;
@@ -123,101 +185,798 @@ QString ReSqliteUnUtil::sqlTriggers (
         col_pk, // flag that tells us if this is a primary key or not.
     };
 
-    bool b_ret = true;
+    info.name = table;
+    info.update_kind = update_kind;
+    info.watch_all = columns.isEmpty ();
+    info.scope = CaptureAllChanges;
+    info.filter_columns = columns;
+    info.filter = filter;
+    info.columns.clear ();
+    info.tracked.clear ();
     for (;;) {
         // Get next record.
         rc = sqlite3_step (stmt);
-        if (rc == SQLITE_DONE) {
+        if (rc != SQLITE_ROW) {
             break;
-        } else if (rc != SQLITE_ROW) {
-            b_ret = false;
+        }
+
+        bool is_primary = (sqlite3_column_int (stmt, col_pk) == 1);
+        QString name = columnText (stmt, col_name);
+        info.columns.append (name);
+
+        // Primary keys excluded from those that trigger an undo step,
+        // and so are the columns that the user asked us to ignore.
+        if (!is_primary && isColumnTracked (name, columns, filter)) {
+            info.tracked.append (info.columns.count () - 1);
+        }
+    }
+    sqlite3_finalize (stmt);
+
+    if (rc == SQLITE_DONE) {
+        // A table that does not exist has no columns.
+        rc = info.columns.isEmpty () ? SQLITE_ERROR : SQLITE_OK;
+    }
+    if (rc == SQLITE_OK) {
+        rc = readDefinition (db, table, info.definition);
+    }
+
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The text is the one stored in `sqlite_master`, so any change to the
+ * structure of the table (`ALTER TABLE` included) changes it. Names with
+ * no schema are searched in the temporary schema first and then in the
+ * main one, as sqlite does. A table that is not found (one in an attached
+ * database, for example) has an empty definition.
+ *
+ * @param db The database where the table lives.
+ * @param table The name of the table, optionally prefixed by the schema.
+ * @param definition Receives the sql that created the table.
+ * @return error code
+ */
+ReSqliteUnUtil::SqLiteResult ReSqliteUnUtil::readDefinition (
+        void * db, const QString & table, QString & definition)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    sqlite3_stmt *stmt;
+
+    QString statement;
+    QString name = table;
+    int dot = table.indexOf ('.');
+    if (dot != -1) {
+        name = table.mid (dot + 1);
+        statement = QString("SELECT sql FROM ") %
+                quotedName (table.left (dot)) %
+                QString(".sqlite_master WHERE type='table' AND name=?1 "
+                        "COLLATE NOCASE;");
+    } else {
+        statement = QLatin1String (
+                "SELECT sql FROM sqlite_temp_master "
+                "WHERE type='table' AND name=?1 COLLATE NOCASE "
+                "UNION ALL SELECT sql FROM main.sqlite_master "
+                "WHERE type='table' AND name=?1 COLLATE NOCASE;");
+    }
+
+    int rc = sqlite3_prepare16_v2 (
+                dtb_, statement.utf16 (),
+                statement.size () * sizeof(QChar), &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        RESQLITEUN_TRACE_EXIT;
+        return rc;
+    }
+    sqlite3_bind_text16 (
+                stmt, 1, name.utf16 (),
+                name.size () * sizeof(QChar), SQLITE_TRANSIENT);
+    definition.clear ();
+    rc = sqlite3_step (stmt);
+    if (rc == SQLITE_ROW) {
+        definition = columnText (stmt, 0);
+        rc = SQLITE_OK;
+    } else if (rc == SQLITE_DONE) {
+        rc = SQLITE_OK;
+    }
+    sqlite3_finalize (stmt);
+
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The columns of all tables are read with a single statement that joins
+ * `sqlite_master` with `pragma_table_info`, so attaching many tables
+ * does not pay for a `PRAGMA table_info` per table.
+ *
+ * If @a tables is not empty the tables with those names are read
+ * (case is not important, a name given twice is read once) and all of
+ * them must exist; otherwise the tables whose names match the `LIKE`
+ * @a pattern are read. Only ordinary rowid tables of the main database
+ * are included: `pragma_table_list` tells apart the internal tables of
+ * sqlite, virtual tables, the shadow tables of FTS and R-tree and
+ * `WITHOUT ROWID` tables, which have no rowid for the triggers to
+ * record. All columns are tracked.
+ *
+ * @param db The database where the tables live.
+ * @param tables The names of the tables.
+ * @param pattern The pattern used when @a tables is empty.
+ * @param update_kind How to track updates.
+ * @param infos Receives the structure of the tables, in creation order.
+ * @return error code
+ */
+ReSqliteUnUtil::SqLiteResult ReSqliteUnUtil::readTablesInfo (
+        void * db, const QStringList & tables, const QString & pattern,
+        UpdateBehaviour update_kind, QList<TableInfo> & infos)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    sqlite3_stmt *stmt = NULL;
+    infos.clear ();
+
+    QStringList names;
+    foreach(const QString & table, tables) {
+        QString name = table.toLower ();
+        if (!names.contains (name)) {
+            names.append (name);
+        }
+    }
+
+    QString filter;
+    if (names.isEmpty ()) {
+        filter = QLatin1String ("m.name LIKE ?1");
+    } else {
+        filter = QLatin1String ("lower(m.name) IN (?1");
+        for (int i = 2; i <= names.count (); ++i) {
+            filter.append (QLatin1String (",?") % QString::number (i));
+        }
+        filter.append (')');
+    }
+    QString statement = QLatin1String (
+            "SELECT m.name, p.name, p.pk, m.sql "
+            "FROM sqlite_master AS m "
+            "JOIN pragma_table_list AS l "
+                "ON l.schema = 'main' AND l.name = m.name, "
+            "pragma_table_info(m.name) AS p "
+            "WHERE m.type = 'table' AND l.type = 'table' AND l.wr = 0 "
+            "AND m.name NOT LIKE 'sqlite\\_%' ESCAPE '\\' AND ") % filter %
+            QLatin1String (" ORDER BY m.rowid, p.cid;");
+
+    int rc = sqlite3_prepare16_v2 (
+                dtb_, statement.utf16 (),
+                statement.size () * sizeof(QChar), &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        RESQLITEUN_TRACE_EXIT;
+        return rc;
+    }
+    if (names.isEmpty ()) {
+        sqlite3_bind_text16 (
+                    stmt, 1, pattern.utf16 (),
+                    pattern.size () * sizeof(QChar), SQLITE_TRANSIENT);
+    } else {
+        for (int i = 0; i < names.count (); ++i) {
+            const QString & name = names.at (i);
+            sqlite3_bind_text16 (
+                        stmt, i + 1, name.utf16 (),
+                        name.size () * sizeof(QChar), SQLITE_TRANSIENT);
+        }
+    }
+
+    enum Columns {
+        col_table = 0, // the name of the table;
+        col_name, // the name of the column;
+        col_pk, // flag that tells us if this is a primary key or not;
+        col_sql, // the sql that created the table.
+    };
+
+    for (;;) {
+        // Get next record.
+        rc = sqlite3_step (stmt);
+        if (rc != SQLITE_ROW) {
             break;
         }
 
+        QString table = columnText (stmt, col_table);
+        if (infos.isEmpty () || (infos.last ().name != table)) {
+            TableInfo info;
+            info.name = table;
+            info.update_kind = update_kind;
+            info.watch_all = true;
+            info.filter = ExcludeColumns;
+            info.definition = columnText (stmt, col_sql);
+            info.scope = CaptureAllChanges;
+            infos.append (info);
+        }
+        TableInfo & info = infos.last ();
+
         bool is_primary = (sqlite3_column_int (stmt, col_pk) == 1);
         QString name = columnText (stmt, col_name);
+        info.columns.append (name);
+        if (!is_primary) {
+            info.tracked.append (info.columns.count () - 1);
+        }
+    }
+    sqlite3_finalize (stmt);
 
-        // This results in column1,column2,column3
-        if (!del_col_name.isEmpty ()) {
-            del_col_name.append (comma);
+    if (rc == SQLITE_DONE) {
+        // Each named table must exist and be one we can track.
+        rc = (!names.isEmpty () && (infos.count () != names.count ())) ?
+                    SQLITE_ERROR : SQLITE_OK;
+    }
+
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! The key of a table in the cache and current version of the schema.
+static bool tableCacheKey (
+        sqlite3 * db, const QString & table,
+        ReSqliteUnUtil::UpdateBehaviour update_kind,
+        const QStringList & columns, ReSqliteUnUtil::ColumnFilter filter,
+        int table_id, ReSqliteUnUtil::CaptureScope scope,
+        QString & key, int & schema_version)
+{
+    const char * file = sqlite3_db_filename (db, "main");
+    if ((file == NULL) || (file[0] == 0) || table.contains ('.')) {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = NULL;
+    bool b_ret = false;
+    if ((sqlite3_prepare_v2 (
+             db, "PRAGMA schema_version", -1, &stmt, NULL) == SQLITE_OK) &&
+            (sqlite3_step (stmt) == SQLITE_ROW)) {
+        schema_version = sqlite3_column_int (stmt, 0);
+        key = QString::fromUtf8 (file) % QChar('\n') %
+                table.toLower () % QChar('\n') %
+                QString::number (update_kind) % comma %
+                QString::number (filter) % comma %
+                QString::number (table_id) % comma %
+                QString::number (scope) % QChar('\n') %
+                columns.join (comma);
+        b_ret = true;
+    }
+    sqlite3_finalize (stmt);
+    return b_ret;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Pooled connections tend to attach the same tables with the same
+ * arguments, so the result of readTableInfo(), sqlTriggers() and
+ * sqlDropTriggers() is kept in a process-wide cache. The key is made of
+ * the file of the database, the name of the table and the arguments;
+ * the entry is only used if `PRAGMA schema_version` did not change since
+ * it was stored. Databases that live in memory have no file name
+ * and are not cached, and neither are tables in other schemas.
+ *
+ * An entry is only stored by cacheTableInfo(), once the caller checked
+ * that the triggers can be created.
+ *
+ * @param db The database where the table lives.
+ * @param table The name of the table.
+ * @param update_kind How to track updates.
+ * @param columns List of columns to include or exclude (may be empty).
+ * @param filter How to interpret the @a columns list.
+ * @param table_id The identifier of the table inside the instance.
+ * @param scope Which changes are recorded by the triggers.
+ * @param info Receives the structure of the table and the triggers.
+ * @param from_cache Set to true if the triggers were checked before.
+ * @return error code
+ */
+ReSqliteUnUtil::SqLiteResult ReSqliteUnUtil::cachedTableInfo (
+        void * db, const QString & table, UpdateBehaviour update_kind,
+        const QStringList & columns, ColumnFilter filter,
+        int table_id, CaptureScope scope, TableInfo & info,
+        bool & from_cache)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnUtil::SqLiteResult rc = SQLITE_OK;
+    from_cache = false;
+    for (;;) {
+        QString key;
+        int schema_version;
+        if (tableCacheKey (
+                    dtb_, table, update_kind, columns, filter,
+                    table_id, scope, key, schema_version)) {
+            QMutexLocker locker (&table_cache_lock);
+            QHash<QString, CachedTableInfo>::const_iterator iter =
+                    table_cache.constFind (key);
+            if ((iter != table_cache.constEnd ()) &&
+                    (iter.value ().schema_version == schema_version)) {
+                info = iter.value ().info;
+                from_cache = true;
+                break;
+            }
         }
-        del_col_name.append (name);
 
-        del_col_value.append (
-                    comma % QString("'||quote(OLD.") % name %
-                    QString(")||'"));
+        // Do it the hard way.
+        rc = readTableInfo (db, table, update_kind, columns, filter, info);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+        info.scope = scope;
+        info.arm_sql = sqlTriggers (info, table_id, scope).toUtf8 ();
+        info.disarm_sql = sqlDropTriggers (info).toUtf8 ();
+        break;
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * An older entry for the same table and arguments is replaced.
+ *
+ * @param db The database where the table lives.
+ * @param table The name of the table.
+ * @param columns List of columns to include or exclude (may be empty).
+ * @param filter How to interpret the @a columns list.
+ * @param table_id The identifier of the table inside the instance.
+ * @param info The structure of the table and the checked triggers.
+ */
+void ReSqliteUnUtil::cacheTableInfo (
+        void * db, const QString & table, const QStringList & columns,
+        ColumnFilter filter, int table_id, const TableInfo & info)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    QString key;
+    CachedTableInfo entry;
+    if (tableCacheKey (
+                dtb_, table, info.update_kind, columns, filter,
+                table_id, info.scope, key, entry.schema_version)) {
+        entry.info = info;
+        QMutexLocker locker (&table_cache_lock);
+        table_cache.insert (key, entry);
+    }
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The tables are found without changing anything: an insert, an update of
+ * all columns and a delete of a single row are prepared with `EXPLAIN`,
+ * which also lists the programs of the triggers and of the foreign key
+ * actions that the statement would run, and the root pages opened for
+ * writing are looked up in the schema of their database. The table itself,
+ * the internal tables of sqlite and our own tables are not reported;
+ * the names are in lower case.
+ *
+ * A write to a virtual table can not be traced to its table, so it is
+ * reported as an empty name.
+ *
+ * @param db The database where the table lives.
+ * @param info The structure of the table.
+ * @param tables Receives the names of the tables.
+ * @return error code
+ */
+ReSqliteUnUtil::SqLiteResult ReSqliteUnUtil::readWrittenTables (
+        void * db, const TableInfo & info, QStringList & tables)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    tables.clear ();
+
+    QStringList assignments;
+    foreach(const QString & column, info.columns) {
+        assignments.append (column % QLatin1String ("=") % column);
+    }
+    QStringList statements;
+    statements.append (QLatin1String ("EXPLAIN INSERT INTO ") % info.name %
+                       QLatin1String ("(rowid) VALUES(?1)"));
+    statements.append (QLatin1String ("EXPLAIN UPDATE ") % info.name %
+                       QLatin1String (" SET ") % assignments.join (comma) %
+                       QLatin1String (" WHERE rowid=?1"));
+    statements.append (QLatin1String ("EXPLAIN DELETE FROM ") % info.name %
+                       QLatin1String (" WHERE rowid=?1"));
+
+    // The pages opened for writing (the index of the database in the
+    // high half, the root page in the low one).
+    QList<qint64> pages;
+    int rc = SQLITE_OK;
+    foreach(const QString & statement, statements) {
+        sqlite3_stmt *stmt = NULL;
+        rc = sqlite3_prepare16_v2 (
+                    dtb_, statement.utf16 (),
+                    statement.size () * sizeof(QChar), &stmt, NULL);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+        // addr, opcode, p1, p2, p3, p4, p5, comment
+        while ((rc = sqlite3_step (stmt)) == SQLITE_ROW) {
+            const char * opcode = reinterpret_cast<const char *>(
+                        sqlite3_column_text (stmt, 1));
+            if (qstrcmp (opcode, "OpenWrite") == 0) {
+                qint64 page =
+                        (sqlite3_column_int64 (stmt, 4) << 32) |
+                        sqlite3_column_int64 (stmt, 3);
+                if (!pages.contains (page)) {
+                    pages.append (page);
+                }
+            } else if ((qstrcmp (opcode, "VUpdate") == 0) &&
+                       !tables.contains (empty)) {
+                tables.append (empty);
+            }
+        }
+        sqlite3_finalize (stmt);
+        if (rc != SQLITE_DONE) {
+            break;
+        }
+        rc = SQLITE_OK;
+    }
+
+    // The names of the databases by index.
+    QStringList schemas;
+    sqlite3_stmt *stmt = NULL;
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2 (
+                    dtb_, "SELECT seq, name FROM pragma_database_list",
+                    -1, &stmt, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        while ((rc = sqlite3_step (stmt)) == SQLITE_ROW) {
+            int seq = sqlite3_column_int (stmt, 0);
+            while (schemas.count () <= seq) {
+                schemas.append (empty);
+            }
+            schemas[seq] = columnText (stmt, 1);
+        }
+        rc = (rc == SQLITE_DONE ? SQLITE_OK : rc);
+    }
+    if (stmt != NULL) {
+        sqlite3_finalize (stmt);
+        stmt = NULL;
+    }
 
-        // Primary keys excluded from those that trigger an undo step.
-        if (is_primary)
+    QString own_name = info.name.toLower ();
+    for (int i = 0; (rc == SQLITE_OK) && (i < pages.count ()); ++i) {
+        QString schema = schemas.value (static_cast<int>(pages.at (i) >> 32));
+        if (schema.isEmpty ()) {
             continue;
+        }
+        QString statement = QLatin1String ("SELECT lower(tbl_name) FROM \"") %
+                schema % QLatin1String ("\".sqlite_master WHERE rootpage=?1");
+        rc = sqlite3_prepare16_v2 (
+                    dtb_, statement.utf16 (),
+                    statement.size () * sizeof(QChar), &stmt, NULL);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+        sqlite3_bind_int64 (stmt, 1, pages.at (i) & Q_INT64_C(0xffffffff));
+        rc = sqlite3_step (stmt);
+        if (rc == SQLITE_ROW) {
+            QString table = columnText (stmt, 0);
+            if ((table != own_name) &&
+                    !table.startsWith (QLatin1String ("sqlite_")) &&
+                    !table.startsWith (QLatin1String (RESQUN_PREFIX)) &&
+                    !tables.contains (table)) {
+                tables.append (table);
+            }
+            rc = SQLITE_OK;
+        } else if (rc == SQLITE_DONE) {
+            rc = SQLITE_OK;
+        }
+        sqlite3_finalize (stmt);
+    }
 
-        switch (update_kind) {
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param info The structure of the table (see readTableInfo()).
+ * @param table_id The identifier of the table inside the instance;
+ * the triggers pass it to the capture function.
+ * @param scope Which changes are recorded by the triggers.
+ * @return the statements
+ */
+QString ReSqliteUnUtil::sqlTriggers (
+        const TableInfo & info, int table_id, CaptureScope scope)
+{
+    RESQLITEUN_TRACE_ENTRY;
+
+    // This results in OLD.column1, OLD.column2, OLD.column3
+    QStringList del_col_value;
+    foreach(const QString & name, info.columns) {
+        del_col_value.append (QString("OLD.") % name);
+    }
+
+    QString upd_col_value;
+    QStringList upd_tbl_value;
+    QStringList upd_tbl_new_value;
+    QString upd_tbl_watched;
+    foreach(int column, info.tracked) {
+        const QString & name = info.columns.at (column);
+        switch (info.update_kind) {
         case OneTriggerPerUpdatedColumn: {
-            upd_col_value.append (sqlUpdateTriggerPerColumn (table, name));
+            upd_col_value.append (
+                        sqlUpdateTriggerPerColumn (
+                            info.name, table_id, name, column, scope));
             break; }
         case OneTriggerPerUpdatedTable: {
-            if (!upd_tbl_value.isEmpty ()) {
-                upd_tbl_value.append (comma);
+            if (!upd_tbl_watched.isEmpty ()) {
+                upd_tbl_watched.append (comma);
             }
-            upd_tbl_value.append (
-                        name % QString("='||quote(OLD.") % name %
-                        QString(")||'"));
+            upd_tbl_value.append (QString("OLD.") % name);
+            upd_tbl_new_value.append (QString("NEW.") % name);
+            upd_tbl_watched.append (name);
             break; }
         case NoTriggerForUpdate: {
             break; }
         }
     }
 
-    QString result;
-    if (rc == SQLITE_DONE) {
-        result =
-            (update_kind == OneTriggerPerUpdatedTable ?
-                 sqlUpdateTriggerPerTable (table, upd_tbl_value) :
-                 empty) %
-            sqlDeleteTrigger (table, del_col_name, del_col_value) %
-            sqlInsertTrigger (table) %
-            upd_col_value;
-    } else {
-        result = empty;
+    // Without a filter the trigger watches all columns.
+    if (info.watch_all) {
+        upd_tbl_watched.clear ();
     }
 
+    // The old values are followed by the new ones.
+    upd_tbl_value.append (upd_tbl_new_value);
+
+    QString result =
+        (info.update_kind == OneTriggerPerUpdatedTable &&
+         !upd_tbl_value.isEmpty () ?
+             sqlUpdateTriggerPerTable (
+                 info.name, table_id, upd_tbl_value,
+                 upd_tbl_watched, scope) :
+             empty) %
+        sqlDeleteTrigger (info.name, table_id, del_col_value, scope) %
+        sqlInsertTrigger (info.name, table_id, scope) %
+        upd_col_value;
+
     RESQLITEUN_TRACE_EXIT;
     return result;
 }
 /* ========================================================================= */
 
+/* ------------------------------------------------------------------------- */
+/**
+ * The triggers only exist while the instance is active, so this
+ * drops every trigger that sqlTriggers() may have created for the table.
+ *
+ * @param info The structure of the table (see readTableInfo()).
+ * @return the statements
+ */
+QString ReSqliteUnUtil::sqlDropTriggers (const TableInfo & info)
+{
+    QString prefix = QString("DROP TRIGGER IF EXISTS temp." RESQUN_PREFIX) %
+            info.name;
+    QString result =
+            prefix % QString("_i;") %
+            prefix % QString("_d;") %
+            prefix % QString("_u;");
+    if (info.update_kind == OneTriggerPerUpdatedColumn) {
+        foreach(int column, info.tracked) {
+            result.append (
+                        prefix % QString("_u_") %
+                        info.columns.at (column) % QString(";"));
+        }
+    }
+    return result;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The triggers are created by `begin` and dropped by `end` (and likewise
+ * around an undo or redo), so they need no condition to tell if the
+ * instance is active and changes made outside an entry cost nothing.
+ *
+ * When only root-level changes are captured the trigger asks the
+ * instance if the row was changed directly by the statement or by a cascade
+ * or a trigger (see ReSqliteUn::isRootChange()):
+ *
+ * @code
+ * WHEN resqun_isroot('Test',9,OLD.rowid)=1
+ * @endcode
+ *
+ * @param s_table The name of the table.
+ * @param operation SQLITE_INSERT, SQLITE_UPDATE or SQLITE_DELETE.
+ * @param s_row The row that holds the rowid (`NEW` or `OLD`).
+ * @param scope Which changes are recorded.
+ * @return the condition, including the `WHEN` keyword, or an empty string
+ */
+QString ReSqliteUnUtil::sqlTriggerCondition (
+        const QString & s_table, int operation, const QString & s_row,
+        CaptureScope scope)
+{
+    if (scope != CaptureRootChanges) {
+        return QString();
+    }
+    return QString(" WHEN ") % QString(RESQUN_FUN_ISROOT) %
+            QString("('") % s_table % QString("',") %
+            QString::number (operation) % comma %
+            s_row % QString(".rowid)=1");
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Column names are compared without regard to case, just like sqlite does.
+ * An empty list means that all columns are tracked, regardless of the
+ * filter.
+ *
+ * @param column The name of the column to check.
+ * @param columns The list of columns provided by the user.
+ * @param filter How to interpret the list.
+ * @return true if updates to this column should be recorded
+ */
+bool ReSqliteUnUtil::isColumnTracked (
+        const QString & column, const QStringList & columns,
+        ColumnFilter filter)
+{
+    if (columns.isEmpty ())
+        return true;
+    bool listed = columns.contains (column, Qt::CaseInsensitive);
+    return (filter == IncludeColumns ? listed : !listed);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Column names are compared without regard to case, just like sqlite does.
+ *
+ * @param columns The list to search.
+ * @param name The name of the column.
+ * @return the index of the column in the list or -1
+ */
+int ReSqliteUnUtil::columnIndex (const QStringList & columns, const QString & name)
+{
+    for (int i = 0; i < columns.count (); ++i) {
+        if (columns.at (i).compare (name, Qt::CaseInsensitive) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * sqlite never moves a column: `ADD COLUMN` appends it, `DROP COLUMN`
+ * removes it and `RENAME COLUMN` changes its name in place. The columns
+ * that kept their name are found by name; they split both lists in gaps
+ * that hold the columns whose name is gone and the new names.
+ *
+ * Inside the table a gap holds either dropped columns (no new name) or
+ * renamed ones (as many new names as old ones). At the end of the table
+ * the first new names are taken as renames of the old columns and the
+ * others as added columns; when there are fewer new names than old
+ * columns it is not possible to tell which were dropped.
+ *
+ * The structure before and after is all there is to go by, so dropping
+ * the last columns and adding as many in the same go looks like a rename.
+ *
+ * @param old_columns The columns before the change, in table order.
+ * @param columns The columns after the change, in table order.
+ * @param moved Receives the new index of each old column (-1 if dropped).
+ * @return false if the change can not be told apart
+ */
+bool ReSqliteUnUtil::matchColumns (
+        const QStringList & old_columns, const QStringList & columns,
+        QList<int> & moved)
+{
+    moved.clear ();
+    bool result = true;
+    int old_gap = 0;
+    int new_gap = 0;
+    for (int i = 0; i <= old_columns.count (); ++i) {
+        bool at_end = (i == old_columns.count ());
+        int index = at_end ? columns.count () :
+                             columnIndex (columns, old_columns.at (i));
+        if (index < 0) {
+            moved.append (-1);
+            continue;
+        }
+        if (index < new_gap) {
+            // A name went back in the table.
+            result = false;
+            index = -1;
+        } else {
+            // Columns from old_gap to i and from new_gap to index.
+            int old_count = i - old_gap;
+            int new_count = index - new_gap;
+            if ((old_count > 0) && (new_count > 0)) {
+                if (at_end ? (new_count < old_count) :
+                             (new_count != old_count)) {
+                    result = false;
+                } else {
+                    for (int k = 0; k < old_count; ++k) {
+                        moved[old_gap + k] = new_gap + k;
+                    }
+                }
+            } else if (!at_end && (new_count > 0)) {
+                // Columns are only added at the end.
+                result = false;
+            }
+            new_gap = index + 1;
+        }
+        old_gap = i + 1;
+        if (!at_end) {
+            moved.append (index);
+        }
+    }
+    return result;
+}
+/* ========================================================================= */
+
 /* ------------------------------------------------------------------------- */
 /**
  * The point of this method is to create an sql statement like the following:
  *
  * @code
  * CREATE TEMP TRIGGER resqun_Test_i
- *     AFTER INSERT ON Test WHEN (SELECT resqun_active())=1
- *     BEGIN INSERT INTO resqun_sqlite_undo(sql,idxid) VALUES (
- *            'DELETE FROM Test WHERE rowid='||NEW.rowid||';',
- *            resqun_getid()
- *         );
- *     END;
+ *     AFTER INSERT ON Test
+ *     BEGIN SELECT resqun_row(0,1,NEW.rowid); END;
  * @endcode
  *
  * This creates a trigger that fires when a certain table (in this case called
- * `Test`) gets a new row from INSERT statement. The RWOID represents
+ * `Test`, the first one attached, so its id is 0) gets a new row from
+ * INSERT statement. The RWOID represents
  * the internal id of the record (see http://sqlite.org/rowidtable.html).
  *
- * Once fired the trigger will write inside the `resqun_sqlite_undo` table
- * the statement that will undo current action.
+ * Once fired the trigger will ask the capture function to write inside the
+ * `resqun_sqlite_undo` table the information needed to undo current action
+ * (see ReSqliteUn::captureRow()). Bulk inserts usually produce contiguous
+ * rowids, so these are merged into a single record covering a range.
  */
-QString ReSqliteUnUtil::sqlInsertTrigger (const QString & s_table)
+QString ReSqliteUnUtil::sqlInsertTrigger (
+        const QString & s_table, int table_id, CaptureScope scope)
 {
     return QString("CREATE TEMP TRIGGER ") % QString(RESQUN_PREFIX) 
         % s_table % QString("_i \n"
-        "AFTER INSERT ON ") % s_table % QString(" WHEN (SELECT ") % 
-        QString(RESQUN_FUN_ACTIVE) % QString("())=1 \n"
-        "BEGIN INSERT INTO resqun_sqlite_undo(sql,idxid) VALUES (\n"
-                "'DELETE FROM ") % s_table % QString(" WHERE rowid='||NEW.rowid||';',\n")  %
-                QString(RESQUN_FUN_GETID) % QString("()\n"
-            ");\n"
-        "END;\n");
+        "AFTER INSERT ON ") % s_table %
+        sqlTriggerCondition (s_table, SQLITE_INSERT, "NEW", scope) %
+        QString(" \n"
+        "BEGIN SELECT " RESQUN_FUN_ROW "(") % QString::number (table_id) %
+            QString("," STR(RESQUN_KIND_INSERT) ",NEW.rowid); END;\n");
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The body of a trigger that records a row:
+ *
+ * @code
+ * SELECT resqun_row(0,2,OLD.rowid,OLD.id,OLD.data);
+ * @endcode
+ *
+ * sqlite allows 127 arguments to a function by default, so the values of
+ * wide tables are split: the first ones are passed to `resqun_part`, in
+ * as many calls as needed, and the rest to `resqun_row`
+ * (see ReSqliteUn::capturePart()).
+ */
+static QString sqlRowCall (
+        int table_id, int kind, const QStringList & values)
+{
+    QString result;
+    int first = 0;
+    while (values.count () - first > ROW_CALL_VALUES) {
+        result.append (QString("SELECT " RESQUN_FUN_PART "(") % values.at (first));
+        for (int i = 1; i < ROW_CALL_VALUES; ++i) {
+            result.append (comma % values.at (first + i));
+        }
+        result.append (QString("); "));
+        first += ROW_CALL_VALUES;
+    }
+    result.append (
+                QString("SELECT " RESQUN_FUN_ROW "(") %
+                QString::number (table_id) % comma %
+                QString::number (kind) % QString(",OLD.rowid"));
+    for (int i = first; i < values.count (); ++i) {
+        result.append (comma % values.at (i));
+    }
+    result.append (QString(");"));
+    return result;
 }
 /* ========================================================================= */
 
@@ -227,34 +986,34 @@ QString ReSqliteUnUtil::sqlInsertTrigger (const QString & s_table)
  *
  * @code
  * CREATE TEMP TRIGGER resqun_Test_d
- *     BEFORE DELETE ON Test WHEN (SELECT resqun_active())=1
- *     BEGIN INSERT INTO resqun_sqlite_undo(sql,idxid) VALUES (
- *             'INSERT INTO Test(rowid,id,data,data1) VALUES('||OLD.rowid||','||quote(OLD.id)||','||quote(OLD.data)||','||quote(OLD.data1)||');',
- *            resqun_getid()
- *         );
- *     END;
+ *     BEFORE DELETE ON Test
+ *     BEGIN SELECT resqun_row(0,2,OLD.rowid,OLD.id,OLD.data,OLD.data1); END;
  * @endcode
  *
  * This creates a trigger that fires when a certain table (in this case called
  * `Test`) looses a row in a DELETE statement. The RWOID represents
  * the internal id of the record (see http://sqlite.org/rowidtable.html).
  *
- * Once fired the trigger will write inside the `resqun_sqlite_undo` table
- * the statement that will undo current action.
+ * Once fired the trigger will hand the whole row to the capture function
+ * that stores it inside the `resqun_sqlite_undo` table (the values of
+ * wide tables are handed in parts, see sqlRowCall()).
+ *
+ * When only root-level changes are captured this becomes an `AFTER DELETE`
+ * trigger, as the preupdate hook that tells root changes apart only
+ * runs after `BEFORE` triggers.
  */
 QString ReSqliteUnUtil::sqlDeleteTrigger (
-        const QString &s_table, const QString & s_column_names,
-        const QString & s_column_values)
+        const QString &s_table, int table_id,
+        const QStringList & column_values, CaptureScope scope)
 {
-    return QString("CREATE TEMP TRIGGER ") % QString(RESQUN_PREFIX) % s_table % QString("_d \n"
-             "BEFORE DELETE ON ") % s_table % QString(" WHEN (SELECT ") %
-             QString(RESQUN_FUN_ACTIVE) % QString("())=1 \n"
-             "BEGIN INSERT INTO resqun_sqlite_undo(sql,idxid) VALUES (\n"
-                    "'INSERT INTO ") % s_table % QString("(rowid,") % s_column_names % QString(") "
-                        "VALUES('||OLD.rowid||'") % s_column_values % QString(");', \n") %
-                    QString(RESQUN_FUN_GETID) % QString("()\n"
-                ");\n"
-             "END;\n");
+    return QString("CREATE TEMP TRIGGER ") % QString(RESQUN_PREFIX) % s_table % QString("_d \n") %
+             QString(scope == CaptureRootChanges ? "AFTER" : "BEFORE") %
+             QString(" DELETE ON ") % s_table %
+             sqlTriggerCondition (s_table, SQLITE_DELETE, "OLD", scope) %
+             QString(" \n"
+             "BEGIN ") % sqlRowCall (
+                 table_id, RESQUN_KIND_DELETE, column_values) %
+             QString(" END;\n");
 }
 /* ========================================================================= */
 
@@ -276,28 +1035,27 @@ QString ReSqliteUnUtil::sqlDeleteTrigger (
  *
  * @code
  * CREATE TEMP TRIGGER resqun_Test_u_data
- *     AFTER UPDATE OF data ON Test WHEN (SELECT resqun_active())=1
- *     BEGIN INSERT INTO resqun_sqlite_undo(sql,idxid) VALUES (
- *            'UPDATE Test SET data WHERE rowid='||OLD.rowid||';',
- *            resqun_getid()
- *         );
- *     END;
+ *     AFTER UPDATE OF data ON Test
+ *     BEGIN SELECT resqun_row(0,4,OLD.rowid,1,OLD.data,NEW.data); END;
  * @endcode
+ *
+ * where `1` is the index of the `data` column inside the table. Both the
+ * old value (used by undo) and the new one (used by redo) are recorded.
  */
 QString ReSqliteUnUtil::sqlUpdateTriggerPerColumn (
-        const QString &s_table, const QString &s_column)
+        const QString &s_table, int table_id, const QString &s_column,
+        int column_index, CaptureScope scope)
 {
     return QString("CREATE TEMP TRIGGER ") % QString(RESQUN_PREFIX) % 
              s_table % QString("_u_") % s_column % QString(" \n"
              "AFTER UPDATE OF ") % s_column % QString(" "
-                 "ON ") % s_table % QString(" "
-                 "WHEN (SELECT ") % QString(RESQUN_FUN_ACTIVE) % QString("())=1 \n"
-             "BEGIN INSERT INTO resqun_sqlite_undo(sql,idxid) VALUES (\n"
-                     "'UPDATE ") % s_table % QString(" SET ") % s_column % QString(" "
-                         "WHERE rowid='||OLD.rowid||';',\n") %
-                     QString(RESQUN_FUN_GETID) % QString("()\n"
-                 ");\n"
-             "END;\n");
+                 "ON ") % s_table %
+                 sqlTriggerCondition (s_table, SQLITE_UPDATE, "OLD", scope) %
+                 QString(" \n"
+             "BEGIN SELECT " RESQUN_FUN_ROW "(") % QString::number (table_id) %
+                QString("," STR(RESQUN_KIND_UPDATE_COLUMN) ",OLD.rowid,") %
+                QString::number (column_index) % QString(",OLD.") %
+                s_column % QString(",NEW.") % s_column % QString("); END;\n");
 }
 /* ========================================================================= */
 
@@ -319,37 +1077,161 @@ QString ReSqliteUnUtil::sqlUpdateTriggerPerColumn (
  *
  * @code
  * CREATE TEMP TRIGGER resqun_Test_u
- *     AFTER UPDATE ON Test WHEN (SELECT resqun_active())=1
- *     BEGIN INSERT INTO resqun_sqlite_undo(sql,idxid) VALUES (
- *            'UPDATE Test SET data='||quote(OLD.data)||',data1='||quote(OLD.data1)||' WHERE rowid='||OLD.rowid||';',
- *            resqun_getid()
- *         );
- *     END;
+ *     AFTER UPDATE ON Test
+ *     BEGIN SELECT resqun_row(0,3,OLD.rowid,
+ *         OLD.data,OLD.data1,NEW.data,NEW.data1); END;
  * @endcode
  *
+ * The values are those of the tracked columns, in the order
+ * in which they appear in the table: the old ones (used by undo)
+ * followed by the new ones (used by redo). The values of wide tables
+ * are handed in parts (see sqlRowCall()).
+ *
+ * When @a s_watched_columns is not empty the trigger becomes
+ * `AFTER UPDATE OF data,data1 ON Test` so that updates touching only
+ * other columns are not recorded.
  */
 QString ReSqliteUnUtil::sqlUpdateTriggerPerTable (
-        const QString &s_table, const QString & s_column_list)
+        const QString &s_table, int table_id, const QStringList & column_values,
+        const QString & s_watched_columns, CaptureScope scope)
 {
     return QString("CREATE TEMP TRIGGER ") % QString(RESQUN_PREFIX) % 
          s_table % QString("_u \n"
-         "AFTER UPDATE ON ") % s_table % QString(" WHEN (SELECT ") % 
-         QString(RESQUN_FUN_ACTIVE) % QString("())=1 \n"
-         "BEGIN INSERT INTO resqun_sqlite_undo(sql,idxid) VALUES (\n"
-                  "'UPDATE ") % s_table % QString(" SET ") % s_column_list % QString(" "
-                      "WHERE rowid='||OLD.rowid||';',\n") %
-                  QString(RESQUN_FUN_GETID) % QString("()\n"
-             ");\n"
-             "END;\n");
+         "AFTER UPDATE ") %
+         (s_watched_columns.isEmpty () ?
+              empty : QString("OF ") % s_watched_columns % QString(" ")) %
+         QString("ON ") % s_table %
+         sqlTriggerCondition (s_table, SQLITE_UPDATE, "OLD", scope) %
+         QString(" \n"
+         "BEGIN ") % sqlRowCall (
+             table_id, RESQUN_KIND_UPDATE, column_values) %
+         QString(" END;\n");
 }
 /* ========================================================================= */
 #include <QWidget>
 #include <QVBoxLayout>
 #include <QTableView>
 #include <QLabel>
-#include <QSqlRelationalTableModel>
+#include <QAbstractTableModel>
+#include <QSqlQuery>
+#include <QSqlDriver>
+#include <QVector>
+#include <QVariant>
+#include <QEvent>
 #include <QSettings>
 
+//! Number of rows read at once by DebugPageModel.
+#define DEBUG_PAGE_ROWS 128
+
+//! Number of pages kept by DebugPageModel.
+#define DEBUG_PAGE_CACHE 16
+
+//! Reads the rows of a query one page at a time, as the view needs them.
+class DebugPageModel : public QAbstractTableModel {
+public:
+    QSqlDatabase database_; /**< the connection to read from */
+    QString count_sql_; /**< counts the rows */
+    QString page_sql_; /**< reads a page (binds limit and offset) */
+    QStringList headers_; /**< the titles of the columns */
+    int rows_; /**< number of rows when last reloaded */
+    mutable QHash<int, QVector<QVector<QVariant> > > pages_; /**< pages read so far */
+
+    DebugPageModel (
+            QSqlDatabase database, const QString & count_sql,
+            const QString & page_sql, const QStringList & headers,
+            QObject * parent) :
+        QAbstractTableModel (parent),
+        database_ (database),
+        count_sql_ (count_sql),
+        page_sql_ (page_sql),
+        headers_ (headers),
+        rows_ (0),
+        pages_ ()
+    {
+        reload ();
+    }
+
+    //! Forget the pages and count the rows again.
+    void reload ()
+    {
+        beginResetModel ();
+        pages_.clear ();
+        rows_ = 0;
+        QSqlQuery query (database_);
+        if (query.exec (count_sql_) && query.next ()) {
+            rows_ = query.value (0).toInt ();
+        }
+        endResetModel ();
+    }
+
+    virtual int rowCount (const QModelIndex & parent = QModelIndex ()) const
+    {
+        return parent.isValid () ? 0 : rows_;
+    }
+
+    virtual int columnCount (const QModelIndex & parent = QModelIndex ()) const
+    {
+        return parent.isValid () ? 0 : headers_.count ();
+    }
+
+    virtual QVariant headerData (
+            int section, Qt::Orientation orientation,
+            int role = Qt::DisplayRole) const
+    {
+        if ((role == Qt::DisplayRole) && (orientation == Qt::Horizontal) &&
+                (section >= 0) && (section < headers_.count ())) {
+            return headers_.at (section);
+        }
+        return QAbstractTableModel::headerData (section, orientation, role);
+    }
+
+    virtual QVariant data (
+            const QModelIndex & index, int role = Qt::DisplayRole) const
+    {
+        if ((role != Qt::DisplayRole) || !index.isValid ()) {
+            return QVariant ();
+        }
+        int page = index.row () / DEBUG_PAGE_ROWS;
+        if (!pages_.contains (page)) {
+            if (pages_.count () >= DEBUG_PAGE_CACHE) {
+                pages_.clear ();
+            }
+            pages_.insert (page, readPage (page));
+        }
+        const QVector<QVector<QVariant> > & rows = pages_[page];
+        int row = index.row () % DEBUG_PAGE_ROWS;
+        if ((row >= rows.count ()) ||
+                (index.column () >= rows.at (row).count ())) {
+            return QVariant ();
+        }
+        return rows.at (row).at (index.column ());
+    }
+
+    //! Read a page from the database.
+    QVector<QVector<QVariant> > readPage (int page) const
+    {
+        QVector<QVector<QVariant> > result;
+        QSqlQuery query (database_);
+        query.setForwardOnly (true);
+        if (!query.prepare (page_sql_)) {
+            return result;
+        }
+        query.addBindValue (DEBUG_PAGE_ROWS);
+        query.addBindValue (page * DEBUG_PAGE_ROWS);
+        if (!query.exec ()) {
+            return result;
+        }
+        while (query.next ()) {
+            QVector<QVariant> row;
+            for (int i = 0; i < headers_.count (); ++i) {
+                row.append (query.value (i));
+            }
+            result.append (row);
+        }
+        return result;
+    }
+};
+
 class DebugViewManager : public QObject {
     Q_OBJECT
 public:
@@ -357,40 +1239,50 @@ public:
     QLabel * lbl1;
     QTableView * tv1;
     QTableView * tv2;
-    QSqlTableModel *model1;
-    QSqlTableModel *model2;
+    DebugPageModel *model1;
+    DebugPageModel *model2;
+    ReSqliteUn * undoer; /**< the instance of the database (may be NULL) */
+    void * db; /**< the sqlite handle of the database */
 
     DebugViewManager(QSqlDatabase database, QWidget * parent) :
-        QObject ()
+        QObject (),
+        undoer (NULL),
+        db (NULL)
     {
         wdg = new QWidget(parent);
         wdg->setAttribute (Qt::WA_DeleteOnClose);
+        wdg->installEventFilter (this);
         this->setParent (wdg);
         QVBoxLayout * main_lay = new QVBoxLayout (wdg);
 
+        // Newest entries first; only the rows that are shown are read.
         tv1 = new QTableView (wdg);
-        model1 = new QSqlTableModel (
-                    tv1, database);
-        model1->setTable (RESQUN_TBL_IDX);
-        model1->setEditStrategy (QSqlTableModel::OnFieldChange);
-        model1->select ();
-        model1->setHeaderData (0, Qt::Horizontal, tr ("ID"));
-        model1->setHeaderData (1, Qt::Horizontal, tr ("Name"));
-        model1->setHeaderData (1, Qt::Horizontal, tr ("Status"));
+        model1 = new DebugPageModel (
+                    database,
+                    "SELECT COUNT(*) FROM " RESQUN_VTAB_HISTORY,
+                    "SELECT id, name, status, records, bytes, ts "
+                    "FROM " RESQUN_VTAB_HISTORY " "
+                    "ORDER BY id DESC LIMIT ? OFFSET ?",
+                    QStringList () << tr ("ID") << tr ("Name") <<
+                        tr ("Status") << tr ("Records") << tr ("Bytes") <<
+                        tr ("Time"),
+                    tv1);
         tv1->setModel (model1);
         main_lay->addWidget (tv1);
 
+        // The images are shown by size, not read.
         tv2 = new QTableView (wdg);
-        model2 = new QSqlTableModel (
-                    tv2, database);
-        model2->setTable (RESQUN_TBL_TEMP);
-        model2->setEditStrategy (QSqlTableModel::OnFieldChange);
-        model2->select ();
-        model2->setHeaderData (0, Qt::Horizontal, tr ("ID"));
-        model2->setHeaderData (1, Qt::Horizontal, tr ("SQ"));
-        model2->setHeaderData (2, Qt::Horizontal, tr ("Idx"));
-//        model2->setRelation (
-//                    2, QSqlRelation(RESQUN_TBL_IDX, "id", "name"));
+        model2 = new DebugPageModel (
+                    database,
+                    "SELECT COUNT(*) FROM " RESQUN_TBL_TEMP,
+                    "SELECT id, idxid, op, tbl, firstid, lastid, "
+                        "length(data), length(redo) "
+                    "FROM " RESQUN_TBL_TEMP " "
+                    "ORDER BY id DESC LIMIT ? OFFSET ?",
+                    QStringList () << tr ("ID") << tr ("Idx") <<
+                        tr ("Op") << tr ("Table") << tr ("First") <<
+                        tr ("Last") << tr ("Undo") << tr ("Redo"),
+                    tv2);
         tv2->setModel (model2);
         main_lay->addWidget (tv2);
 
@@ -402,17 +1294,44 @@ public:
         QSettings settings ("resqliteun", "DebugViewManager");
         wdg->restoreGeometry (settings.value("geometry").toByteArray());
 
-        startTimer(500);
+        // The instance of this database, not the last one that was created.
+        QVariant handle = database.driver ()->handle ();
+        if (handle.isValid () && (qstrcmp (handle.typeName (), "sqlite3*") == 0)) {
+            db = *static_cast<void **>(handle.data ());
+            undoer = ReSqliteUn::instanceForDatabase (db);
+        }
+        if (undoer != NULL) {
+            undoer->addChangeListener (changeCallback, this);
+        }
+
+        updateState ();
     }
 
-    void closeEvent (QCloseEvent *event)
+    //! Stop listening if the instance still exists.
+    virtual ~DebugViewManager ()
     {
+        if ((undoer != NULL) &&
+                (ReSqliteUn::instanceForDatabase (db) == undoer)) {
+            undoer->removeChangeListener (changeCallback, this);
+        }
     }
 
-    virtual void timerEvent (QTimerEvent *event) {
-        model1->select ();
-        model2->select ();
-        ReSqliteUn * inst = ReSqliteUn::instance();
+    //! Called by the instance after end, undo and redo, on any thread.
+    static void changeCallback (
+            ReSqliteUn * undoer, int reason,
+            const ReSqliteUn::ChangeSet & changes, void * user_data)
+    {
+        Q_UNUSED(undoer);
+        Q_UNUSED(reason);
+        Q_UNUSED(changes);
+        DebugViewManager * self = static_cast<DebugViewManager *>(user_data);
+        QMetaObject::invokeMethod (self, "reload", Qt::QueuedConnection);
+    }
+
+    //! Show the state of the instance.
+    void updateState ()
+    {
+        ReSqliteUn * inst = undoer;
         if (inst == NULL) {
             lbl1->setText("No active instance");
         } else {
@@ -426,13 +1345,39 @@ public:
                 lbl1->setText ("Inactive");
             }
         }
-        QSettings settings ("resqliteun", "DebugViewManager");
-        settings.setValue ("geometry", wdg->saveGeometry());
+    }
+
+    //! Save the geometry once, when the window is closed.
+    virtual bool eventFilter (QObject *watched, QEvent *event) {
+        if ((watched == wdg) && (event->type () == QEvent::Close)) {
+            QSettings settings ("resqliteun", "DebugViewManager");
+            settings.setValue ("geometry", wdg->saveGeometry());
+        }
+        return QObject::eventFilter (watched, event);
+    }
+
+public slots:
+
+    //! Read the tables again.
+    void reload () {
+        model1->reload ();
+        model2->reload ();
+        updateState ();
     }
 
 };
 
 /* ------------------------------------------------------------------------- */
+/**
+ * The view lists the entries (newest first) and the journal records.
+ * The models read the rows that are shown, a page at a time, and are
+ * reloaded after each end, undo and redo of the instance of @a database,
+ * so an idle view costs nothing. The view is a change listener of the
+ * instance (see ReSqliteUn::addChangeListener()) until it is closed, so
+ * it leaves the change callback of the application alone.
+ *
+ * The geometry of the window is saved when it is closed.
+ */
 QWidget *ReSqliteUnUtil::createDebugView (
         QSqlDatabase database, QWidget * parent)
 {
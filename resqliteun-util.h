@@ -24,6 +24,8 @@
 #include <resqliteun/resqliteun-names.h>
 
 #include <QString>
+#include <QByteArray>
+#include <QStringList>
 #include <QList>
 
 /*  INCLUDES    ============================================================ */
@@ -67,6 +69,22 @@ public:
                                              column of the table */
     };
 
+    //! Which changes are recorded.
+    enum CaptureScope {
+        CaptureAllChanges  = 0, /**< every row that changes is recorded,
+                                     including those changed by cascades
+                                     and triggers */
+        CaptureRootChanges = 1  /**< only rows changed directly by
+                                     the statement are recorded; nested
+                                     changes are reproduced by replay */
+    };
+
+    //! How to interpret the list of columns passed along with a table.
+    enum ColumnFilter {
+        ExcludeColumns = 0, /**< listed columns are not tracked by updates */
+        IncludeColumns = 1  /**< only listed columns are tracked by updates */
+    };
+
     //! Ways to refer to undo and redo.
     enum UndoRedoType {
         NoUndoRedo = 0,
@@ -78,6 +96,21 @@ public:
 
     typedef int SqLiteResult;
 
+    //! The structure of a table as seen by the triggers and by replay.
+    struct TableInfo {
+        QString name; /**< the name of the table */
+        QStringList columns; /**< all the columns, in table order */
+        QList<int> tracked; /**< indices of the columns tracked by updates */
+        UpdateBehaviour update_kind; /**< how updates are tracked */
+        bool watch_all; /**< no column filter, updates watch all columns */
+        QStringList filter_columns; /**< the columns given to attachToTable() */
+        ColumnFilter filter; /**< how to interpret filter_columns */
+        QString definition; /**< the sql that created the table */
+        CaptureScope scope; /**< which changes are recorded by the triggers */
+        QByteArray arm_sql; /**< statements that create the triggers */
+        QByteArray disarm_sql; /**< statements that drop the triggers */
+    };
+
     /*  DEFINITIONS    ===================================================== */
     //
     //
@@ -113,43 +146,158 @@ public:
             int column,
             const QString &s_value);
 
+    //! Set a string as the result of a function or a column.
+    static void
+    result (
+            void *context,
+            const QString &s_value);
+
 
     //! Get the content of a value as a string.
     static QString
     value2string (
             void *val);
 
+    //! Quote a name for use as an identifier in sql.
+    static QString
+    quotedName (
+            const QString &s_name);
 
-    //! The sql statements that create triggers for a table.
+    //! Quote a string for use as a literal in sql.
     static QString
-    sqlTriggers (
+    quotedText (
+            const QString &s_value);
+
+
+    //! Read the structure of a table.
+    static SqLiteResult
+    readTableInfo (
+            void *db,
+            const QString &table,
+            UpdateBehaviour update_kind,
+            const QStringList &columns,
+            ColumnFilter filter,
+            TableInfo &info);
+
+    //! Read the sql that created a table.
+    static SqLiteResult
+    readDefinition (
+            void *db,
+            const QString &table,
+            QString &definition);
+
+    //! Read the structure of many tables with one statement.
+    static SqLiteResult
+    readTablesInfo (
+            void *db,
+            const QStringList &tables,
+            const QString &pattern,
+            UpdateBehaviour update_kind,
+            QList<TableInfo> &infos);
+
+    //! Read the tables that a change to a table writes to.
+    static SqLiteResult
+    readWrittenTables (
+            void *db,
+            const TableInfo &info,
+            QStringList &tables);
+
+    //! Read the structure of a table and build its triggers, reusing
+    //! the work done by other connections to the same database.
+    static SqLiteResult
+    cachedTableInfo (
             void *db,
             const QString &table,
-            UpdateBehaviour update_kind);
+            UpdateBehaviour update_kind,
+            const QStringList &columns,
+            ColumnFilter filter,
+            int table_id,
+            CaptureScope scope,
+            TableInfo &info,
+            bool &from_cache);
+
+    //! Make the triggers of a table available to other connections.
+    static void
+    cacheTableInfo (
+            void *db,
+            const QString &table,
+            const QStringList &columns,
+            ColumnFilter filter,
+            int table_id,
+            const TableInfo &info);
+
+    //! The sql statements that create triggers for a table.
+    static QString
+    sqlTriggers (
+            const TableInfo &info,
+            int table_id,
+            CaptureScope scope = CaptureAllChanges);
+
+    //! The sql statements that drop the triggers of a table.
+    static QString
+    sqlDropTriggers (
+            const TableInfo &info);
+
+    //! The condition that decides if a trigger records a change.
+    static QString
+    sqlTriggerCondition (
+            const QString &s_table,
+            int operation,
+            const QString &s_row,
+            CaptureScope scope);
+
+    //! Tell if a column takes part in update tracking.
+    static bool
+    isColumnTracked (
+            const QString &column,
+            const QStringList &columns,
+            ColumnFilter filter);
+
+    //! Find a column in a list of columns.
+    static int
+    columnIndex (
+            const QStringList &columns,
+            const QString &name);
+
+    //! Find where the columns of a table went after `ALTER TABLE`.
+    static bool
+    matchColumns (
+            const QStringList &old_columns,
+            const QStringList &columns,
+            QList<int> &moved);
 
     //! Compute the sql string for insert trigger.
     static QString
     sqlInsertTrigger (
-            const QString &s_table);
+            const QString &s_table,
+            int table_id,
+            CaptureScope scope = CaptureAllChanges);
 
     //! Compute the sql string for delete trigger.
     static QString
     sqlDeleteTrigger (
             const QString &s_table,
-            const QString & s_column_names,
-            const QString & s_column_values);
+            int table_id,
+            const QStringList & column_values,
+            CaptureScope scope = CaptureAllChanges);
 
     //! Compute the sql string for update trigger.
     static QString
     sqlUpdateTriggerPerColumn (
             const QString &s_table,
-            const QString &s_colum);
+            int table_id,
+            const QString &s_colum,
+            int column_index,
+            CaptureScope scope = CaptureAllChanges);
 
     //! Compute the sql string for update trigger.
     static QString
     sqlUpdateTriggerPerTable (
             const QString &s_table,
-            const QString &s_column_list);
+            int table_id,
+            const QStringList &column_values,
+            const QString &s_watched_columns = QString(),
+            CaptureScope scope = CaptureAllChanges);
 
     //! Creates an autorefresh view into the temporary tables.
     static QWidget *
@@ -23,6 +23,8 @@
 
 #include <assert.h>
 #include <QStringBuilder>
+#include <QElapsedTimer>
+#include <QVector>
 
 /*  INCLUDES    ============================================================ */
 //
@@ -36,6 +38,65 @@
 
 #define dtb_ static_cast<sqlite3 *>(db_)
 
+//! Milliseconds since the Unix epoch, as an sql expression.
+#define SQL_NOW "CAST((julianday('now')-2440587.5)*86400000 AS INTEGER)"
+
+static QLatin1String comma (",");
+
+/* ------------------------------------------------------------------------- */
+//! What a journal record does to the rows when replayed (or captured).
+static int changeOp (int kind, bool for_undo)
+{
+    switch (kind) {
+    case ReSqliteUnRecord::InsertKind:
+        return for_undo ? ReSqliteUn::ChangeDelete : ReSqliteUn::ChangeInsert;
+    case ReSqliteUnRecord::DeleteKind:
+        return for_undo ? ReSqliteUn::ChangeInsert : ReSqliteUn::ChangeDelete;
+    case ReSqliteUnRecord::SnapshotKind:
+        return ReSqliteUn::ChangeReset;
+    default:
+        return ReSqliteUn::ChangeUpdate;
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! The name of the shadow table of a table (or of one of its objects),
+//! quoted for sql.
+static QString shadowName (const QString & table, const char * suffix = "")
+{
+    return ReSqliteUnUtil::quotedName (
+                QLatin1String (RESQUN_TBL_SHADOW) % table %
+                QLatin1String (suffix));
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Changes a flag of the connection and returns its previous value.
+static int switchFlag (sqlite3 * db, int flag, int value)
+{
+    int previous = 1;
+    sqlite3_db_config (db, flag, -1, &previous);
+    sqlite3_db_config (db, flag, value, NULL);
+    return previous;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+ReSqliteUnLocker::ReSqliteUnLocker (void * db) :
+    mutex_ (sqlite3_db_mutex (static_cast<sqlite3 *>(db)))
+{
+    sqlite3_mutex_enter (static_cast<sqlite3_mutex *>(mutex_));
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+ReSqliteUnLocker::~ReSqliteUnLocker ()
+{
+    sqlite3_mutex_leave (static_cast<sqlite3_mutex *>(mutex_));
+}
+/* ========================================================================= */
+
 /*  DEFINITIONS    ========================================================= */
 //
 //
@@ -67,10 +128,46 @@ ReSqliteUn::ReSqliteUn (
         void *db) :
     db_ (db),
     is_active_ (false),
-    in_undo_(true)
+    in_undo_(true),
+    is_armed_ (false),
+    capture_scope_ (CaptureAllChanges),
+    pending_ (),
+    app_hook_ (NULL),
+    app_hook_data_ (NULL),
+    app_progress_ (NULL),
+    app_progress_data_ (NULL),
+    app_progress_opcodes_ (0),
+    tables_ (),
+    table_ids_ (),
+    capture_id_ (-1),
+    stmt_capture_ (NULL),
+    stmt_extend_ (NULL),
+    part_values_ (),
+    last_record_ (-1),
+    last_table_ (-1),
+    last_rowid_ (-1),
+    precompile_ (false),
+    plans_ (),
+    replay_total_ (0),
+    replay_applied_ (0),
+    is_replaying_ (false),
+    effects_key_ (),
+    quiet_triggers_ (false),
+    quiet_fkeys_ (false),
+    schema_version_ (-1),
+    stats_ (),
+    entry_records_ (0),
+    entry_bytes_ (0),
+    entry_rows_ (0),
+    entry_tables_ (),
+    change_callback_ (NULL),
+    change_data_ (NULL),
+    change_listeners_ (),
+    changes_ (),
+    change_index_ ()
 {
     RESQLITEUN_TRACE_ENTRY;
-    instances_.append (this);
+    registerInstance (this);
     RESQLITEUN_TRACE_EXIT;
 }
 /* ========================================================================= */
@@ -79,12 +176,138 @@ ReSqliteUn::ReSqliteUn (
 /**
  * If this is the default (last created) instnce then it will be no
  * default instance from this point forward..
+ *
+ * The statements used while capturing are released by end(), but an
+ * entry that was never closed still holds them (and the values kept by
+ * capturePart()), so they are released here. Those of a replay are
+ * released by closeReplay() and the plans prepared in advance hold no
+ * statement, so these are simply deleted.
+ *
+ * The preupdate hook of the application (see setPreupdateHook()) is
+ * given back to the connection.
  */
 ReSqliteUn::~ReSqliteUn()
 {
     RESQLITEUN_TRACE_ENTRY;
-    instances_.removeOne (this);
+    discardPlans ();
+    releaseCapture ();
+    installPreupdateHook (CaptureAllChanges);
+    unregisterInstance (this);
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Connections that never use undo do not need the temporary tables,
+ * so these are created by the first `resqun_table` or `resqun_begin`
+ * (attachToTable() and begin()). Until then there is nothing to undo or
+ * redo and the functions that read the tables report empty results.
+ *
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::createSchema ()
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    for (;;) {
+        if (hasSchema ()) {
+            break;
+        }
+
+        // AUTOINCREMENT is justified because we use the indices to
+        // have the entries sorted by time.
+        rc = sqlite3_exec (dtb_,
+
+            // This is where each undo or redo entry is stored.
+            // The cost of the entry (journal records, bytes of images,
+            // rows, tables) and the time it was closed are written
+            // by end(), so that nobody needs to scan the journal to
+            // find them.
+            "CREATE TEMP TABLE IF NOT EXISTS " RESQUN_TBL_IDX "("
+                "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                "name TEXT, "
+                "status INTEGER, "
+                "records INTEGER NOT NULL DEFAULT 0, "
+                "bytes INTEGER NOT NULL DEFAULT 0, "
+                "rows INTEGER NOT NULL DEFAULT 0, "
+                "tables TEXT, "
+                "started INTEGER, "
+                "finished INTEGER "
+            ");"
+
+            // This is where the data for each individual step is stored
+            // An undo or redo method may have zero or more
+            // individual steps associated with them.
+            // Each record stores the kind of change, the table and
+            // the range of rowids it covers (contiguous inserts share
+            // a single record) along with binary images of the values
+            // that need to be restored by undo and by redo.
+            "CREATE TEMP TABLE IF NOT EXISTS " RESQUN_TBL_TEMP "("
+                "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                "idxid INTEGER, "
+                "op INTEGER, "
+                "tbl TEXT, "
+                "firstid INTEGER, "
+                "lastid INTEGER, "
+                "data BLOB, "
+                "redo BLOB, "
+                "FOREIGN KEY(idxid) REFERENCES " RESQUN_TBL_IDX "(id) "
+            ");"
+
+            // We're creating an index here because
+            // `SELECT id FROM sqlite_undo WHERE idxid=XX` is common.
+            "CREATE INDEX IF NOT EXISTS " RESQUN_INDEX_DATA " "
+                "ON " RESQUN_TBL_TEMP "(idxid);"
+
+            // Used by `resqun_asof` to find the records of a row
+            // (see ReSqliteUnAsOf) without reading the whole journal.
+            "CREATE INDEX IF NOT EXISTS " RESQUN_INDEX_ROWS " "
+                "ON " RESQUN_TBL_TEMP "(tbl, firstid);",
+
+            NULL, NULL, NULL);
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("createSchema(): failed to create "
+                              "temporary tables: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+
+        break;
+    }
     RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The answer is not kept: the tables are created inside the transaction
+ * of the application, which may roll them back, so the schema of the
+ * `temp` database is the one to ask.
+ *
+ * @return true if both temporary tables exist
+ */
+bool ReSqliteUn::hasSchema () const
+{
+    bool result = false;
+    sqlite3_stmt *stmt = NULL;
+    ReSqliteUn::SqLiteResult rc = sqlite3_prepare_v2 (
+                dtb_,
+                "SELECT count(*) FROM sqlite_temp_master "
+                "WHERE type='table' AND name IN "
+                "('" RESQUN_TBL_IDX "', '" RESQUN_TBL_TEMP "')",
+                -1, &stmt, NULL);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_step (stmt);
+        if (rc == SQLITE_ROW) {
+            result = (sqlite3_column_int (stmt, 0) == 2);
+        }
+    }
+    if (stmt != NULL) {
+        sqlite3_finalize (stmt);
+    }
+    return result;
 }
 /* ========================================================================= */
 
@@ -102,15 +325,33 @@ ReSqliteUn::SqLiteResult ReSqliteUn::begin (
         const QString & s_name, qint64 * entry_id)
 {
     RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    RESQLITEUN_PROBE1(begin__start, dtb_);
+    QElapsedTimer timer;
+    timer.start ();
     ReSqliteUn::SqLiteResult rc = SQLITE_ERROR;
     for (;;) {
 
-        if (is_active_) {
+        if (is_active_ || is_replaying_) {
             RESQLITEUN_DEBUGM("Already in active state; cannot begin");
             rc = SQLITE_MISUSE;
             break;
         }
 
+        rc = createSchema ();
+        if (rc != SQLITE_OK) {
+            break;
+        }
+
+        // Tables changed by ALTER TABLE since last time get new triggers.
+        rc = refreshTables ();
+        if (rc != SQLITE_OK) {
+            break;
+        }
+
+        // The new entry replaces the top of the stack.
+        discardPlans ();
+
         // Remove all "redo" entries and place a marker for first undo entry.
         QString statements = QString (
             "SAVEPOINT " RESQUN_SVP_BEGIN ";"
@@ -124,25 +365,42 @@ ReSqliteUn::SqLiteResult ReSqliteUn::begin (
             "DELETE FROM " RESQUN_TBL_IDX " WHERE status=" STR(RESQUN_MARK_REDO) ";"
 
             // And we're inserting a new undo entry.
-            "INSERT INTO " RESQUN_TBL_IDX "(name, status) VALUES('%1'," STR(RESQUN_MARK_UNDO) ");"
+            "INSERT INTO " RESQUN_TBL_IDX "(name, status, started) "
+                "VALUES('%1'," STR(RESQUN_MARK_UNDO) "," SQL_NOW ");"
             ).arg (s_name);
-        rc = sqlite3_exec (
-            dtb_,
-            statements.toUtf8().constData (),
-            NULL, NULL, NULL);
+        {
+            RESQLITEUN_TRACE_SPAN("begin.truncate_redo");
+            RESQLITEUN_PROBE1(truncate__start, dtb_);
+            rc = sqlite3_exec (
+                dtb_,
+                statements.toUtf8().constData (),
+                NULL, NULL, NULL);
+            RESQLITEUN_PROBE2(truncate__done, dtb_, rc);
+        }
+        if (rc == SQLITE_OK) {
+            rc = armTriggers ();
+        }
         if (rc != SQLITE_OK) {
             sqlite3_exec (dtb_,
                 "ROLLBACK TO SAVEPOINT " RESQUN_SVP_BEGIN,
                 NULL, NULL, NULL);
+            is_armed_ = false;
             rc = SQLITE_ERROR;
         } else {
             is_active_ = true;
             RESQLITEUN_DEBUGM("State changed to active by begin command");
             rc = SQLITE_OK;
 
+            capture_id_ = sqlite3_last_insert_rowid (dtb_);
             if (entry_id != NULL) {
-                *entry_id = sqlite3_last_insert_rowid (dtb_);
+                *entry_id = capture_id_;
             }
+            entry_records_ = 0;
+            entry_bytes_ = 0;
+            entry_rows_ = 0;
+            entry_tables_.clear ();
+            changes_.clear ();
+            change_index_.clear ();
         }
         sqlite3_exec (dtb_, "RELEASE SAVEPOINT " RESQUN_SVP_BEGIN,
                 NULL, NULL, NULL);
@@ -150,105 +408,2383 @@ ReSqliteUn::SqLiteResult ReSqliteUn::begin (
         in_undo_ = true;
         break;
     }
+    stats_.addTiming (ReSqliteUnStats::BeginCount, timer.nsecsElapsed ());
+    RESQLITEUN_PROBE3(begin__done, dtb_, capture_id_, rc);
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+ReSqliteUn::SqLiteResult ReSqliteUn::end ()
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    RESQLITEUN_PROBE1(end__start, dtb_);
+    QElapsedTimer timer;
+    timer.start ();
+    qint64 records = 0;
+    ReSqliteUn::SqLiteResult rc = SQLITE_ERROR;
+    for (;;) {
+
+        if (!is_active_) {
+            rc = SQLITE_MISUSE;
+            break;
+        }
+
+        RESQLITEUN_DEBUGM("State changed to inactive by end command");
+        is_active_ = false;
+        releaseCapture ();
+        suspended_.clear ();
+
+        // The size of the entry.
+        records = entry_records_;
+        qint64 bytes = entry_bytes_;
+        stats_.add (ReSqliteUnStats::Entries);
+        stats_.raise (ReSqliteUnStats::EntryRecordsMax, records);
+        stats_.raise (ReSqliteUnStats::EntryBytesMax, bytes);
+        ReSqliteUn::SqLiteResult rc_cost = saveEntryCost (records, bytes);
+
+        rc = disarmTriggers ();
+        if (rc == SQLITE_OK) {
+            rc = rc_cost;
+        }
+        if ((rc == SQLITE_OK) && precompile_) {
+            precompile ();
+        }
+        if (rc == SQLITE_OK) {
+            ChangeSet changes = changes_;
+            changes_.clear ();
+            change_index_.clear ();
+            publishChanges (ChangedByEnd, changes);
+        }
+        break;
+    }
+    stats_.addTiming (ReSqliteUnStats::EndCount, timer.nsecsElapsed ());
+    RESQLITEUN_PROBE4(end__done, dtb_, capture_id_, records, rc);
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The callback is called after each successful end(), undo and redo
+ * with the rows that changed, grouped by table; ranges of rowids that
+ * went through the same change are merged, and a table that was replaced
+ * as a whole (see suspendTable()) has a single ChangeReset range. Models
+ * can then refresh those rows instead of reading the tables again.
+ *
+ * The rows are only collected while a callback or a listener (see
+ * addChangeListener()) is set, so the capture path does not pay for
+ * them otherwise. With the `RootChanges` scope
+ * (see setCaptureScope()) rows changed by cascades and triggers are not
+ * part of the set for end(). The callback is called on the thread that
+ * changed the database (a worker thread for performUndoRedoAsync()),
+ * possibly from inside a sql function: it may read the database, but
+ * not close it.
+ *
+ * @param callback The function to call or NULL to stop the calls.
+ * @param user_data Passed to the callback as is.
+ */
+void ReSqliteUn::setChangeCallback (ChangeCallback callback, void * user_data)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    change_callback_ = callback;
+    change_data_ = user_data;
+    if (!wantsChanges ()) {
+        changes_.clear ();
+        change_index_.clear ();
+    }
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Listeners receive the same change sets as the callback (see
+ * setChangeCallback()), after it and in the order they were added, so
+ * that several parts of the application (a notifier, a debug view)
+ * can follow the changes without replacing each other. The same
+ * pair may be added more than once and is then called more than once.
+ *
+ * @param callback The function to call.
+ * @param user_data Passed to the callback as is.
+ */
+void ReSqliteUn::addChangeListener (ChangeCallback callback, void * user_data)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    ChangeListener listener;
+    listener.callback = callback;
+    listener.user_data = user_data;
+    change_listeners_.append (listener);
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Only the last listener added with the same function and user data
+ * is removed; the rows stop being collected when no callback and no
+ * listener are left.
+ *
+ * @param callback The function that was added.
+ * @param user_data The user data it was added with.
+ */
+void ReSqliteUn::removeChangeListener (
+        ChangeCallback callback, void * user_data)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    for (int i = change_listeners_.count () - 1; i >= 0; --i) {
+        const ChangeListener & listener = change_listeners_.at (i);
+        if ((listener.callback == callback) &&
+                (listener.user_data == user_data)) {
+            change_listeners_.removeAt (i);
+            break;
+        }
+    }
+    if (!wantsChanges ()) {
+        changes_.clear ();
+        change_index_.clear ();
+    }
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Ranges of the same kind that touch or overlap the last range of the
+ * table are merged into it; once a table is reset the other ranges
+ * no longer matter.
+ *
+ * @param changes The set that receives the range.
+ * @param index Maps table ids to indices in @a changes.
+ * @param table_id The id of the table.
+ * @param table The name of the table.
+ * @param first_rowid First rowid of the range.
+ * @param last_rowid Last rowid of the range.
+ * @param op What happened to the rows (see ChangeOp).
+ */
+void ReSqliteUn::addChange (
+        ChangeSet & changes, QHash<int, int> & index, int table_id,
+        const QString & table, qint64 first_rowid, qint64 last_rowid, int op)
+{
+    int i = index.value (table_id, -1);
+    if (i == -1) {
+        i = changes.count ();
+        index.insert (table_id, i);
+        TableChanges table_changes;
+        table_changes.table = table;
+        changes.append (table_changes);
+    }
+    QList<ChangedRows> & rows = changes[i].rows;
+
+    if (op == ChangeReset) {
+        rows.clear ();
+        first_rowid = -1;
+        last_rowid = -1;
+    } else if (!rows.isEmpty ()) {
+        ChangedRows & last = rows.last ();
+        if (last.op == ChangeReset) {
+            return;
+        }
+        if ((last.op == op) &&
+                (first_rowid <= last.last_rowid + 1) &&
+                (last_rowid + 1 >= last.first_rowid)) {
+            last.first_rowid = qMin (last.first_rowid, first_rowid);
+            last.last_rowid = qMax (last.last_rowid, last_rowid);
+            return;
+        }
+    }
+
+    ChangedRows range;
+    range.first_rowid = first_rowid;
+    range.last_rowid = last_rowid;
+    range.op = op;
+    rows.append (range);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param reason Why the rows changed (see ChangeReason).
+ * @param changes The rows that changed.
+ */
+void ReSqliteUn::publishChanges (int reason, const ChangeSet & changes)
+{
+    if (change_callback_ != NULL) {
+        change_callback_ (this, reason, changes, change_data_);
+    }
+    // A listener may remove itself while it is called.
+    QList<ChangeListener> listeners = change_listeners_;
+    foreach(const ChangeListener & listener, listeners) {
+        listener.callback (this, reason, changes, listener.user_data);
+    }
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The rows and tables were counted by captureRow() and snapshotTable()
+ * while the entry was open; the tables are saved as a comma-separated
+ * list of names.
+ *
+ * @param records Number of journal records of the entry.
+ * @param bytes Size of the images of the entry.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::saveEntryCost (
+        qint64 records, qint64 bytes)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn::SqLiteResult rc = SQLITE_ERROR;
+    sqlite3_stmt *stmt = NULL;
+    for (;;) {
+        QStringList names;
+        foreach(int table_id, entry_tables_) {
+            names.append (tables_.at (table_id).name);
+        }
+        names.sort ();
+
+        rc = sqlite3_prepare_v2 (
+                    dtb_,
+                    "UPDATE " RESQUN_TBL_IDX " SET "
+                        "records=?1, bytes=?2, rows=?3, tables=?4, "
+                        "finished=" SQL_NOW " "
+                    "WHERE id=?5",
+                    -1, &stmt, NULL);
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("saveEntryCost(): prepare failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+        sqlite3_bind_int64 (stmt, 1, records);
+        sqlite3_bind_int64 (stmt, 2, bytes);
+        sqlite3_bind_int64 (stmt, 3, entry_rows_);
+        bind (stmt, 4, names.join (comma));
+        sqlite3_bind_int64 (stmt, 5, capture_id_);
+        rc = sqlite3_step (stmt);
+        if (rc != SQLITE_DONE) {
+            RESQLITEUN_DEBUGM("saveEntryCost(): step failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+
+        rc = SQLITE_OK;
+        break;
+    }
+    if (stmt != NULL) {
+        sqlite3_finalize(stmt);
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * We're adding a table to the list of tables managed by the
+ * undo-redo mechanism.
+ *
+ * Volatile or derived columns (timestamps, cached aggregates) can be
+ * kept out of the update records by listing them in @a columns with
+ * @a filter set to ExcludeColumns; alternatively, list only the columns
+ * that should be tracked and use IncludeColumns.
+ *
+ * @param table The name of the table.
+ * @param update_kind How to track updates.
+ * @param columns List of columns to include or exclude (may be empty).
+ * @param filter How to interpret the @a columns list.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::attachToTable (
+        const QString & table, UpdateBehaviour update_kind,
+        const QStringList & columns, ColumnFilter filter)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    TableInfo info;
+    bool from_cache = false;
+
+    // Tables keep their id if attached again.
+    int table_id = tableId (table);
+    bool is_new = (table_id < 0);
+    if (is_new) {
+        table_id = tables_.count ();
+    }
+
+    // The triggers are only created while the instance is active;
+    // the statements are kept in utf8 as sqlite3_exec only works with
+    // utf8 (there is no 16 alternative).
+    // countTriggers() tells if the triggers exist now (is_armed_).
+    int existing = 0;
+    ReSqliteUn::SqLiteResult rc = createSchema ();
+    if (rc == SQLITE_OK) {
+        rc = countTriggers (existing);
+        RESQLITEUN_DEBUGM("attachToTable(): %d triggers exist\n", existing);
+    }
+    if (rc == SQLITE_OK) {
+        rc = cachedTableInfo (
+                    db_, table, update_kind, columns, filter,
+                    table_id, capture_scope_, info, from_cache);
+    }
+    if (rc != SQLITE_OK) {
+        qWarning() << "Failed to inspect table" << table;
+        RESQLITEUN_TRACE_EXIT;
+        return rc;
+    }
+
+    // Check the statements now rather than at next `begin`; statements
+    // that came from the cache were already checked by another connection
+    // against the same schema.
+    char * err_msg = NULL;
+    if (!from_cache || is_armed_) {
+        QByteArray statements =
+            QByteArray ("SAVEPOINT " RESQUN_SVP_BEGIN ";") +
+            (is_new ? QByteArray () : tables_.at (table_id).disarm_sql) +
+            info.arm_sql +
+            (is_armed_ ? QByteArray () : info.disarm_sql) +
+            QByteArray ("RELEASE SAVEPOINT " RESQUN_SVP_BEGIN ";");
+        rc = sqlite3_exec (
+                    dtb_,
+                    statements.constData (),
+                    NULL, NULL, &err_msg);
+    }
+    if (rc != SQLITE_OK) {
+        qWarning() << "Failed to install triggers:"
+                   << err_msg << endl
+                   << info.arm_sql;
+        sqlite3_free (err_msg);
+        sqlite3_exec (dtb_,
+            "ROLLBACK TO SAVEPOINT " RESQUN_SVP_BEGIN ";"
+            "RELEASE SAVEPOINT " RESQUN_SVP_BEGIN,
+            NULL, NULL, NULL);
+    } else if (is_new) {
+        if (!from_cache) {
+            cacheTableInfo (db_, table, columns, filter, table_id, info);
+        }
+        discardPlans ();
+        tables_.append (info);
+        table_ids_.insert (table.toLower (), table_id);
+    } else {
+        if (!from_cache) {
+            cacheTableInfo (db_, table, columns, filter, table_id, info);
+        }
+        discardPlans ();
+        tables_[table_id] = info;
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Same as calling attachToTable() for each table with no column filter,
+ * but the structure of all tables is read with a single statement
+ * (see readTablesInfo()) and the triggers of all tables are checked
+ * in a single savepoint. Either all tables are attached or none is.
+ *
+ * @param tables The names of the tables.
+ * @param update_kind How to track updates.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::attachToTables (
+        const QStringList & tables, UpdateBehaviour update_kind)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    QList<TableInfo> infos;
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    if (!tables.isEmpty ()) {
+        rc = createSchema ();
+        if (rc == SQLITE_OK) {
+            rc = readTablesInfo (db_, tables, QString (), update_kind, infos);
+        }
+        if (rc == SQLITE_OK) {
+            rc = installTables (infos);
+        } else {
+            qWarning() << "Failed to inspect tables" << tables;
+        }
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Attaches all the tables whose names match the `LIKE` @a pattern
+ * (`%` attaches every table in the database) in the way
+ * attachToTables() does.
+ *
+ * @param pattern The pattern for the names of the tables.
+ * @param update_kind How to track updates.
+ * @param count Receives the number of tables that were attached.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::attachMatchingTables (
+        const QString & pattern, UpdateBehaviour update_kind, int * count)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    QList<TableInfo> infos;
+    ReSqliteUn::SqLiteResult rc = createSchema ();
+    if (rc == SQLITE_OK) {
+        rc = readTablesInfo (
+                    db_, QStringList (), pattern, update_kind, infos);
+    }
+    if (rc == SQLITE_OK) {
+        rc = installTables (infos);
+    } else {
+        qWarning() << "Failed to inspect tables matching" << pattern;
+    }
+    if (count != NULL) {
+        *count = (rc == SQLITE_OK ? infos.count () : 0);
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The triggers for all tables are generated, then created (and dropped
+ * again if the instance is not armed) by a single script inside
+ * a savepoint; the tables are only added to the instance if the script
+ * succeeds.
+ *
+ * @param infos The structure of the tables; the triggers are filled in.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::installTables (QList<TableInfo> & infos)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    int existing = 0;
+    ReSqliteUn::SqLiteResult rc = countTriggers (existing);
+    if (rc != SQLITE_OK) {
+        RESQLITEUN_TRACE_EXIT;
+        return rc;
+    }
+    RESQLITEUN_DEBUGM("installTables(): %d triggers exist\n", existing);
+
+    QList<int> ids;
+    QByteArray statements ("SAVEPOINT " RESQUN_SVP_BEGIN ";");
+    int next_id = tables_.count ();
+    for (int i = 0; i < infos.count (); ++i) {
+        TableInfo & info = infos[i];
+
+        // Tables keep their id if attached again.
+        int table_id = tableId (info.name);
+        if (table_id < 0) {
+            table_id = next_id++;
+        } else {
+            statements.append (tables_.at (table_id).disarm_sql);
+        }
+        ids.append (table_id);
+
+        info.scope = capture_scope_;
+        info.arm_sql = sqlTriggers (info, table_id, capture_scope_).toUtf8 ();
+        info.disarm_sql = sqlDropTriggers (info).toUtf8 ();
+        statements.append (info.arm_sql);
+        if (!is_armed_) {
+            statements.append (info.disarm_sql);
+        }
+    }
+    statements.append ("RELEASE SAVEPOINT " RESQUN_SVP_BEGIN ";");
+
+    char * err_msg = NULL;
+    rc = sqlite3_exec (
+                dtb_,
+                statements.constData (),
+                NULL, NULL, &err_msg);
+    if (rc != SQLITE_OK) {
+        qWarning() << "Failed to install triggers:" << err_msg;
+        sqlite3_free (err_msg);
+        sqlite3_exec (dtb_,
+            "ROLLBACK TO SAVEPOINT " RESQUN_SVP_BEGIN ";"
+            "RELEASE SAVEPOINT " RESQUN_SVP_BEGIN,
+            NULL, NULL, NULL);
+    } else {
+        discardPlans ();
+        for (int i = 0; i < infos.count (); ++i) {
+            const TableInfo & info = infos.at (i);
+            int table_id = ids.at (i);
+            cacheTableInfo (
+                        db_, info.name, QStringList (), ExcludeColumns,
+                        table_id, info);
+            if (table_id < tables_.count ()) {
+                tables_[table_id] = info;
+            } else {
+                tables_.append (info);
+                table_ids_.insert (info.name.toLower (), table_id);
+            }
+        }
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The triggers of a table list its columns, so a column added by
+ * `ALTER TABLE` after the table was attached would not be recorded.
+ * This is called by begin(), before the triggers are created, and by
+ * openReplay(). The check is a single `PRAGMA schema_version`; only if the
+ * schema changed since the last call are the definitions of the attached
+ * tables compared with the ones they were attached with. Tables that
+ * changed are read again with the arguments they were attached with and
+ * keep their id; their shadow tables follow (see refreshShadow()) and
+ * the images in the journal get the new indices of the columns (see
+ * remapJournal()). If the change can not be followed (see matchColumns())
+ * the entries that changed the table are dropped (see dropHistory()).
+ *
+ * Only changes in the main database are detected; tables in the
+ * temporary schema or in attached databases keep their triggers.
+ *
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::refreshTables ()
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    sqlite3_stmt *stmt = NULL;
+    for (;;) {
+        rc = sqlite3_prepare_v2 (
+                    dtb_, "PRAGMA main.schema_version", -1, &stmt, NULL);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+        rc = sqlite3_step (stmt);
+        if (rc != SQLITE_ROW) {
+            break;
+        }
+        int schema_version = sqlite3_column_int (stmt, 0);
+        rc = SQLITE_OK;
+        if (schema_version == schema_version_) {
+            break;
+        }
+
+        for (int table_id = 0; table_id < tables_.count (); ++table_id) {
+            const TableInfo & info = tables_.at (table_id);
+            QString definition;
+            rc = readDefinition (db_, info.name, definition);
+            if (rc != SQLITE_OK) {
+                break;
+            }
+            if (info.definition.isEmpty () ||
+                    (definition == info.definition)) {
+                continue;
+            }
+
+            RESQLITEUN_DEBUGM("Structure of table %s changed",
+                              info.name.toUtf8 ().constData ());
+            TableInfo fresh;
+            rc = readTableInfo (
+                        db_, info.name, info.update_kind,
+                        QStringList (), info.filter, fresh);
+            if (rc != SQLITE_OK) {
+                qWarning() << "Failed to inspect table" << info.name;
+                break;
+            }
+
+            // The column filter follows the columns that were renamed.
+            QList<int> moved;
+            bool known = matchColumns (info.columns, fresh.columns, moved);
+            QStringList filter_columns;
+            foreach(const QString & column, info.filter_columns) {
+                int index = columnIndex (info.columns, column);
+                index = (index < 0 ? -1 : moved.at (index));
+                filter_columns.append (
+                            index < 0 ? column : fresh.columns.at (index));
+            }
+
+            bool from_cache;
+            rc = cachedTableInfo (
+                        db_, info.name, info.update_kind,
+                        filter_columns, info.filter,
+                        table_id, info.scope, fresh, from_cache);
+            if (rc == SQLITE_OK) {
+                rc = refreshShadow (table_id, fresh.columns, moved);
+            }
+            if (rc == SQLITE_OK) {
+                if (known) {
+                    rc = remapJournal (table_id, moved);
+                } else {
+                    qWarning() << "Cannot follow the columns of table"
+                               << info.name << "; its history is dropped";
+                    rc = dropHistory (table_id);
+                }
+            }
+            if (rc != SQLITE_OK) {
+                qWarning() << "Failed to inspect table" << info.name;
+                break;
+            }
+            tables_[table_id] = fresh;
+            discardPlans ();
+        }
+        if (rc == SQLITE_OK) {
+            schema_version_ = schema_version;
+        }
+        break;
+    }
+    sqlite3_finalize (stmt);
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Rows are copied in the shadow table with `SELECT ...,*` so its columns
+ * must follow the ones of the table. If the shadow table exists, the
+ * columns that were dropped from the table are dropped from it, the ones
+ * that were renamed are renamed (the values they hold are kept) and the
+ * ones that were added are added (the rows that are already there
+ * get NULL).
+ *
+ * @param table_id The id of the table (index in tables_, which still
+ * holds the old structure).
+ * @param columns The current columns of the table.
+ * @param moved The new index of each old column (see matchColumns()).
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::refreshShadow (
+        int table_id, const QStringList & columns, const QList<int> & moved)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    sqlite3_stmt *stmt = NULL;
+    for (;;) {
+        const TableInfo & info = tables_.at (table_id);
+        QString shadow = shadowName (info.name);
+
+        QString statement = QString("PRAGMA temp.table_info(") %
+                shadow % QString(");");
+        rc = sqlite3_prepare16_v2 (
+                    dtb_, statement.utf16 (),
+                    statement.size () * sizeof(QChar), &stmt, NULL);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+
+        // The shadow table is changed the way the table was (columns are
+        // never moved) and is not built again, as tables cannot be
+        // dropped while the statement that called us runs.
+        QStringList old_columns;
+        while ((rc = sqlite3_step (stmt)) == SQLITE_ROW) {
+            old_columns.append (columnText (stmt, 1));
+        }
+        sqlite3_finalize (stmt);
+        stmt = NULL;
+        if (rc != SQLITE_DONE) {
+            break;
+        }
+        rc = SQLITE_OK;
+        if (old_columns.isEmpty ()) {
+            // There is no shadow table.
+            break;
+        }
+
+        QString drops;
+        QString renames;
+        QStringList kept;
+        for (int i = 2; i < old_columns.count (); ++i) {
+            const QString & column = old_columns.at (i);
+            int index = columnIndex (info.columns, column);
+            index = (index < 0 ? -1 : moved.at (index));
+            if (index < 0) {
+                drops.append (
+                            QString("ALTER TABLE temp.") % shadow %
+                            QString(" DROP COLUMN ") % column %
+                            QString(";"));
+                continue;
+            }
+            const QString & name = columns.at (index);
+            if (name != column) {
+                renames.append (
+                            QString("ALTER TABLE temp.") % shadow %
+                            QString(" RENAME COLUMN ") % column %
+                            QString(" TO ") % name % QString(";"));
+            }
+            kept.append (name);
+        }
+        statement = drops % renames;
+
+        // The columns that remain are in table order unless the change
+        // could not be told apart (see matchColumns()); from the first
+        // one that is out of place they are dropped and added again.
+        int in_place = 0;
+        while ((in_place < kept.count ()) &&
+               (in_place < columns.count ()) &&
+               (kept.at (in_place).compare (
+                    columns.at (in_place), Qt::CaseInsensitive) == 0)) {
+            ++in_place;
+        }
+        for (int i = in_place; i < kept.count (); ++i) {
+            statement.append (
+                        QString("ALTER TABLE temp.") % shadow %
+                        QString(" DROP COLUMN ") % kept.at (i) %
+                        QString(";"));
+        }
+        for (int i = in_place; i < columns.count (); ++i) {
+            statement.append (
+                        QString("ALTER TABLE temp.") % shadow %
+                        QString(" ADD COLUMN ") % columns.at (i) %
+                        QString(";"));
+        }
+        if (statement.isEmpty ()) {
+            break;
+        }
+        rc = sqlite3_exec (
+                    dtb_, statement.toUtf8 ().constData (), NULL, NULL, NULL);
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("refreshShadow(): exec failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+        }
+        break;
+    }
+    sqlite3_finalize (stmt);
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The images in the journal name the columns by their index, so the
+ * images of a table whose columns were dropped are rewritten with the
+ * new indices (see ReSqliteUnRecord::remap()); the values of dropped
+ * columns are left out. Records with no image (inserts and snapshots)
+ * are not touched and nothing is done if no column moved.
+ *
+ * @param table_id The id of the table.
+ * @param moved The new index of each old column (see matchColumns()).
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::remapJournal (
+        int table_id, const QList<int> & moved)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    sqlite3_stmt *stmt_read = NULL;
+    sqlite3_stmt *stmt_write = NULL;
+    for (;;) {
+        bool same = true;
+        for (int i = 0; i < moved.count (); ++i) {
+            if (moved.at (i) != i) {
+                same = false;
+                break;
+            }
+        }
+        if (same) {
+            break;
+        }
+
+        rc = sqlite3_prepare_v2 (
+                    dtb_,
+                    "SELECT id, data, redo FROM " RESQUN_TBL_TEMP " "
+                    "WHERE tbl=?1 COLLATE NOCASE "
+                    "AND (data IS NOT NULL OR redo IS NOT NULL)",
+                    -1, &stmt_read, NULL);
+        if (rc == SQLITE_OK) {
+            rc = sqlite3_prepare_v2 (
+                        dtb_,
+                        "UPDATE " RESQUN_TBL_TEMP " "
+                        "SET data=?2, redo=?3 WHERE id=?1",
+                        -1, &stmt_write, NULL);
+        }
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("remapJournal(): prepare failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+        bind (stmt_read, 1, tables_.at (table_id).name);
+
+        // All images are read first; the journal is then changed.
+        QList<qint64> ids;
+        QList<QByteArray> images;
+        QList<QByteArray> redo_images;
+        while ((rc = sqlite3_step (stmt_read)) == SQLITE_ROW) {
+            ids.append (sqlite3_column_int64 (stmt_read, 0));
+            images.append (ReSqliteUnRecord::remap (QByteArray (
+                        static_cast<const char *>(
+                            sqlite3_column_blob (stmt_read, 1)),
+                        sqlite3_column_bytes (stmt_read, 1)), moved));
+            redo_images.append (ReSqliteUnRecord::remap (QByteArray (
+                        static_cast<const char *>(
+                            sqlite3_column_blob (stmt_read, 2)),
+                        sqlite3_column_bytes (stmt_read, 2)), moved));
+        }
+        if (rc != SQLITE_DONE) {
+            break;
+        }
+        rc = SQLITE_OK;
+
+        for (int i = 0; i < ids.count (); ++i) {
+            sqlite3_bind_int64 (stmt_write, 1, ids.at (i));
+            for (int k = 0; k < 2; ++k) {
+                const QByteArray & image =
+                        (k == 0 ? images.at (i) : redo_images.at (i));
+                if (image.isEmpty ()) {
+                    sqlite3_bind_null (stmt_write, k + 2);
+                } else {
+                    sqlite3_bind_blob (
+                                stmt_write, k + 2, image.constData (),
+                                image.size (), SQLITE_STATIC);
+                }
+            }
+            rc = sqlite3_step (stmt_write);
+            sqlite3_reset (stmt_write);
+            if (rc != SQLITE_DONE) {
+                break;
+            }
+            rc = SQLITE_OK;
+        }
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("remapJournal(): update failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+        }
+        break;
+    }
+    sqlite3_finalize (stmt_read);
+    sqlite3_finalize (stmt_write);
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Used when the images of a table can not be mapped to its new columns.
+ * The undo entries up to the last one that changed the table and the redo
+ * entries from the first one that changed it on are removed, so
+ * that the entries that remain can still be undone and redone in order.
+ *
+ * @param table_id The id of the table.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::dropHistory (int table_id)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    sqlite3_stmt *stmt = NULL;
+    for (;;) {
+        rc = sqlite3_prepare_v2 (
+                    dtb_,
+                    "SELECT "
+                        "(SELECT max(j.idxid) FROM " RESQUN_TBL_TEMP " AS j "
+                            "JOIN " RESQUN_TBL_IDX " AS i ON i.id=j.idxid "
+                            "WHERE j.tbl=?1 COLLATE NOCASE "
+                            "AND i.status=" STR(RESQUN_MARK_UNDO) "), "
+                        "(SELECT min(j.idxid) FROM " RESQUN_TBL_TEMP " AS j "
+                            "JOIN " RESQUN_TBL_IDX " AS i ON i.id=j.idxid "
+                            "WHERE j.tbl=?1 COLLATE NOCASE "
+                            "AND i.status=" STR(RESQUN_MARK_REDO) ")",
+                    -1, &stmt, NULL);
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("dropHistory(): prepare failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+        bind (stmt, 1, tables_.at (table_id).name);
+        rc = sqlite3_step (stmt);
+        if (rc != SQLITE_ROW) {
+            break;
+        }
+        qint64 last_undo = sqlite3_column_type (stmt, 0) == SQLITE_NULL ?
+                    0 : sqlite3_column_int64 (stmt, 0);
+        qint64 first_redo = sqlite3_column_type (stmt, 1) == SQLITE_NULL ?
+                    0 : sqlite3_column_int64 (stmt, 1);
+
+        QString condition = QString(
+                "(status=" STR(RESQUN_MARK_UNDO) " AND id<=%1) OR "
+                "(status=" STR(RESQUN_MARK_REDO) " AND id>=%2 AND %2>0)")
+                .arg (last_undo).arg (first_redo);
+        QString statements =
+                QString("DELETE FROM " RESQUN_TBL_TEMP " WHERE idxid IN ("
+                        "SELECT id FROM " RESQUN_TBL_IDX " WHERE ") %
+                condition % QString(");"
+                "DELETE FROM " RESQUN_TBL_IDX " WHERE ") % condition %
+                QString(";");
+        rc = sqlite3_exec (
+                    dtb_, statements.toUtf8 ().constData (), NULL, NULL, NULL);
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("dropHistory(): exec failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+        }
+        break;
+    }
+    sqlite3_finalize (stmt);
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param table The name of the table (case is not important).
+ * @return the id or -1 if the table was not attached
+ */
+int ReSqliteUn::tableId (const QString & table) const
+{
+    return table_ids_.value (table.toLower (), -1);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Bulk replacements of the content of a table (`DELETE FROM t` followed by
+ * `INSERT INTO t SELECT ...`) would write a record for each row that
+ * is removed and for each row that is inserted. Instead, the table may be
+ * suspended before such an operation: its content is copied in a shadow
+ * table with a single statement (see snapshotTable()) and its triggers are
+ * dropped until resumeTable() or end() is called. Other tables continue to
+ * be tracked row by row.
+ *
+ * Undoing the entry restores the content of the table from the snapshot
+ * (see restoreTable()).
+ *
+ * Suspending a table that is already suspended does nothing.
+ *
+ * @param table The name of the table.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::suspendTable (const QString & table)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    for (;;) {
+        int table_id = tableId (table);
+        if (!is_active_ || (table_id < 0)) {
+            rc = SQLITE_MISUSE;
+            break;
+        }
+        if (suspended_.contains (table_id)) {
+            break;
+        }
+
+        rc = snapshotTable (table_id);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+
+        rc = sqlite3_exec (
+                    dtb_, tables_.at (table_id).disarm_sql.constData (),
+                    NULL, NULL, NULL);
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("suspendTable(): exec failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+        suspended_.insert (table_id);
+        break;
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Changes made after this call are recorded row by row, as usual.
+ * Resuming a table that is not suspended does nothing.
+ *
+ * @param table The name of the table.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::resumeTable (const QString & table)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    for (;;) {
+        int table_id = tableId (table);
+        if (!is_active_ || (table_id < 0)) {
+            rc = SQLITE_MISUSE;
+            break;
+        }
+        if (!suspended_.contains (table_id)) {
+            break;
+        }
+
+        rc = sqlite3_exec (
+                    dtb_, tables_.at (table_id).arm_sql.constData (),
+                    NULL, NULL, NULL);
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("resumeTable(): exec failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+        suspended_.remove (table_id);
+        break;
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Each attached table that needs one gets a shadow table
+ * (`resqun_shadow_Test` for `Test`) with the same columns, prefixed by
+ * a key and by the rowid. The key is the id of the journal record that
+ * owns the rows: a positive key is used for the content needed by undo and
+ * a negative one for the content needed by redo.
+ *
+ * A trigger on the journal removes the rows of a record when
+ * the record is deleted.
+ *
+ * @param table_id The id of the table (index in tables_).
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::createShadow (int table_id)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    const TableInfo & info = tables_.at (table_id);
+    QString shadow = shadowName (info.name);
+
+    QString statements =
+            QString("CREATE TEMP TABLE IF NOT EXISTS ") % shadow %
+            QString(" AS SELECT 0 AS resqun_snap,rowid AS resqun_rowid,* "
+                    "FROM ") % quotedName (info.name) % QString(" WHERE 0;"
+            "CREATE INDEX IF NOT EXISTS temp.") % shadowName (info.name, "_idx") %
+            QString(" ON ") % shadow % QString("(resqun_snap,resqun_rowid);"
+            "CREATE TEMP TRIGGER IF NOT EXISTS ") % shadowName (info.name, "_d") %
+            QString(" AFTER DELETE ON " RESQUN_TBL_TEMP " "
+            "WHEN OLD.op IN (" STR(RESQUN_KIND_INSERT) ","
+                STR(RESQUN_KIND_SNAPSHOT) ") AND OLD.tbl=") %
+            quotedText (info.name) % QString(" BEGIN DELETE FROM ") % shadow %
+            QString(" WHERE resqun_snap IN (OLD.id,-OLD.id); END;");
+    ReSqliteUn::SqLiteResult rc = sqlite3_exec (
+                dtb_, statements.toUtf8 ().constData (),
+                NULL, NULL, NULL);
+    if (rc != SQLITE_OK) {
+        RESQLITEUN_DEBUGM("createShadow(): exec failed: %s\n",
+                          sqlite3_errmsg(dtb_));
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The content of the table is copied in its shadow table (see
+ * createShadow()) with a single statement:
+ *
+ * @code
+ * INSERT INTO resqun_shadow_Test SELECT 12,rowid,* FROM Test;
+ * @endcode
+ *
+ * where `12` is the id of the SnapshotKind record (with no image)
+ * that is added to the journal.
+ *
+ * @param table_id The id of the table (index in tables_).
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::snapshotTable (int table_id)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    sqlite3_stmt *stmt = NULL;
+    for (;;) {
+        const TableInfo & info = tables_.at (table_id);
+
+        rc = createShadow (table_id);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+
+        // The record in the journal.
+        rc = sqlite3_prepare_v2 (
+                    dtb_,
+                    "INSERT INTO " RESQUN_TBL_TEMP "(idxid,op,tbl) "
+                    "VALUES(?," STR(RESQUN_KIND_SNAPSHOT) ",?)",
+                    -1, &stmt, NULL);
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("snapshotTable(): prepare failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+        sqlite3_bind_int64 (stmt, 1, capture_id_);
+        bind (stmt, 2, info.name);
+        rc = sqlite3_step (stmt);
+        if (rc != SQLITE_DONE) {
+            RESQLITEUN_DEBUGM("snapshotTable(): step failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+        qint64 snapshot_id = sqlite3_last_insert_rowid (dtb_);
+
+        // The content of the table.
+        RESQLITEUN_TRACE_SPAN("snapshot.copy");
+        QString statements =
+                QString("INSERT INTO ") % shadowName (info.name) %
+                QString(" SELECT ") % QString::number (snapshot_id) %
+                QString(",rowid,* FROM ") % info.name;
+        rc = sqlite3_exec (
+                    dtb_, statements.toUtf8 ().constData (),
+                    NULL, NULL, NULL);
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("snapshotTable(): copy failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+
+        // Undo puts back every row that was copied.
+        ++entry_records_;
+        entry_rows_ += sqlite3_changes (dtb_);
+        entry_tables_.insert (table_id);
+        if (wantsChanges ()) {
+            addChange (changes_, change_index_, table_id, info.name,
+                       0, 0, ChangeReset);
+        }
+
+        // Inserts that follow can't extend a record written before this one.
+        last_record_ = -1;
+        stats_.add (ReSqliteUnStats::Snapshots);
+        stats_.add (ReSqliteUnStats::JournalRecords);
+        break;
+    }
+    if (stmt != NULL) {
+        sqlite3_finalize(stmt);
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * When @a save_key is not 0 the current content of the table is first
+ * copied in the shadow table under that key (replacing whatever was
+ * saved there before), so that the operation can be reverted later.
+ *
+ * The content is swapped with the triggers and the foreign keys of
+ * the connection turned off: removing the rows must not cascade to other
+ * tables (or to user triggers), as the rows come right back.
+ *
+ * @param table_id The id of the table (index in tables_).
+ * @param restore_key The key of the rows to restore.
+ * @param save_key The key for current content or 0 to discard it.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::restoreTable (
+        int table_id, qint64 restore_key, qint64 save_key)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    const TableInfo & info = tables_.at (table_id);
+    QString shadow = shadowName (info.name);
+
+    QString statements;
+    if (save_key != 0) {
+        statements = QString("DELETE FROM ") % shadow %
+                QString(" WHERE resqun_snap=") % QString::number (save_key) %
+                QString(";INSERT INTO ") % shadow % QString(" SELECT ") %
+                QString::number (save_key) %
+                QString(",rowid,* FROM ") % info.name % QString(";");
+    }
+
+    QString columns = info.columns.join (comma);
+    statements.append (
+            QString("DELETE FROM ") % info.name % QString(";"
+            "INSERT INTO ") % info.name % QString("(rowid,") % columns %
+            QString(") SELECT resqun_rowid,") % columns %
+            QString(" FROM ") % shadow %
+            QString(" WHERE resqun_snap=") % QString::number (restore_key) %
+            QString(";"));
+
+    int had_triggers = switchFlag (dtb_, SQLITE_DBCONFIG_ENABLE_TRIGGER, 0);
+    int had_fkeys = switchFlag (dtb_, SQLITE_DBCONFIG_ENABLE_FKEY, 0);
+    ReSqliteUn::SqLiteResult rc = sqlite3_exec (
+                dtb_, statements.toUtf8 ().constData (), NULL, NULL, NULL);
+    if (rc != SQLITE_OK) {
+        RESQLITEUN_DEBUGM("restoreTable(): exec failed: %s\n",
+                          sqlite3_errmsg(dtb_));
+    }
+    switchFlag (dtb_, SQLITE_DBCONFIG_ENABLE_TRIGGER, had_triggers);
+    switchFlag (dtb_, SQLITE_DBCONFIG_ENABLE_FKEY, had_fkeys);
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * This is called by the triggers (through `resqun_row`) for each row
+ * that changes while the instance is active. The values arrive straight
+ * from the trigger (`OLD.column`, `NEW.column`) and are serialized into
+ * the journal record in a single pass (see ReSqliteUnRecord); this replaces
+ * the chain of `quote()` and concatenations that used to build the undo
+ * statement inside the trigger.
+ *
+ * Each record keeps what is needed in both directions: updates store
+ * the old values (the undo image) and the new ones (the redo image),
+ * deletions store the whole row (redo only needs the rowid).
+ *
+ * Inserts only store the rowid; the inserted values are copied in the
+ * shadow table of the table by the undo (see buildPlan()). If the last
+ * record written is an insert in the same table that ends right before
+ * this row that record is extended instead of creating a new one, so
+ * a bulk insert results in a single record covering a range of rowids.
+ *
+ * The statements used here are prepared on first use and kept until
+ * releaseCapture() is called by end().
+ *
+ * sqlite limits the number of arguments of a function, so the triggers
+ * of wide tables pass the first values through `resqun_part` (see
+ * capturePart()); these are put in front of the values given here.
+ *
+ * @param table_id The id of the table (index in tables_).
+ * @param kind The kind of the record (see ReSqliteUnRecord::Kind).
+ * @param rowid The rowid of the row.
+ * @param value_count Number of values.
+ * @param values The values as `sqlite3_value *`: all columns for deletions,
+ * the old then the new values of the tracked columns for updates, the index
+ * of the column followed by the old and the new value for single column
+ * updates and nothing for inserts.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::captureRow (
+        int table_id, int kind, qint64 rowid,
+        int value_count, void ** values)
+{
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    QVector<void *> all_values;
+    if (!part_values_.isEmpty ()) {
+        all_values.reserve (part_values_.count () + value_count);
+        foreach(void * value, part_values_) {
+            all_values.append (value);
+        }
+        for (int i = 0; i < value_count; ++i) {
+            all_values.append (values[i]);
+        }
+        value_count = all_values.count ();
+        values = all_values.data ();
+    }
+    sqlite3_value ** argv = reinterpret_cast<sqlite3_value **>(values);
+    for (;;) {
+        if ((table_id < 0) || (table_id >= tables_.count ())) {
+            rc = SQLITE_MISUSE;
+            break;
+        }
+
+        // The triggers come back if the transaction that dropped them
+        // is rolled back; the rows they report belong to no entry.
+        if (!is_active_) {
+            break;
+        }
+        const TableInfo & info = tables_.at (table_id);
+
+        if (stmt_capture_ == NULL) {
+            RESQLITEUN_TRACE_SPAN("capture.prepare");
+            rc = sqlite3_prepare_v2 (
+                        dtb_,
+                        "INSERT INTO " RESQUN_TBL_TEMP
+                        "(idxid,op,tbl,firstid,lastid,data,redo) "
+                        "VALUES(?,?,?,?,?,?,?)",
+                        -1, reinterpret_cast<sqlite3_stmt **>(&stmt_capture_),
+                        NULL);
+            if (rc != SQLITE_OK) {
+                RESQLITEUN_DEBUGM("captureRow(): prepare failed: %s\n",
+                                  sqlite3_errmsg(dtb_));
+                break;
+            }
+            rc = sqlite3_prepare_v2 (
+                        dtb_,
+                        "UPDATE " RESQUN_TBL_TEMP " SET lastid=?1 "
+                        "WHERE id=?2 AND lastid=?1-1 "
+                        "AND op=" STR(RESQUN_KIND_INSERT),
+                        -1, reinterpret_cast<sqlite3_stmt **>(&stmt_extend_),
+                        NULL);
+            if (rc != SQLITE_OK) {
+                RESQLITEUN_DEBUGM("captureRow(): prepare failed: %s\n",
+                                  sqlite3_errmsg(dtb_));
+                break;
+            }
+        }
+
+        // Extend the range of the last insert record if possible.
+        if ((kind == ReSqliteUnRecord::InsertKind) &&
+                (last_record_ > 0) && (last_table_ == table_id) &&
+                (last_rowid_ + 1 == rowid)) {
+            RESQLITEUN_TRACE_SPAN("capture.extend");
+            sqlite3_stmt * stmt = static_cast<sqlite3_stmt *>(stmt_extend_);
+            sqlite3_bind_int64 (stmt, 1, rowid);
+            sqlite3_bind_int64 (stmt, 2, last_record_);
+            rc = sqlite3_step (stmt);
+            sqlite3_reset (stmt);
+            // The record may be gone if the user rolled back a savepoint.
+            if ((rc == SQLITE_DONE) && (sqlite3_changes (dtb_) == 1)) {
+                last_rowid_ = rowid;
+                ++entry_rows_;
+                stats_.addRow (table_id, kind, 0);
+                if (wantsChanges ()) {
+                    addChange (changes_, change_index_, table_id, info.name,
+                               rowid, rowid, changeOp (kind, false));
+                }
+                RESQLITEUN_PROBE5(capture, dtb_, table_id, kind, rowid, 0);
+                rc = SQLITE_OK;
+                break;
+            }
+        }
+
+        // Serialize the values.
+        QByteArray image;
+        QByteArray redo_image;
+        switch (kind) {
+        case ReSqliteUnRecord::InsertKind: {
+            break; }
+        case ReSqliteUnRecord::DeleteKind: {
+            if (value_count != info.columns.count ()) {
+                rc = SQLITE_MISUSE;
+                break;
+            }
+            for (int i = 0; i < value_count; ++i) {
+                ReSqliteUnRecord::encode (image, i, argv[i]);
+            }
+            break; }
+        case ReSqliteUnRecord::UpdateKind: {
+            int tracked = info.tracked.count ();
+            if (value_count != 2 * tracked) {
+                rc = SQLITE_MISUSE;
+                break;
+            }
+            for (int i = 0; i < tracked; ++i) {
+                ReSqliteUnRecord::encode (
+                            image, info.tracked.at (i), argv[i]);
+                ReSqliteUnRecord::encode (
+                            redo_image, info.tracked.at (i), argv[tracked + i]);
+            }
+            break; }
+        case ReSqliteUnRecord::UpdateColumnKind: {
+            if (value_count != 3) {
+                rc = SQLITE_MISUSE;
+                break;
+            }
+            ReSqliteUnRecord::encode (
+                        image, sqlite3_value_int (argv[0]), argv[1]);
+            ReSqliteUnRecord::encode (
+                        redo_image, sqlite3_value_int (argv[0]), argv[2]);
+            break; }
+        default: {
+            rc = SQLITE_MISUSE;
+            break; }
+        }
+        if (rc != SQLITE_OK) {
+            break;
+        }
+
+        RESQLITEUN_TRACE_SPAN("capture.insert");
+        sqlite3_stmt * stmt = static_cast<sqlite3_stmt *>(stmt_capture_);
+        sqlite3_bind_int64 (stmt, 1, capture_id_);
+        sqlite3_bind_int (stmt, 2, kind);
+        bind (stmt, 3, info.name);
+        sqlite3_bind_int64 (stmt, 4, rowid);
+        sqlite3_bind_int64 (stmt, 5, rowid);
+        if (image.isEmpty ()) {
+            sqlite3_bind_null (stmt, 6);
+        } else {
+            sqlite3_bind_blob (
+                        stmt, 6, image.constData (), image.size (),
+                        SQLITE_STATIC);
+        }
+        if (redo_image.isEmpty ()) {
+            sqlite3_bind_null (stmt, 7);
+        } else {
+            sqlite3_bind_blob (
+                        stmt, 7, redo_image.constData (), redo_image.size (),
+                        SQLITE_STATIC);
+        }
+        rc = sqlite3_step (stmt);
+        sqlite3_reset (stmt);
+        if (rc != SQLITE_DONE) {
+            RESQLITEUN_DEBUGM("captureRow(): step failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+
+        if (kind == ReSqliteUnRecord::InsertKind) {
+            last_record_ = sqlite3_last_insert_rowid (dtb_);
+            last_table_ = table_id;
+            last_rowid_ = rowid;
+        } else {
+            last_record_ = -1;
+        }
+        ++entry_records_;
+        entry_bytes_ += image.size () + redo_image.size ();
+        ++entry_rows_;
+        entry_tables_.insert (table_id);
+        if (wantsChanges ()) {
+            addChange (changes_, change_index_, table_id, info.name,
+                       rowid, rowid, changeOp (kind, false));
+        }
+        stats_.add (ReSqliteUnStats::JournalRecords);
+        stats_.addRow (table_id, kind, image.size () + redo_image.size ());
+        RESQLITEUN_PROBE5(capture, dtb_, table_id, kind, rowid,
+                          image.size () + redo_image.size ());
+
+        rc = SQLITE_OK;
+        break;
+    }
+    releaseParts ();
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * sqlite allows 127 arguments to a function unless it was built with
+ * a larger `SQLITE_MAX_FUNCTION_ARG`, which is less than the values of
+ * a row of a wide table. The triggers of such tables call `resqun_part`
+ * with the first values before calling `resqun_row` with the rest;
+ * the values are copied here until captureRow() takes them.
+ *
+ * @param value_count Number of values.
+ * @param values The values as `sqlite3_value *`.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::capturePart (
+        int value_count, void ** values)
+{
+    sqlite3_value ** argv = reinterpret_cast<sqlite3_value **>(values);
+    for (int i = 0; i < value_count; ++i) {
+        sqlite3_value * value = sqlite3_value_dup (argv[i]);
+        if (value == NULL) {
+            releaseParts ();
+            return SQLITE_NOMEM;
+        }
+        part_values_.append (value);
+    }
+    return SQLITE_OK;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The triggers of the attached tables only exist while the instance
+ * is active (between `begin` and `end` and while an undo or redo is
+ * replayed). Outside of these the tracked tables carry no triggers at all,
+ * so changes that are not recorded have the same cost as changes made to
+ * a table that was never attached.
+ *
+ * The price is paid once per entry: creating and dropping the triggers
+ * changes the schema of the `temp` database, so the statements prepared
+ * before that are prepared again by sqlite on their next use.
+ *
+ * Triggers that are still there (the transaction that dropped them
+ * was rolled back) are dropped and created again.
+ *
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::armTriggers ()
+{
+    RESQLITEUN_TRACE_ENTRY;
+    int existing = 0;
+    ReSqliteUn::SqLiteResult rc = countTriggers (existing);
+    if (rc == SQLITE_OK) {
+        RESQLITEUN_DEBUGM("armTriggers(): %d triggers exist\n", existing);
+        QByteArray statements;
+        foreach(const TableInfo & info, tables_) {
+            if (existing > 0) {
+                statements.append (info.disarm_sql);
+            }
+            statements.append (info.arm_sql);
+        }
+        if (!statements.isEmpty ()) {
+            rc = sqlite3_exec (
+                        dtb_, statements.constData (), NULL, NULL, NULL);
+        }
+        if (rc == SQLITE_OK) {
+            is_armed_ = true;
+        } else {
+            RESQLITEUN_DEBUGM("armTriggers(): exec failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+        }
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Nothing is done if the triggers are already gone (the transaction that
+ * created them was rolled back).
+ *
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::disarmTriggers ()
+{
+    RESQLITEUN_TRACE_ENTRY;
+    int existing = 0;
+    ReSqliteUn::SqLiteResult rc = countTriggers (existing);
+    if ((rc == SQLITE_OK) && (existing > 0)) {
+        RESQLITEUN_DEBUGM("disarmTriggers(): %d triggers exist\n", existing);
+        QByteArray statements;
+        foreach(const TableInfo & info, tables_) {
+            statements.append (info.disarm_sql);
+        }
+        if (!statements.isEmpty ()) {
+            rc = sqlite3_exec (
+                        dtb_, statements.constData (), NULL, NULL, NULL);
+        }
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("disarmTriggers(): exec failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+        }
+    }
+    if (rc == SQLITE_OK) {
+        is_armed_ = false;
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * is_armed_ only tells what the instance did last; a transaction
+ * that is rolled back takes the triggers it created or dropped along,
+ * so the schema of the `temp` database is the one to ask. The flag is
+ * updated with the answer.
+ *
+ * @param count Receives the number of triggers.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::countTriggers (int & count)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    count = 0;
+    sqlite3_stmt *stmt = NULL;
+    ReSqliteUn::SqLiteResult rc = sqlite3_prepare_v2 (
+                dtb_,
+                "SELECT count(*) FROM sqlite_temp_master "
+                "WHERE type='trigger' AND name GLOB '" RESQUN_PREFIX "*'",
+                -1, &stmt, NULL);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_step (stmt);
+        if (rc == SQLITE_ROW) {
+            count = sqlite3_column_int (stmt, 0);
+            is_armed_ = (count > 0);
+            rc = SQLITE_OK;
+        }
+    }
+    if (rc != SQLITE_OK) {
+        RESQLITEUN_DEBUGM("countTriggers(): failed: %s\n",
+                          sqlite3_errmsg(dtb_));
+    }
+    if (stmt != NULL) {
+        sqlite3_finalize (stmt);
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void ReSqliteUn::releaseCapture ()
+{
+    if (stmt_capture_ != NULL) {
+        sqlite3_finalize (static_cast<sqlite3_stmt *>(stmt_capture_));
+        stmt_capture_ = NULL;
+    }
+    if (stmt_extend_ != NULL) {
+        sqlite3_finalize (static_cast<sqlite3_stmt *>(stmt_extend_));
+        stmt_extend_ = NULL;
+    }
+    last_record_ = -1;
+    last_table_ = -1;
+    last_rowid_ = -1;
+    releaseParts ();
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+void ReSqliteUn::releaseParts ()
+{
+    foreach(void * value, part_values_) {
+        sqlite3_value_free (static_cast<sqlite3_value *>(value));
+    }
+    part_values_.clear ();
+}
+/* ========================================================================= */
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+//! Remembers the depth of each change and calls the hook of the application.
+static void preupdateCallback (
+        void * user_data, sqlite3 * db, int operation,
+        const char * database, const char * table,
+        sqlite3_int64 old_rowid, sqlite3_int64 new_rowid)
+{
+    ReSqliteUn * p_app = static_cast<ReSqliteUn *>(user_data);
+
+    // The journal and the shadow tables are written by statements
+    // of our own that always have a depth of 0.
+    if (sqlite3_strnicmp (table, RESQUN_PREFIX,
+                          sizeof(RESQUN_PREFIX) - 1) != 0) {
+        p_app->notePreupdate (
+                    table, operation,
+                    (operation == SQLITE_INSERT ? new_rowid : old_rowid),
+                    sqlite3_preupdate_depth (db));
+    }
+
+    if (p_app->app_hook_ != NULL) {
+        p_app->app_hook_ (p_app->app_hook_data_, db, operation,
+                          database, table, old_rowid, new_rowid);
+    }
+}
+#endif
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * sqlite keeps a single preupdate hook for each connection and does not
+ * tell which function was installed before, so an application that needs
+ * its own hook while CaptureRootChanges is in effect hands it to the
+ * instance instead of the connection. The instance calls it for every
+ * change, installs it in the connection when the scope goes back to
+ * CaptureAllChanges and leaves it there when the instance is destroyed.
+ *
+ * @param callback The hook or NULL to remove it.
+ * @param user_data Passed to the hook as is.
+ */
+void ReSqliteUn::setPreupdateHook (PreupdateHook callback, void * user_data)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    app_hook_ = callback;
+    app_hook_data_ = user_data;
+    installPreupdateHook (capture_scope_);
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * sqlite keeps a single progress handler for each connection and
+ * ReSqliteUnAsync needs it while its steps run, so an application that
+ * has its own handler hands it to the instance instead of the connection.
+ * The handler is installed in the connection right away; the worker
+ * calls it from its own handler and puts it back after each step.
+ *
+ * @param opcodes Number of virtual machine instructions between the calls.
+ * @param callback The handler or NULL to remove it.
+ * @param user_data Passed to the handler as is.
+ */
+void ReSqliteUn::setProgressHandler (
+        int opcodes, ProgressHandler callback, void * user_data)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    app_progress_ = callback;
+    app_progress_data_ = user_data;
+    app_progress_opcodes_ = opcodes;
+    sqlite3_progress_handler (dtb_, opcodes, callback, user_data);
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * With CaptureRootChanges our own hook is installed and it forwards
+ * the changes to the hook of the application; otherwise the connection
+ * gets the hook of the application (or none).
+ *
+ * @param scope The scope that is (or is about to be) in effect.
+ */
+void ReSqliteUn::installPreupdateHook (CaptureScope scope)
+{
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+    if (scope == CaptureRootChanges) {
+        sqlite3_preupdate_hook (dtb_, preupdateCallback, this);
+    } else if ((app_hook_ != NULL) || (capture_scope_ == CaptureRootChanges)) {
+        sqlite3_preupdate_hook (dtb_, app_hook_, app_hook_data_);
+    }
+#else
+    Q_UNUSED(scope);
+#endif
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The changes at the same depth or deeper that are still in the list
+ * were finished, together with their triggers, before this one started,
+ * so only the changes that lead to this one are kept.
+ *
+ * @param table The name of the table.
+ * @param operation SQLITE_INSERT, SQLITE_UPDATE or SQLITE_DELETE.
+ * @param rowid The rowid of the row.
+ * @param depth The depth reported by `sqlite3_preupdate_depth()`.
+ */
+void ReSqliteUn::notePreupdate (
+        const char * table, int operation, qint64 rowid, int depth)
+{
+    while (!pending_.isEmpty () && (pending_.last ().depth >= depth)) {
+        pending_.removeLast ();
+    }
+    PendingChange change;
+    change.table = table;
+    change.rowid = rowid;
+    change.op = operation;
+    change.depth = depth;
+    pending_.append (change);
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * With CaptureAllChanges (the default) every row that changes in a tracked
+ * table is recorded, including those changed by `ON DELETE CASCADE`
+ * actions and by the user's own triggers.
+ *
+ * With CaptureRootChanges only the rows that the statement changes directly
+ * are recorded; undo and redo replay those changes and let cascades and
+ * triggers reproduce the rest, so no row is logged twice. Changes that can
+ * not be reproduced this way (rows removed by `ON DELETE CASCADE` can not
+ * be recreated by inserting the parent back) are lost on undo, so this
+ * scope is meant for tables whose nested effects are derived data.
+ *
+ * Root changes are told apart using `sqlite3_preupdate_depth()`, so
+ * CaptureRootChanges requires an sqlite library built with
+ * SQLITE_ENABLE_PREUPDATE_HOOK; SQLITE_MISUSE is returned otherwise.
+ *
+ * The scope is used when the triggers are generated; it affects
+ * the tables attached after this call. An application that has its own
+ * preupdate hook should hand it to setPreupdateHook(), as this scope
+ * needs the hook of the connection.
+ *
+ * @param value The new scope.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::setCaptureScope (CaptureScope value)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    for (;;) {
+        if (is_active_) {
+            rc = SQLITE_MISUSE;
+            break;
+        }
+
+#ifndef SQLITE_ENABLE_PREUPDATE_HOOK
+        if (value == CaptureRootChanges) {
+            RESQLITEUN_DEBUGM("setCaptureScope(): sqlite was build without "
+                              "SQLITE_ENABLE_PREUPDATE_HOOK\n");
+            rc = SQLITE_MISUSE;
+            break;
+        }
+#endif
+        installPreupdateHook (value);
+        pending_.clear ();
+        capture_scope_ = value;
+        break;
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Triggers call this (through `resqun_isroot`) after the row was changed.
+ * The answer is the depth that the preupdate hook saw for the change
+ * (see notePreupdate()): 0 for a change made directly by the statement,
+ * more for one made by a cascade or a trigger.
+ *
+ * The call is matched with the innermost change of the list that has the
+ * same table, operation and rowid; the changes that come after it were
+ * made by its cascades and triggers, and these have finished.
+ * Our temporary triggers run before the triggers of the database, so
+ * a nested change of the same row can only be pending here when it comes
+ * from a foreign key of the table that refers to the table itself.
+ *
+ * @param table The name of the table.
+ * @param operation SQLITE_INSERT, SQLITE_UPDATE or SQLITE_DELETE.
+ * @param rowid The rowid of the row.
+ * @return true if the change was made directly by the statement
+ */
+bool ReSqliteUn::isRootChange (
+        const char * table, int operation, qint64 rowid)
+{
+    for (int i = pending_.count () - 1; i >= 0; --i) {
+        const PendingChange & change = pending_.at (i);
+        if ((change.rowid == rowid) && (change.op == operation) &&
+                (sqlite3_stricmp (table, change.table.constData ()) == 0)) {
+            bool is_root = (change.depth == 0);
+            while (pending_.count () > i + 1) {
+                pending_.removeLast ();
+            }
+            return is_root;
+        }
+    }
+    return false;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Undo reverts the changes in the opposite order of the one in which
+ * they were made, so records are returned newest first; redo returns
+ * them in their original order.
+ *
+ * @param entry_id The id of the entry in the index table.
+ * @param for_undo The records are loaded for an undo (true) or a redo.
+ * @param records Receives the records.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::loadRecords (
+        qint64 entry_id, bool for_undo,
+        QList<ReSqliteUnRecord> & records) const
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    sqlite3_stmt *stmt = NULL;
+    for (;;) {
+
+        rc = sqlite3_prepare_v2 (
+                    dtb_,
+                    for_undo ?
+                        "SELECT id,op,tbl,firstid,lastid,data,redo"
+                        " FROM " RESQUN_TBL_TEMP
+                        " WHERE idxid=?"
+                        " ORDER BY id DESC" :
+                        "SELECT id,op,tbl,firstid,lastid,data,redo"
+                        " FROM " RESQUN_TBL_TEMP
+                        " WHERE idxid=?"
+                        " ORDER BY id ASC",
+                -1, &stmt, NULL);
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("loadRecords(): prepare failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+        rc = sqlite3_bind_int64 (stmt, 1, entry_id);
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("loadRecords(): bind failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+        for (;;) {
+            rc = sqlite3_step (stmt);
+            if (rc != SQLITE_ROW)
+                break;
+            ReSqliteUnRecord record;
+            record.id_ = sqlite3_column_int64 (stmt, 0);
+            record.kind_ = sqlite3_column_int (stmt, 1);
+            record.table_ = columnText (stmt, 2);
+            record.first_rowid_ = sqlite3_column_int64 (stmt, 3);
+            record.last_rowid_ = sqlite3_column_int64 (stmt, 4);
+            record.image_ = QByteArray (
+                        static_cast<const char *>(
+                            sqlite3_column_blob (stmt, 5)),
+                        sqlite3_column_bytes (stmt, 5));
+            record.redo_image_ = QByteArray (
+                        static_cast<const char *>(
+                            sqlite3_column_blob (stmt, 6)),
+                        sqlite3_column_bytes (stmt, 6));
+            records.append (record);
+        }
+        if (rc != SQLITE_DONE) {
+            RESQLITEUN_DEBUGM("loadRecords(): step failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+
+        rc = SQLITE_OK;
+        break;
+    }
+    if (stmt != NULL) {
+        sqlite3_finalize(stmt);
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+//! Get the index of a template in the plan, adding it on first use.
+static int templateIndex (
+        ReSqliteUn::ReplayPlan & plan, QHash<QString, int> & index,
+        const QString & sql)
+{
+    int i = index.value (sql, -1);
+    if (i == -1) {
+        i = plan.sql.count ();
+        plan.sql.append (sql);
+        index.insert (sql, i);
+    }
+    return i;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Each record is turned into statements built from per-table templates.
+ * For undo:
+ *
+ * - inserted rows are copied in the shadow table (for redo) and removed:
+ *   `INSERT INTO resqun_shadow_Test SELECT ?3,rowid,* FROM Test
+ *   WHERE rowid BETWEEN ?1 AND ?2` and
+ *   `DELETE FROM Test WHERE rowid BETWEEN ?1 AND ?2`;
+ * - deleted rows are restored with
+ *   `INSERT INTO Test(rowid,id,data,data1) VALUES(?,?,?,?)`;
+ * - updated rows get their old values back with
+ *   `UPDATE Test SET data=?,data1=? WHERE rowid=?`;
+ * - snapshots replace the content of the table (see restoreTable()),
+ *   after saving current content for redo.
+ *
+ * For redo the inserted rows are copied back from the shadow table,
+ * deleted rows are removed again and updated rows get the new values.
+ *
+ * The text of the statements only depends on the table and on the set of
+ * columns in the image, so the statements are shared by the records
+ * of the plan that use the same template. They are only prepared when
+ * the plan runs (see preparePlan()): a plan that waits for its turn
+ * (see precompile()) holds no statement, so it does not keep the
+ * connection from being closed.
+ *
+ * The shadow tables are created here, as the statements that use them
+ * cannot be prepared otherwise. Nothing else is written to the database.
+ *
+ * @param plan The plan; entry_id and for_undo must be set by the caller.
+ * @param s_error Receives the error message, if any.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::buildPlan (
+        ReplayPlan & plan, QString & s_error)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    QSet<int> shadows;
+    QHash<QString, int> index;
+    for (;;) {
+        rc = loadRecords (plan.entry_id, plan.for_undo, plan.records);
+        if (rc != SQLITE_OK) {
+            s_error = tr("Cannot load the records.\n%1")
+                    .arg (sqlite3_errmsg (dtb_));
+            break;
+        }
+
+        // The steps point inside the records, so the list of records
+        // is not changed from here on.
+        for (int i = 0; i < plan.records.count (); ++i) {
+            const ReSqliteUnRecord & record = plan.records.at (i);
+
+            ReplayStep step;
+            step.record = &record;
+            step.table_id = tableId (record.table_);
+            step.statement = -1;
+            step.statement_next = -1;
+            if (step.table_id < 0) {
+                s_error = tr("Table %1 is not tracked.").arg (record.table_);
+                rc = SQLITE_ERROR;
+                break;
+            }
+            const TableInfo & info = tables_.at (step.table_id);
+
+            // Snapshots replace the whole table when the plan is run.
+            if (record.kind_ == ReSqliteUnRecord::SnapshotKind) {
+                plan.steps.append (step);
+                continue;
+            }
+
+            // Inserted rows are kept in the shadow table between undo and redo.
+            if ((record.kind_ == ReSqliteUnRecord::InsertKind) &&
+                    !shadows.contains (step.table_id)) {
+                rc = createShadow (step.table_id);
+                if (rc != SQLITE_OK) {
+                    s_error = tr("Cannot create the shadow of table %1.\n%2")
+                            .arg (record.table_)
+                            .arg (sqlite3_errmsg (dtb_));
+                    break;
+                }
+                shadows.insert (step.table_id);
+            }
+
+            // Decode the image.
+            const QByteArray & image = plan.for_undo ?
+                        record.image_ : record.redo_image_;
+            const char * cursor = image.constData ();
+            const char * end = cursor + image.size ();
+            ReSqliteUnRecord::Value value;
+            while (cursor < end) {
+                if (!ReSqliteUnRecord::decode (cursor, end, value) ||
+                        (value.column < 0) ||
+                        (value.column >= info.columns.count ())) {
+                    rc = SQLITE_CORRUPT;
+                    break;
+                }
+                step.values.append (value);
+            }
+            if (rc != SQLITE_OK) {
+                s_error = tr("Damaged record for table %1.").arg (record.table_);
+                break;
+            }
+
+            // Compute the text of the statements; range statements use
+            // ?1 and ?2 for the rowids and ?3 for the key in the shadow table.
+            QString shadow = shadowName (info.name);
+            QString sql;
+            QString sql_next;
+            switch (record.kind_) {
+            case ReSqliteUnRecord::InsertKind: {
+                if (plan.for_undo) {
+                    sql = QString("INSERT INTO ") % shadow %
+                            QString(" SELECT ?3,rowid,* FROM ") % info.name %
+                            QString(" WHERE rowid BETWEEN ?1 AND ?2");
+                    sql_next = QString("DELETE FROM ") % info.name %
+                            QString(" WHERE rowid BETWEEN ?1 AND ?2");
+                } else {
+                    QString columns = info.columns.join (comma);
+                    sql = QString("INSERT INTO ") % info.name %
+                            QString("(rowid,") % columns %
+                            QString(") SELECT resqun_rowid,") % columns %
+                            QString(" FROM ") % shadow %
+                            QString(" WHERE resqun_snap=?3");
+                    sql_next = QString("DELETE FROM ") % shadow %
+                            QString(" WHERE resqun_snap=?3");
+                }
+                break; }
+            case ReSqliteUnRecord::DeleteKind: {
+                if (plan.for_undo) {
+                    QString names;
+                    QString marks;
+                    foreach(const ReSqliteUnRecord::Value & iter, step.values) {
+                        names.append (comma % info.columns.at (iter.column));
+                        marks.append (QLatin1String (",?"));
+                    }
+                    sql = QString("INSERT INTO ") % info.name %
+                            QString("(rowid") % names % QString(") VALUES(?") %
+                            marks % QString(")");
+                } else {
+                    sql = QString("DELETE FROM ") % info.name %
+                            QString(" WHERE rowid BETWEEN ?1 AND ?2");
+                }
+                break; }
+            case ReSqliteUnRecord::UpdateKind:
+            case ReSqliteUnRecord::UpdateColumnKind: {
+                QString assign;
+                foreach(const ReSqliteUnRecord::Value & iter, step.values) {
+                    if (!assign.isEmpty ()) {
+                        assign.append (comma);
+                    }
+                    assign.append (info.columns.at (iter.column) % QString("=?"));
+                }
+                if (!assign.isEmpty ()) {
+                    sql = QString("UPDATE ") % info.name % QString(" SET ") %
+                            assign % QString(" WHERE rowid=?");
+                }
+                break; }
+            default: {
+                s_error = tr("Unknown record kind %1.").arg (record.kind_);
+                rc = SQLITE_CORRUPT;
+                break; }
+            }
+            if (rc != SQLITE_OK) {
+                break;
+            }
+            if (sql.isEmpty ()) {
+                continue;
+            }
+
+            step.statement = templateIndex (plan, index, sql);
+            if (!sql_next.isEmpty ()) {
+                step.statement_next = templateIndex (plan, index, sql_next);
+            }
+            plan.steps.append (step);
+        }
+        break;
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Nothing is written to the journal, so a plan can be run any number of
+ * times; the caller is responsible for the savepoint and for changing
+ * the status of the entry (see openReplay() and closeReplay()).
+ *
+ * The steps are applied starting with @a position, which is updated as
+ * they are applied. With a non-negative @a budget_ms the function returns
+ * once that many milliseconds were spent (after at least one step), so
+ * the rest of the plan can be applied by a later call.
+ *
+ * The user's triggers and the foreign keys are turned off while the steps
+ * are applied when the records already contain their effects (see
+ * replayEffects()).
+ *
+ * @param plan The plan built by buildPlan().
+ * @param position The first step to apply; receives the next one.
+ * @param budget_ms Time available, in milliseconds (negative for no limit).
+ * @param s_error Receives the error message, if any.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::runPlan (
+        const ReplayPlan & plan, int & position, qint64 budget_ms,
+        QString & s_error)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    replay_total_ = plan.steps.count ();
+    replay_applied_ = position;
+    if (position >= plan.steps.count ()) {
+        RESQLITEUN_TRACE_EXIT;
+        return rc;
+    }
+
+    bool quiet_triggers = false;
+    bool quiet_fkeys = false;
+    rc = replayEffects (quiet_triggers, quiet_fkeys);
+    if (rc != SQLITE_OK) {
+        s_error = tr("Cannot inspect the triggers.\n%1")
+                .arg (sqlite3_errmsg (dtb_));
+        RESQLITEUN_TRACE_EXIT;
+        return rc;
+    }
+    int had_triggers = 1;
+    int had_fkeys = 1;
+    if (quiet_triggers) {
+        had_triggers = switchFlag (dtb_, SQLITE_DBCONFIG_ENABLE_TRIGGER, 0);
+    }
+    if (quiet_fkeys) {
+        had_fkeys = switchFlag (dtb_, SQLITE_DBCONFIG_ENABLE_FKEY, 0);
+    }
+
+    int first = position;
+    QElapsedTimer timer;
+    timer.start ();
+    while (position < plan.steps.count ()) {
+        replay_applied_ = position;
+        if ((budget_ms >= 0) &&
+                (position > first) &&
+                (timer.elapsed () >= budget_ms)) {
+            break;
+        }
+        const ReplayStep & step = plan.steps.at (position);
+        const ReSqliteUnRecord & record = *step.record;
+
+        // Snapshots replace the whole table.
+        if (record.kind_ == ReSqliteUnRecord::SnapshotKind) {
+            rc = plan.for_undo ?
+                        restoreTable (step.table_id, record.id_, -record.id_) :
+                        restoreTable (step.table_id, -record.id_);
+            if (rc != SQLITE_OK) {
+                s_error = tr("Cannot restore table %1.\n%2")
+                        .arg (record.table_)
+                        .arg (sqlite3_errmsg (dtb_));
+                break;
+            }
+            ++position;
+            continue;
+        }
+
+        bool by_range =
+                (record.kind_ == ReSqliteUnRecord::InsertKind) ||
+                ((record.kind_ == ReSqliteUnRecord::DeleteKind) &&
+                 !plan.for_undo);
+        for (int i = 0; i < 2; ++i) {
+            int statement = (i == 0 ? step.statement : step.statement_next);
+            if (statement == -1) {
+                break;
+            }
+            sqlite3_stmt * stmt = static_cast<sqlite3_stmt *>(
+                        plan.statements.at (statement));
+            RESQLITEUN_TRACE_SPAN("replay.step");
+
+            if (by_range) {
+                sqlite3_bind_int64 (stmt, 1, record.first_rowid_);
+                sqlite3_bind_int64 (stmt, 2, record.last_rowid_);
+                sqlite3_bind_int64 (stmt, 3, -record.id_);
+            } else if (record.kind_ == ReSqliteUnRecord::DeleteKind) {
+                sqlite3_bind_int64 (stmt, 1, record.first_rowid_);
+                for (int j = 0; j < step.values.count (); ++j) {
+                    ReSqliteUnRecord::bind (stmt, j + 2, step.values.at (j));
+                }
+            } else {
+                for (int j = 0; j < step.values.count (); ++j) {
+                    ReSqliteUnRecord::bind (stmt, j + 1, step.values.at (j));
+                }
+                sqlite3_bind_int64 (
+                            stmt, step.values.count () + 1,
+                            record.first_rowid_);
+            }
+            rc = sqlite3_step (stmt);
+            sqlite3_reset (stmt);
+            if (rc != SQLITE_DONE) {
+                s_error = tr("Cannot perform the update.\n%1")
+                        .arg (sqlite3_errmsg (dtb_));
+                break;
+            }
+            rc = SQLITE_OK;
+        }
+        if (rc != SQLITE_OK) {
+            break;
+        }
+        ++position;
+    }
+    replay_applied_ = position;
+
+    if (quiet_triggers) {
+        switchFlag (dtb_, SQLITE_DBCONFIG_ENABLE_TRIGGER, had_triggers);
+    }
+    if (quiet_fkeys) {
+        switchFlag (dtb_, SQLITE_DBCONFIG_ENABLE_FKEY, had_fkeys);
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * Nothing is done if the statements are already prepared.
+ *
+ * @param plan The plan built by buildPlan().
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::preparePlan (ReplayPlan & plan)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    while (plan.statements.count () < plan.sql.count ()) {
+        RESQLITEUN_TRACE_SPAN("replay.prepare");
+        const QString & sql = plan.sql.at (plan.statements.count ());
+        sqlite3_stmt * prepared = NULL;
+        rc = sqlite3_prepare16_v2 (
+                    dtb_, sql.utf16 (), sql.size () * sizeof(QChar),
+                    &prepared, NULL);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+        plan.statements.append (prepared);
+    }
     RESQLITEUN_TRACE_EXIT;
     return rc;
 }
 /* ========================================================================= */
 
 /* ------------------------------------------------------------------------- */
-ReSqliteUn::SqLiteResult ReSqliteUn::end ()
+/**
+ * The plan keeps its records and may be prepared and run again.
+ *
+ * @param plan The plan.
+ */
+void ReSqliteUn::finalizePlan (ReplayPlan & plan)
 {
-    RESQLITEUN_TRACE_ENTRY;
-    ReSqliteUn::SqLiteResult rc = SQLITE_ERROR;
-    for (;;) {
-
-        if (!is_active_) {
-            rc = SQLITE_MISUSE;
-            break;
-        }
-
-        RESQLITEUN_DEBUGM("State changed to inactive by end command");
-        is_active_ = false;
-
-        rc = SQLITE_OK;
-        break;
+    foreach(void * stmt, plan.statements) {
+        sqlite3_finalize (static_cast<sqlite3_stmt *>(stmt));
     }
-    RESQLITEUN_TRACE_EXIT;
-    return rc;
+    plan.statements.clear ();
 }
 /* ========================================================================= */
 
 /* ------------------------------------------------------------------------- */
 /**
- * We're adding a table to the list of tables managed by the
- * undo-redo mechanism.
+ * @param plan The plan to release (may be NULL).
  */
-ReSqliteUn::SqLiteResult ReSqliteUn::attachToTable (
-        const QString & table, UpdateBehaviour update_kind)
+void ReSqliteUn::releasePlan (ReplayPlan * plan)
 {
-    RESQLITEUN_TRACE_ENTRY;
-    QString statements = sqlTriggers (db_, table, update_kind);
-    // printf(statements.toLatin1().constData());
+    if (plan == NULL) {
+        return;
+    }
+    finalizePlan (*plan);
+    delete plan;
+}
+/* ========================================================================= */
 
-    // This is inefficient as toUtf8 will allocate a new buffer;
-    // as sqlite3_exec only works with Utf8 (there is no 16 alternative)
-    // we are left with three options: use utf8 all over the place,
-    // the one below or reimplementing sqlite3_exec.
-    // As the this function will probably used only when the program starts,
-    // once for each table, the performance penality is neglijable IMHO.
-    char * err_msg;
-    ReSqliteUn::SqLiteResult rc = sqlite3_exec (
-                dtb_,
-                statements.toUtf8().constData (),
-                NULL, NULL, &err_msg);
-    if (rc != SQLITE_OK) {
-        qWarning() << "Failed to install triggers:"
-                   << err_msg << endl
-                   << statements;
-     }
-    RESQLITEUN_TRACE_EXIT;
-    return rc;
+/* ------------------------------------------------------------------------- */
+/**
+ * The time between the end of an entry and the next undo is usually idle,
+ * so the work that does not change the database (loading and decoding
+ * the records, building the text of the statements) may be done ahead
+ * of time.
+ * With this option on, the replay of the top undo entry and of the
+ * next redo entry is prepared by end(), by undo and by redo; otherwise
+ * precompile() may be called by the application when it sees fit
+ * (from an idle handler, for example).
+ *
+ * @param value Turn the option on (true) or off.
+ */
+void ReSqliteUn::setPrecompile (bool value)
+{
+    ReSqliteUnLocker locker (db_);
+    precompile_ = value;
+    if (!value) {
+        discardPlans ();
+    }
 }
 /* ========================================================================= */
 
 /* ------------------------------------------------------------------------- */
-ReSqliteUnUtil::SqLiteResult deleteById (
-        sqlite3 * database, quint64 the_id)
+/**
+ * Plans that are still valid are kept; all others are released.
+ * The plans hold the decoded records and the text of their statements,
+ * but no prepared statement, so the connection may be closed at any time.
+ *
+ * A plan stays valid until the next begin() or attachToTable().
+ *
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::precompile ()
 {
     RESQLITEUN_TRACE_ENTRY;
-    ReSqliteUnUtil::SqLiteResult rc = SQLITE_OK;
-    sqlite3_stmt *stmt = NULL;
+    ReSqliteUnLocker locker (db_);
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
+    QList<ReplayPlan *> previous = plans_;
+    plans_.clear ();
     for (;;) {
-
-        rc = sqlite3_prepare_v2 (
-                    database,
-                    "DELETE "
-                    " FROM " RESQUN_TBL_TEMP
-                    " WHERE idxid=?",
-                -1, &stmt, NULL);
-        if (rc != SQLITE_OK) {
-            RESQLITEUN_DEBUGM("deleteById(): prepare failed: %s\n",
-                              sqlite3_errmsg(database));
-            break;
-        }
-        rc = sqlite3_bind_int64 (stmt, 1, the_id);
-        if (rc != SQLITE_OK) {
-            RESQLITEUN_DEBUGM("deleteById(): bind failed: %s\n",
-                              sqlite3_errmsg(database));
-            break;
-        }
-        rc = sqlite3_step (stmt);
-        if (rc != SQLITE_DONE) {
-            RESQLITEUN_DEBUGM("deleteById(): step failed: %s\n",
-                              sqlite3_errmsg(database));
+        if (is_active_ || is_replaying_) {
+            rc = SQLITE_MISUSE;
             break;
         }
 
-        rc = SQLITE_OK;
+        for (int i = 0; i < 2; ++i) {
+            bool for_undo = (i == 0);
+            qint64 active = getActiveId (for_undo ? UndoType : RedoType);
+            if (active < 1) {
+                continue;
+            }
+
+            ReplayPlan * plan = NULL;
+            for (int j = 0; j < previous.count (); ++j) {
+                if ((previous.at (j)->entry_id == active) &&
+                        (previous.at (j)->for_undo == for_undo)) {
+                    plan = previous.takeAt (j);
+                    break;
+                }
+            }
+            if (plan == NULL) {
+                plan = new ReplayPlan ();
+                plan->entry_id = active;
+                plan->for_undo = for_undo;
+                QString s_error;
+                rc = buildPlan (*plan, s_error);
+                if (rc != SQLITE_OK) {
+                    RESQLITEUN_DEBUGM("precompile(): %s\n",
+                                      s_error.toUtf8 ().constData ());
+                    releasePlan (plan);
+                    break;
+                }
+            }
+            plans_.append (plan);
+        }
         break;
     }
-    if (stmt != NULL) {
-        sqlite3_finalize(stmt);
+    foreach(ReplayPlan * plan, previous) {
+        releasePlan (plan);
     }
     RESQLITEUN_TRACE_EXIT;
     return rc;
@@ -256,51 +2792,142 @@ ReSqliteUnUtil::SqLiteResult deleteById (
 /* ========================================================================= */
 
 /* ------------------------------------------------------------------------- */
-ReSqliteUnUtil::SqLiteResult statementsById (
-        sqlite3 * database, quint64 the_id, QString & result)
+/**
+ * When all attached tables record every change (CaptureAllChanges) the
+ * effects of the user's triggers and of the foreign key actions on
+ * attached tables are in the records, so running them again during
+ * replay would apply these effects twice. Effects on tables that are not
+ * attached are in no record, though, so:
+ * - the foreign keys are turned off only if every table with a foreign
+ *   key that refers to an attached table is attached;
+ * - the triggers are turned off only if the triggers of the attached
+ *   tables (and the foreign key actions they start) write to attached
+ *   tables alone (see ReSqliteUnUtil::readWrittenTables()).
+ *
+ * The answer is kept until the schema, the triggers of the application
+ * or the list of attached tables change.
+ *
+ * @param quiet_triggers Receives true if the triggers can be turned off.
+ * @param quiet_fkeys Receives true if the foreign keys can be turned off.
+ * @return error code
+ */
+ReSqliteUn::SqLiteResult ReSqliteUn::replayEffects (
+        bool & quiet_triggers, bool & quiet_fkeys)
 {
     RESQLITEUN_TRACE_ENTRY;
-    ReSqliteUnUtil::SqLiteResult rc = SQLITE_OK;
+    quiet_triggers = false;
+    quiet_fkeys = false;
+    foreach(const TableInfo & info, tables_) {
+        if (info.scope != CaptureAllChanges) {
+            RESQLITEUN_TRACE_EXIT;
+            return SQLITE_OK;
+        }
+    }
+
+    ReSqliteUn::SqLiteResult rc = SQLITE_OK;
     sqlite3_stmt *stmt = NULL;
     for (;;) {
-
         rc = sqlite3_prepare_v2 (
-                    database,
-                    "SELECT group_concat(sql, ';')"
-                    " FROM " RESQUN_TBL_TEMP
-                    " WHERE idxid=?",
-                -1, &stmt, NULL);
-        if (rc != SQLITE_OK) {
-            RESQLITEUN_DEBUGM("statementsById(): prepare failed: %s\n",
-                              sqlite3_errmsg(database));
-            break;
-        }
-        rc = sqlite3_bind_int64 (stmt, 1, the_id);
+                    dtb_,
+                    "SELECT (SELECT schema_version FROM pragma_schema_version)"
+                    "||':'||ifnull((SELECT group_concat(name) "
+                        "FROM sqlite_temp_master WHERE type='trigger' "
+                        "AND name NOT GLOB '" RESQUN_PREFIX "*'),'')",
+                    -1, &stmt, NULL);
         if (rc != SQLITE_OK) {
-            RESQLITEUN_DEBUGM("statementsById(): bind failed: %s\n",
-                              sqlite3_errmsg(database));
             break;
         }
         rc = sqlite3_step (stmt);
         if (rc != SQLITE_ROW) {
-            RESQLITEUN_DEBUGM("statementsById(): step failed: %s\n",
-                              sqlite3_errmsg(database));
+            break;
+        }
+        QString key = columnText (stmt, 0) % QLatin1String (":") %
+                QString::number (tables_.count ());
+        sqlite3_finalize (stmt);
+        stmt = NULL;
+        if (key == effects_key_) {
+            quiet_triggers = quiet_triggers_;
+            quiet_fkeys = quiet_fkeys_;
+            rc = SQLITE_OK;
             break;
         }
 
-        result = ReSqliteUn::columnText (stmt, 0);
+        // Tables with a foreign key to an attached table.
+        rc = sqlite3_prepare_v2 (
+                    dtb_,
+                    "SELECT lower(m.name), lower(f.\"table\") "
+                    "FROM sqlite_master AS m, "
+                        "pragma_foreign_key_list(m.name) AS f "
+                    "WHERE m.type='table'",
+                    -1, &stmt, NULL);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+        quiet_fkeys = true;
+        while ((rc = sqlite3_step (stmt)) == SQLITE_ROW) {
+            if (table_ids_.contains (columnText (stmt, 1)) &&
+                    !table_ids_.contains (columnText (stmt, 0))) {
+                quiet_fkeys = false;
+            }
+        }
+        if (rc != SQLITE_DONE) {
+            break;
+        }
 
+        // The foreign key actions were dealt with above.
+        int had_fkeys = switchFlag (dtb_, SQLITE_DBCONFIG_ENABLE_FKEY, 0);
+        quiet_triggers = true;
         rc = SQLITE_OK;
+        foreach(const TableInfo & info, tables_) {
+            QStringList written;
+            rc = readWrittenTables (db_, info, written);
+            if (rc != SQLITE_OK) {
+                break;
+            }
+            foreach(const QString & table, written) {
+                if (!table_ids_.contains (table)) {
+                    RESQLITEUN_DEBUGM("Triggers of %s write to %s\n",
+                                      info.name.toUtf8 ().constData (),
+                                      table.toUtf8 ().constData ());
+                    quiet_triggers = false;
+                }
+            }
+            if (!quiet_triggers) {
+                break;
+            }
+        }
+        switchFlag (dtb_, SQLITE_DBCONFIG_ENABLE_FKEY, had_fkeys);
+        if (rc != SQLITE_OK) {
+            break;
+        }
+
+        effects_key_ = key;
+        quiet_triggers_ = quiet_triggers;
+        quiet_fkeys_ = quiet_fkeys;
         break;
     }
     if (stmt != NULL) {
-        sqlite3_finalize(stmt);
+        sqlite3_finalize (stmt);
+    }
+    if (rc != SQLITE_OK) {
+        quiet_triggers = false;
+        quiet_fkeys = false;
     }
     RESQLITEUN_TRACE_EXIT;
     return rc;
 }
 /* ========================================================================= */
 
+/* ------------------------------------------------------------------------- */
+void ReSqliteUn::discardPlans ()
+{
+    foreach(ReplayPlan * plan, plans_) {
+        releasePlan (plan);
+    }
+    plans_.clear ();
+}
+/* ========================================================================= */
+
 /* ------------------------------------------------------------------------- */
 ReSqliteUnUtil::SqLiteResult changeStatusById (
         sqlite3 * database, quint64 the_id, int new_status)
@@ -356,7 +2983,12 @@ ReSqliteUnUtil::SqLiteResult ReSqliteUn::performUndoRedo (
         int steps, bool for_undo, QString &s_error)
 {
     RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
     ReSqliteUnUtil::SqLiteResult rc = SQLITE_ERROR;
+
+    // Only prepare the replay of the last step.
+    bool b_precompile = precompile_;
+    precompile_ = false;
     for (int i = 0; i < steps; ++i) {
         rc = performUndoRedo (for_undo, s_error);
         if (rc != SQLITE_OK) {
@@ -364,20 +2996,35 @@ ReSqliteUnUtil::SqLiteResult ReSqliteUn::performUndoRedo (
             break;
         }
     }
+    precompile_ = b_precompile;
+    if (precompile_) {
+        precompile ();
+    }
     RESQLITEUN_TRACE_EXIT;
     return rc;
 }
 /* ========================================================================= */
 
 /* ------------------------------------------------------------------------- */
-ReSqliteUnUtil::SqLiteResult ReSqliteUn::performUndoRedo (
-        bool for_undo, QString &s_error)
+/**
+ * The status of the entry is changed inside the `RESQUN_SVP_UNDO`
+ * savepoint, which stays open until closeReplay() is called. The plan
+ * prepared in advance is used if there is one (see precompile()).
+ *
+ * @param for_undo Undo (true) or redo.
+ * @param plan Receives the plan to run; release it with closeReplay().
+ * @param s_error Receives the error message, if any.
+ * @return error code (SQLITE_DONE if there is nothing to undo or redo)
+ */
+ReSqliteUnUtil::SqLiteResult ReSqliteUn::openReplay (
+        bool for_undo, ReplayPlan *& plan, QString &s_error)
 {
     RESQLITEUN_TRACE_ENTRY;
     ReSqliteUnUtil::SqLiteResult rc = SQLITE_ERROR;
     bool rollback = false;
+    plan = NULL;
     for (;;) {
-        if (is_active_) {
+        if (is_active_ || is_replaying_) {
             rc = SQLITE_MISUSE;
             s_error = "Cannot undo/redo while active";
             break;
@@ -386,74 +3033,163 @@ ReSqliteUnUtil::SqLiteResult ReSqliteUn::performUndoRedo (
         // Get the id of the undo or redo entry.
         qint64 active = getActiveId (for_undo ? UndoType : RedoType);
         if (active < 1) {
-            RESQLITEUN_DEBUGM("performUndoRedo(): getActiveId failed: %s\n",
+            RESQLITEUN_DEBUGM("openReplay(): getActiveId failed: %s\n",
                               sqlite3_errmsg(dtb_));
             rc = SQLITE_DONE;
             break;
         }
 
-        // Get the statements needed to get the database to former glory.
-        QString statements;
-        rc = statementsById (dtb_, active, statements);
+        // Rows are copied with `SELECT *`, so the shadow tables must
+        // follow tables changed since the entry was recorded.
+        rc = refreshTables ();
         if (rc != SQLITE_OK) {
-            RESQLITEUN_DEBUGM("performUndoRedo(): statementsById failed: %s\n",
-                              sqlite3_errmsg(dtb_));
+            s_error = "Cannot inspect the tables";
             break;
         }
 
+        // Use the replay prepared in advance, if any.
+        for (int i = 0; i < plans_.count (); ++i) {
+            if ((plans_.at (i)->entry_id == active) &&
+                    (plans_.at (i)->for_undo == for_undo)) {
+                plan = plans_.takeAt (i);
+                break;
+            }
+        }
+
         rc = sqlite3_exec (dtb_, "SAVEPOINT " RESQUN_SVP_UNDO,
                 NULL, NULL, NULL);
         if (rc != SQLITE_OK) {
             break;
         }
-        rollback = true; {
-
-            // Delete all those old statements.
-            rc = deleteById (dtb_, active);
-            if (rc != SQLITE_OK) {
-                RESQLITEUN_DEBUGM("performUndoRedo(): statementsById failed: %s\n",
-                                  sqlite3_errmsg(dtb_));
-                break;
-            }
+        rollback = true;
 
-            // Switch the status from undo to redo and vv.
-            rc = changeStatusById (
-                        dtb_, active, for_undo ?
-                            RESQUN_MARK_REDO : RESQUN_MARK_UNDO );
-            if (rc != SQLITE_OK) {
-                RESQLITEUN_DEBUGM("performUndoRedo(): changeStatusById failed: %s\n",
-                                  sqlite3_errmsg(dtb_));
-                break;
-            }
+        // Switch the status from undo to redo and vv.
+        rc = changeStatusById (
+                    dtb_, active, for_undo ?
+                        RESQUN_MARK_REDO : RESQUN_MARK_UNDO );
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("openReplay(): changeStatusById failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
 
-            char * error_msg;
-            in_undo_ = !for_undo;
-            if (!statements.isEmpty ()) {
-                is_active_ = true;
-                RESQLITEUN_DEBUGM("State changed to active by undo/redo command");
-                rc = sqlite3_exec (
-                            dtb_, statements.toUtf8 ().constData (),
-                            NULL, NULL, &error_msg);
-                RESQLITEUN_DEBUGM("State changed to inactive by undo/redo command");
-                is_active_ = false;
-            }
+        // Get the records needed to get the database to former glory.
+        if (plan == NULL) {
+            plan = new ReplayPlan ();
+            plan->entry_id = active;
+            plan->for_undo = for_undo;
+            rc = buildPlan (*plan, s_error);
             if (rc != SQLITE_OK) {
-                s_error = tr("Cannot perform the update.\n%1").arg  (error_msg);
                 break;
             }
+        }
 
-        } rollback = false;
-        sqlite3_exec (dtb_, "RELEASE SAVEPOINT " RESQUN_SVP_UNDO,
-            NULL, NULL, NULL);
+        // The statements only live until closeReplay().
+        rc = preparePlan (*plan);
+        if (rc != SQLITE_OK) {
+            s_error = tr("Cannot prepare the update.\n%1")
+                    .arg (sqlite3_errmsg (dtb_));
+            break;
+        }
 
+        rollback = false;
+        is_replaying_ = true;
         break;
     }
-    if (rollback) {
+    if (rc != SQLITE_OK) {
+        if (rollback) {
+            sqlite3_exec (dtb_,
+                "ROLLBACK TO SAVEPOINT " RESQUN_SVP_UNDO ";"
+                "RELEASE SAVEPOINT " RESQUN_SVP_UNDO,
+                NULL, NULL, NULL);
+        }
+        releasePlan (plan);
+        plan = NULL;
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * @param plan The plan returned by openReplay(); it is released.
+ * @param commit Keep the changes (true) or roll them back.
+ */
+void ReSqliteUn::closeReplay (ReplayPlan * plan, bool commit)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ChangeSet changes;
+    int reason = plan->for_undo ? ChangedByUndo : ChangedByRedo;
+    if (commit) {
+        sqlite3_exec (dtb_, "RELEASE SAVEPOINT " RESQUN_SVP_UNDO,
+            NULL, NULL, NULL);
+        stats_.add (plan->for_undo ?
+                        ReSqliteUnStats::Undos : ReSqliteUnStats::Redos);
+
+        // The records of the plan tell which rows were changed.
+        if (wantsChanges ()) {
+            QHash<int, int> index;
+            foreach(const ReplayStep & step, plan->steps) {
+                const ReSqliteUnRecord & record = *step.record;
+                addChange (changes, index, step.table_id, record.table_,
+                           record.first_rowid_, record.last_rowid_,
+                           changeOp (record.kind_, plan->for_undo));
+            }
+        }
+    } else {
         sqlite3_exec (dtb_,
             "ROLLBACK TO SAVEPOINT " RESQUN_SVP_UNDO ";"
             "RELEASE SAVEPOINT " RESQUN_SVP_UNDO,
             NULL, NULL, NULL);
     }
+    releasePlan (plan);
+    is_replaying_ = false;
+
+    // The top of the stack moved; prepare the next steps.
+    if (precompile_) {
+        precompile ();
+    } else {
+        discardPlans ();
+    }
+
+    if (commit) {
+        publishChanges (reason, changes);
+    }
+    RESQLITEUN_TRACE_EXIT;
+}
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/**
+ * The records have both images, so replay is not recorded
+ * (our triggers only exist between begin and end).
+ *
+ * @param for_undo Undo (true) or redo.
+ * @param s_error Receives the error message, if any.
+ * @return error code (SQLITE_DONE if there is nothing to undo or redo)
+ */
+ReSqliteUnUtil::SqLiteResult ReSqliteUn::performUndoRedo (
+        bool for_undo, QString &s_error)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    RESQLITEUN_PROBE2(replay__start, dtb_, for_undo);
+    QElapsedTimer timer;
+    timer.start ();
+    qint64 entry_id = -1;
+    int records = 0;
+    ReplayPlan * plan;
+    ReSqliteUnUtil::SqLiteResult rc = openReplay (for_undo, plan, s_error);
+    if (rc == SQLITE_OK) {
+        entry_id = plan->entry_id;
+        records = plan->records.count ();
+        int position = 0;
+        rc = runPlan (*plan, position, -1, s_error);
+        closeReplay (plan, rc == SQLITE_OK);
+    }
+    stats_.addTiming (ReSqliteUnStats::ReplayCount, timer.nsecsElapsed ());
+    RESQLITEUN_PROBE5(replay__done, dtb_, for_undo, entry_id, records, rc);
     RESQLITEUN_TRACE_EXIT;
     return rc;
 }
@@ -464,9 +3200,15 @@ ReSqliteUnUtil::SqLiteResult ReSqliteUn::stepsToGoal (
         bool for_undo, qint64 goal_id, int &steps)
 {
     RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
     ReSqliteUnUtil::SqLiteResult rc = SQLITE_ERROR;
     sqlite3_stmt *stmt = NULL;
     for (;;) {
+        if (!hasSchema ()) {
+            steps = 0;
+            rc = SQLITE_OK;
+            break;
+        }
 
         static const char * stm_undo =
                 "SELECT COUNT(id) FROM " RESQUN_TBL_IDX " "
@@ -518,6 +3260,79 @@ ReSqliteUnUtil::SqLiteResult ReSqliteUn::stepsToGoal (
 /* ========================================================================= */
 
 
+/* ------------------------------------------------------------------------- */
+/**
+ * Same entries as stepsToGoal(), but the sizes saved by end() are also
+ * added, so the cost is known without reading the journal. The rows are
+ * an estimate: a record may be replayed in the other direction (an insert
+ * range is one row per id) and a snapshot counts the rows it copied.
+ *
+ * @param for_undo Undo (true) or redo.
+ * @param goal_id The last entry to undo or redo.
+ * @param steps Receives the number of entries.
+ * @param rows Receives the number of rows those entries change.
+ * @param bytes Receives the size of the images of those entries.
+ * @return error code
+ */
+ReSqliteUnUtil::SqLiteResult ReSqliteUn::costToGoal (
+        bool for_undo, qint64 goal_id, int &steps, qint64 &rows, qint64 &bytes)
+{
+    RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
+    ReSqliteUnUtil::SqLiteResult rc = SQLITE_ERROR;
+    sqlite3_stmt *stmt = NULL;
+    for (;;) {
+        steps = 0;
+        rows = 0;
+        bytes = 0;
+        if (!hasSchema ()) {
+            rc = SQLITE_OK;
+            break;
+        }
+
+        static const char * stm_undo =
+                "SELECT COUNT(id), TOTAL(rows), TOTAL(bytes) "
+                    "FROM " RESQUN_TBL_IDX " "
+                    "WHERE status=" STR(RESQUN_MARK_UNDO) " "
+                    "AND id>=?;\n";
+        static const char * stm_redo =
+                "SELECT COUNT(id), TOTAL(rows), TOTAL(bytes) "
+                    "FROM " RESQUN_TBL_IDX " "
+                    "WHERE status=" STR(RESQUN_MARK_REDO) " "
+                    "AND id <=?;\n";
+
+        rc = sqlite3_prepare_v2 (
+                    dtb_, for_undo ? stm_undo : stm_redo, -1, &stmt, NULL);
+        if (rc != SQLITE_OK) {
+            RESQLITEUN_DEBUGM("costToGoal(): prepare failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+
+        sqlite3_bind_int64 (stmt, 1, goal_id);
+        rc = sqlite3_step (stmt);
+        if (rc != SQLITE_ROW) {
+            RESQLITEUN_DEBUGM("costToGoal(): step failed: %s\n",
+                              sqlite3_errmsg(dtb_));
+            break;
+        }
+
+        steps = sqlite3_column_int (stmt, 0);
+        rows = sqlite3_column_int64 (stmt, 1);
+        bytes = sqlite3_column_int64 (stmt, 2);
+
+        rc = SQLITE_OK;
+        break;
+    }
+    if (stmt != NULL) {
+        sqlite3_finalize(stmt);
+    }
+    RESQLITEUN_TRACE_EXIT;
+    return rc;
+}
+/* ========================================================================= */
+
+
 /* ------------------------------------------------------------------------- */
 /**
  * @warning The result is the error code (SQLITE_OK if all went well).
@@ -530,9 +3345,16 @@ ReSqliteUn::SqLiteResult ReSqliteUn::count (
         qint64 &undo_entries, qint64 &redo_entries) const
 {
     RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
     ReSqliteUn::SqLiteResult rc = SQLITE_OK;
     sqlite3_stmt *stmt = NULL;
     for (;;) {
+        if (!hasSchema ()) {
+            undo_entries = 0;
+            redo_entries = 0;
+            break;
+        }
+
         rc = sqlite3_prepare_v2 (
                     dtb_,
                     "SELECT "
@@ -584,10 +3406,15 @@ ReSqliteUn::SqLiteResult ReSqliteUn::count (
 qint64 ReSqliteUn::getActiveId (UndoRedoType ty) const
 {
     RESQLITEUN_TRACE_ENTRY;
+    ReSqliteUnLocker locker (db_);
     qint64 result = -1;
     ReSqliteUn::SqLiteResult rc = SQLITE_OK;
     sqlite3_stmt *stmt = NULL;
     for (;;) {
+        if (!hasSchema ()) {
+            break;
+        }
+
         static const char * stm_undo =
                 "SELECT MAX(id) FROM " RESQUN_TBL_IDX " "
                     "WHERE status=" STR(RESQUN_MARK_UNDO) ";\n";
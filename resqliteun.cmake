@@ -2,6 +2,18 @@
 # enable/disable cmake debug messages related to this pile
 set (RESQLITEUN_DEBUG_MSG OFF)
 
+# record trace events (spans that can be dumped as Chrome trace json)
+option (RESQLITEUN_TRACE "Build ReSqliteUn with the tracing layer" OFF)
+
+# static probes for perf and bpftrace (see the bpftrace directory)
+option (RESQLITEUN_USDT "Build ReSqliteUn with USDT probes" OFF)
+
+# the resqliteun_bench executable (see bench/resqliteun-bench.cc)
+option (RESQLITEUN_BENCH "Build the ReSqliteUn microbenchmarks" OFF)
+
+# the sources of the benchmarks are relative to this file
+set (RESQLITEUN_PILE_DIR "${CMAKE_CURRENT_LIST_DIR}")
+
 # make sure support code is present; no harm
 # in including it twice; the user, however, should have used
 # pileInclude() from pile_support.cmake module.
@@ -66,15 +78,42 @@ macro    (resqliteunInit
     set(RESQLITEUN_INCLUDES
         ${ICU_INCLUDE_DIRS})
 
+    # the probes come from systemtap's header (systemtap-sdt-dev)
+    if (RESQLITEUN_USDT)
+        include(CheckIncludeFileCXX)
+        check_include_file_cxx("sys/sdt.h" RESQLITEUN_HAVE_SDT_H)
+        if (NOT RESQLITEUN_HAVE_SDT_H)
+            message(FATAL_ERROR "RESQLITEUN_USDT requires sys/sdt.h")
+        endif ()
+    endif ()
+
     # compose the list of headers and sources
     set(RESQLITEUN_HEADERS
         "resqliteun-names.h"
+        "resqliteun-async.h"
+        "resqliteun-asof.h"
+        "resqliteun-changes.h"
+        "resqliteun-history.h"
+        "resqliteun-incremental.h"
         "resqliteun-manager.h"
+        "resqliteun-notifier.h"
+        "resqliteun-record.h"
+        "resqliteun-stats.h"
+        "resqliteun-trace.h"
         "resqliteun-util.h"
         "resqliteun.h")
     set(RESQLITEUN_SOURCES
+        "resqliteun-async.cc"
+        "resqliteun-asof.cc"
+        "resqliteun-changes.cc"
         "resqliteun-entry-points.cc"
+        "resqliteun-history.cc"
+        "resqliteun-incremental.cc"
         "resqliteun-manager.cc"
+        "resqliteun-notifier.cc"
+        "resqliteun-record.cc"
+        "resqliteun-stats.cc"
+        "resqliteun-trace.cc"
         "resqliteun-util.cc"
         "resqliteun.cc")
 
@@ -92,4 +131,12 @@ macro    (resqliteunInit
         "database"
         "sqlite")
 
+    # the benchmarks link with the library and report json on stdout
+    if (RESQLITEUN_BENCH)
+        add_executable(resqliteun_bench
+            "${RESQLITEUN_PILE_DIR}/bench/resqliteun-bench.cc")
+        target_link_libraries(resqliteun_bench
+            ${RESQLITEUN_INIT_NAME})
+    endif ()
+
 endmacro ()
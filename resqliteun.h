@@ -22,9 +22,14 @@
 
 #include <resqliteun/resqliteun-manager.h>
 #include <resqliteun/resqliteun-util.h>
+#include <resqliteun/resqliteun-record.h>
+#include <resqliteun/resqliteun-stats.h>
 
 #include <QString>
+#include <QByteArray>
 #include <QList>
+#include <QHash>
+#include <QSet>
 
 /*  INCLUDES    ============================================================ */
 //
@@ -33,6 +38,11 @@
 //
 /*  DEFINITIONS    --------------------------------------------------------- */
 
+class ReSqliteUnAsync;
+class ReSqliteUnIncremental;
+class QObject;
+struct sqlite3;
+
 /*  DEFINITIONS    ========================================================= */
 //
 //
@@ -49,6 +59,93 @@ class RESQLITEUN_EXPORT ReSqliteUn :
     //
     /*  DEFINITIONS    ----------------------------------------------------- */
 
+public:
+
+    //! A record that was decoded and bound to its statements.
+    struct ReplayStep {
+        const ReSqliteUnRecord * record; /**< the record (owned by the plan) */
+        int table_id; /**< the table changed by the record */
+        int statement; /**< index of the first statement in the plan (-1 for snapshots) */
+        int statement_next; /**< index of the second statement (may be -1) */
+        QList<ReSqliteUnRecord::Value> values; /**< decoded image */
+    };
+
+    //! The replay of an entry in one direction, ready to run.
+    struct ReplayPlan {
+        qint64 entry_id; /**< the entry that is replayed */
+        bool for_undo; /**< undo (true) or redo */
+        QList<ReSqliteUnRecord> records; /**< the records, in order of replay */
+        QList<ReplayStep> steps; /**< one step for each record to run */
+        QStringList sql; /**< the text of the statements, each once */
+        QList<void *> statements; /**< the statements for sql (only while the plan runs) */
+    };
+
+    //! Why a change set is published.
+    enum ChangeReason {
+        ChangedByEnd = 0, /**< an entry was closed */
+        ChangedByUndo, /**< an entry was undone */
+        ChangedByRedo /**< an entry was redone */
+    };
+
+    //! What happened to a range of rows.
+    enum ChangeOp {
+        ChangeInsert = 1, /**< the rows were inserted */
+        ChangeDelete, /**< the rows were deleted */
+        ChangeUpdate, /**< the rows were updated */
+        ChangeReset /**< the whole table was replaced (no rowids) */
+    };
+
+    //! A range of rowids that went through the same change.
+    struct ChangedRows {
+        qint64 first_rowid; /**< first rowid of the range (-1 for ChangeReset) */
+        qint64 last_rowid; /**< last rowid of the range (-1 for ChangeReset) */
+        int op; /**< what happened to the rows (see ChangeOp) */
+    };
+
+    //! The changed rows of a table.
+    struct TableChanges {
+        QString table; /**< the name of the table */
+        QList<ChangedRows> rows; /**< the ranges, in the order of the changes */
+    };
+
+    //! The changes made by an entry, undo or redo, grouped by table.
+    typedef QList<TableChanges> ChangeSet;
+
+    //! A row change seen by the preupdate hook whose triggers may still run.
+    struct PendingChange {
+        QByteArray table; /**< the name of the table */
+        qint64 rowid; /**< the rowid of the row */
+        int op; /**< SQLITE_INSERT, SQLITE_UPDATE or SQLITE_DELETE */
+        int depth; /**< 0 for changes made directly by a statement */
+    };
+
+    //! A preupdate hook of the application (see setPreupdateHook()).
+    typedef void (*PreupdateHook) (
+            void * user_data,
+            sqlite3 * db,
+            int operation,
+            const char * database,
+            const char * table,
+            qint64 old_rowid,
+            qint64 new_rowid);
+
+    //! A progress handler of the application (see setProgressHandler()).
+    typedef int (*ProgressHandler) (
+            void * user_data);
+
+    //! Receives the change sets (see setChangeCallback()).
+    typedef void (*ChangeCallback) (
+            ReSqliteUn * undoer,
+            int reason,
+            const ChangeSet & changes,
+            void * user_data);
+
+    //! A function that receives the change sets (see addChangeListener()).
+    struct ChangeListener {
+        ChangeCallback callback; /**< the function to call */
+        void * user_data; /**< passed to the function as is */
+    };
+
     /*  DEFINITIONS    ===================================================== */
     //
     //
@@ -60,6 +157,43 @@ public:
     void * db_; /**< the actual sqlite database */
     bool is_active_; /**< is the instance active  or not? */
     bool in_undo_; /**< are we performing an undo or a redo (valid when is_active_) */
+    bool is_armed_; /**< did the triggers exist when last checked (see countTriggers()) */
+    CaptureScope capture_scope_; /**< which changes are recorded by tables attached from now on */
+    QList<PendingChange> pending_; /**< changes seen by the preupdate hook, outermost first */
+    PreupdateHook app_hook_; /**< the preupdate hook of the application (may be NULL) */
+    void * app_hook_data_; /**< the user data for app_hook_ */
+    ProgressHandler app_progress_; /**< the progress handler of the application (may be NULL) */
+    void * app_progress_data_; /**< the user data for app_progress_ */
+    int app_progress_opcodes_; /**< instructions between the calls to app_progress_ */
+    QList<TableInfo> tables_; /**< attached tables; the index is the id used by triggers */
+    QHash<QString, int> table_ids_; /**< maps lower case table names to ids */
+    QSet<int> suspended_; /**< tables whose rows are not tracked until resumed */
+    qint64 capture_id_; /**< the entry that receives captured rows */
+    void * stmt_capture_; /**< inserts journal records (only while capturing) */
+    void * stmt_extend_; /**< extends the range of an insert record (only while capturing) */
+    QList<void *> part_values_; /**< first values of a wide row, kept by capturePart() */
+    qint64 last_record_; /**< id of the last record if it was an insert, -1 otherwise */
+    int last_table_; /**< table of the last insert record */
+    qint64 last_rowid_; /**< last rowid covered by the last insert record */
+    bool precompile_; /**< prepare next undo and redo after each change */
+    QList<ReplayPlan *> plans_; /**< replays prepared in advance */
+    int replay_total_; /**< number of steps in the plan being run */
+    int replay_applied_; /**< number of steps of that plan already applied */
+    bool is_replaying_; /**< an undo or redo is in progress */
+    QString effects_key_; /**< the schema that quiet_triggers_ and quiet_fkeys_ were computed for */
+    bool quiet_triggers_; /**< can replay run without the triggers (see replayEffects()) */
+    bool quiet_fkeys_; /**< can replay run without the foreign keys (see replayEffects()) */
+    int schema_version_; /**< version of the schema the triggers were checked against */
+    ReSqliteUnStats stats_; /**< what the instance costs */
+    qint64 entry_records_; /**< journal records written by the entry being captured */
+    qint64 entry_bytes_; /**< journal bytes written by the entry being captured */
+    qint64 entry_rows_; /**< rows captured by the entry being captured */
+    QSet<int> entry_tables_; /**< tables changed by the entry being captured */
+    ChangeCallback change_callback_; /**< receives the change sets (may be NULL) */
+    void * change_data_; /**< the user data for change_callback_ */
+    QList<ChangeListener> change_listeners_; /**< also receive the change sets */
+    ChangeSet changes_; /**< rows changed by the entry being captured */
+    QHash<int, int> change_index_; /**< maps table ids to indices in changes_ */
 
     /*  DATA    ============================================================ */
     //
@@ -78,6 +212,14 @@ public:
     virtual ~ReSqliteUn ();
 
 
+    //! Create the temporary tables if they were not created, yet.
+    ReSqliteUn::SqLiteResult
+    createSchema ();
+
+    //! Do the temporary tables exist?
+    bool
+    hasSchema () const;
+
     //! Creates a restore point.
     ReSqliteUn::SqLiteResult
     begin (
@@ -92,14 +234,309 @@ public:
     ReSqliteUn::SqLiteResult
     attachToTable (
             const QString &table,
+            UpdateBehaviour update_kind,
+            const QStringList &columns = QStringList(),
+            ColumnFilter filter = ExcludeColumns);
+
+    //! The counters of the instance.
+    const ReSqliteUnStats &
+    stats () const {
+        return stats_;
+    }
+
+    //! Set the function that receives the rows changed by end, undo and redo.
+    void
+    setChangeCallback (
+            ChangeCallback callback,
+            void * user_data = NULL);
+
+    //! Add a function that receives the rows changed by end, undo and redo.
+    void
+    addChangeListener (
+            ChangeCallback callback,
+            void * user_data = NULL);
+
+    //! Remove a function added by addChangeListener().
+    void
+    removeChangeListener (
+            ChangeCallback callback,
+            void * user_data = NULL);
+
+    //! Is anyone interested in the rows that change?
+    bool
+    wantsChanges () const {
+        return (change_callback_ != NULL) || !change_listeners_.isEmpty ();
+    }
+
+    //! Add a range of rows to a change set.
+    static void
+    addChange (
+            ChangeSet & changes,
+            QHash<int, int> & index,
+            int table_id,
+            const QString & table,
+            qint64 first_rowid,
+            qint64 last_rowid,
+            int op);
+
+    //! Hand a change set to the callback and the listeners.
+    void
+    publishChanges (
+            int reason,
+            const ChangeSet & changes);
+
+    //! Rebuild the triggers of the tables whose structure changed.
+    ReSqliteUn::SqLiteResult
+    refreshTables ();
+
+    //! Give the shadow table of a table the new columns of the table.
+    ReSqliteUn::SqLiteResult
+    refreshShadow (
+            int table_id,
+            const QStringList &columns,
+            const QList<int> &moved);
+
+    //! Give the journal images of a table the new indices of its columns.
+    ReSqliteUn::SqLiteResult
+    remapJournal (
+            int table_id,
+            const QList<int> &moved);
+
+    //! Remove the entries that changed a table from the history.
+    ReSqliteUn::SqLiteResult
+    dropHistory (
+            int table_id);
+
+    //! Creates the triggers for many tables at once.
+    ReSqliteUn::SqLiteResult
+    attachToTables (
+            const QStringList &tables,
             UpdateBehaviour update_kind);
 
+    //! Creates the triggers for the tables that match a pattern.
+    ReSqliteUn::SqLiteResult
+    attachMatchingTables (
+            const QString &pattern,
+            UpdateBehaviour update_kind,
+            int * count = NULL);
+
+    //! Generate, check and keep the triggers of many tables.
+    ReSqliteUn::SqLiteResult
+    installTables (
+            QList<TableInfo> &infos);
+
+    //! Save the whole table and stop tracking its rows.
+    ReSqliteUn::SqLiteResult
+    suspendTable (
+            const QString &table);
+
+    //! Start tracking the rows of a suspended table again.
+    ReSqliteUn::SqLiteResult
+    resumeTable (
+            const QString &table);
+
+    //! Create the shadow table for a table.
+    ReSqliteUn::SqLiteResult
+    createShadow (
+            int table_id);
+
+    //! Copy the content of a table in its shadow table.
+    ReSqliteUn::SqLiteResult
+    snapshotTable (
+            int table_id);
+
+    //! Replace the content of a table with a snapshot.
+    ReSqliteUn::SqLiteResult
+    restoreTable (
+            int table_id,
+            qint64 restore_key,
+            qint64 save_key = 0);
+
+    //! Select which changes are recorded by tables attached from now on.
+    ReSqliteUn::SqLiteResult
+    setCaptureScope (
+            CaptureScope value);
+
+    //! Set the preupdate hook of the application.
+    void
+    setPreupdateHook (
+            PreupdateHook callback,
+            void * user_data = NULL);
+
+    //! Set the progress handler of the application.
+    void
+    setProgressHandler (
+            int opcodes,
+            ProgressHandler callback,
+            void * user_data = NULL);
+
+    //! Install the preupdate hook required by the scope and the application.
+    void
+    installPreupdateHook (
+            CaptureScope scope);
+
+    //! Remember a change seen by the preupdate hook.
+    void
+    notePreupdate (
+            const char * table,
+            int operation,
+            qint64 rowid,
+            int depth);
+
+    //! Tell if a row was changed directly by a statement.
+    bool
+    isRootChange (
+            const char * table,
+            int operation,
+            qint64 rowid);
+
+    //! Record a row on behalf of a trigger.
+    ReSqliteUn::SqLiteResult
+    captureRow (
+            int table_id,
+            int kind,
+            qint64 rowid,
+            int value_count,
+            void ** values);
+
+    //! Keep the first values of a wide row for captureRow().
+    ReSqliteUn::SqLiteResult
+    capturePart (
+            int value_count,
+            void ** values);
+
+    //! Create the triggers for all attached tables.
+    ReSqliteUn::SqLiteResult
+    armTriggers ();
+
+    //! Drop the triggers for all attached tables.
+    ReSqliteUn::SqLiteResult
+    disarmTriggers ();
+
+    //! Count the triggers of the instance that exist in the database.
+    ReSqliteUn::SqLiteResult
+    countTriggers (
+            int & count);
+
+    //! Release the resources used while capturing.
+    void
+    releaseCapture ();
+
+    //! Release the values kept by capturePart().
+    void
+    releaseParts ();
+
+    //! Save the size of the entry being closed in the index table.
+    ReSqliteUn::SqLiteResult
+    saveEntryCost (
+            qint64 records,
+            qint64 bytes);
+
+    //! Find the id of an attached table.
+    int
+    tableId (
+            const QString & table) const;
+
+    //! Prepare next undo and redo after end(), undo and redo.
+    void
+    setPrecompile (
+            bool value);
+
+    //! Is next undo and redo prepared after end(), undo and redo?
+    bool
+    precompileEnabled () const {
+        return precompile_;
+    }
+
+    //! Prepare the replay of next undo and redo entries.
+    ReSqliteUn::SqLiteResult
+    precompile ();
+
+    //! Release the replays prepared in advance.
+    void
+    discardPlans ();
+
+    //! Load the records associated with an entry in the order of replay.
+    ReSqliteUn::SqLiteResult
+    loadRecords (
+            qint64 entry_id,
+            bool for_undo,
+            QList<ReSqliteUnRecord> & records) const;
+
+    //! Load and decode the records of an entry and prepare the statements.
+    ReSqliteUn::SqLiteResult
+    buildPlan (
+            ReplayPlan & plan,
+            QString & s_error);
+
+    //! Apply the steps of a plan to the database.
+    ReSqliteUn::SqLiteResult
+    runPlan (
+            const ReplayPlan & plan,
+            int & position,
+            qint64 budget_ms,
+            QString & s_error);
+
+    //! Tell if the triggers and the foreign keys can be off during replay.
+    ReSqliteUn::SqLiteResult
+    replayEffects (
+            bool & quiet_triggers,
+            bool & quiet_fkeys);
+
+    //! Prepare the statements of a plan.
+    ReSqliteUn::SqLiteResult
+    preparePlan (
+            ReplayPlan & plan);
+
+    //! Finalize the statements of a plan.
+    static void
+    finalizePlan (
+            ReplayPlan & plan);
+
+    //! Finalize the statements of a plan and delete it.
+    static void
+    releasePlan (
+            ReplayPlan * plan);
+
+    //! Start an undo or redo and get the plan to run.
+    ReSqliteUn::SqLiteResult
+    openReplay (
+            bool for_undo,
+            ReplayPlan *& plan,
+            QString &s_error);
+
+    //! Finish an undo or redo started by openReplay().
+    void
+    closeReplay (
+            ReplayPlan * plan,
+            bool commit);
+
     //! Do an Undo or Redo.
     ReSqliteUn::SqLiteResult
     performUndoRedo (
             bool for_undo,
             QString &s_error);
 
+    //! Start an undo or redo that is applied in slices.
+    ReSqliteUnIncremental *
+    beginUndoRedo (
+            bool for_undo,
+            QString &s_error);
+
+    //! Start an undo that is applied in slices.
+    ReSqliteUnIncremental *
+    beginUndo (
+            QString &s_error) {
+        return beginUndoRedo (true, s_error);
+    }
+
+    //! Start a redo that is applied in slices.
+    ReSqliteUnIncremental *
+    beginRedo (
+            QString &s_error) {
+        return beginUndoRedo (false, s_error);
+    }
+
     //! Do multiple Undo or Redo.
     ReSqliteUn::SqLiteResult
     performUndoRedo (
@@ -107,6 +544,13 @@ public:
             bool for_undo,
             QString &s_error);
 
+    //! Prepare multiple Undo or Redo on a worker thread (call start()).
+    ReSqliteUnAsync *
+    performUndoRedoAsync (
+            int steps,
+            bool for_undo,
+            QObject * parent = NULL);
+
     //! Get the number of steps required to reach a certain id.
     ReSqliteUn::SqLiteResult
     stepsToGoal (
@@ -114,6 +558,15 @@ public:
             qint64 goal_id,
             int &steps);
 
+    //! Get the number of steps, rows and bytes required to reach an id.
+    ReSqliteUn::SqLiteResult
+    costToGoal (
+            bool for_undo,
+            qint64 goal_id,
+            int &steps,
+            qint64 &rows,
+            qint64 &bytes);
+
     //! Get the number of entries in the temporary table by kind.
     SqLiteResult
     count (